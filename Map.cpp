@@ -5,124 +5,811 @@
 //
 
 #include "Map.h"
+#include "decision_trace.h"
+#include "routing/memory_usage.h"
+#include "routing/min_cost_flow.h"
+#include "vector/hilbert.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
 #include <queue>
 #include <utility>
 #include <limits>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
 
-std::pair<float, std::vector<int>>
+std::pair<float, int>
 Map::shortestRouteUsingCapacity(int sourceIndex, CargoType need,
-                                float quantity) {
-  std::priority_queue<std::pair<float, int>> frontier;
-  frontier.push({0.0f, sourceIndex});
-  std::vector<bool> visited;
-  visited.resize(triangulation.vertices.size());
-  std::vector<int> previous;
-  previous.resize(triangulation.vertices.size());
-  std::fill(previous.begin(), previous.end(), -1);
+                                float quantity, std::vector<int>* settled,
+                                float costBound) {
+  if (!decisionTrace) {
+    return searchForRoute(sourceIndex, need, quantity, settled, costBound);
+  }
+  auto start = std::chrono::steady_clock::now();
+  auto route = searchForRoute(sourceIndex, need, quantity, settled,
+                              costBound);
+  auto taken = std::chrono::steady_clock::now() - start;
+  decisionTrace->search(toExternal(sourceIndex), need, quantity, costBound,
+                        settled != nullptr, route.first,
+                        route.second < 0 ? -1 : toExternal(route.second),
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          taken).count());
+  return route;
+}
 
-  std::vector<float> distance;
-  distance.resize(triangulation.vertices.size());
-  std::fill(distance.begin(), distance.end(),
-            std::numeric_limits<float>::infinity());
+std::pair<float, int>
+Map::searchForRoute(int sourceIndex, CargoType need, float quantity,
+                    std::vector<int>* settled, float costBound) {
+  if (!supplierIndex.canSupply(sourceIndex, need, quantity)) {
+    ++lastRoutingStats.searchesRejected;
+    return {std::numeric_limits<float>::infinity(), -1};
+  }
+  ++lastRoutingStats.searches;
+  if (overlay.isBuilt() && settled == nullptr) {
+    std::vector<int> targets;
+    supplierIndex.forEachSupplier(sourceIndex, need, quantity,
+                                  [&](int i) {targets.push_back(i);});
+    auto route = overlay.shortestRoute(*network, scenarioFlows, sourceIndex,
+                                       cargoInfo.wagonTypeForCargo(need),
+                                       quantity, targets, candidatePaths,
+                                       costBound);
+    if (route.second.length == 0) {
+      if (route.first <= costBound) {
+        return {std::numeric_limits<float>::infinity(), -1};
+      }
+      ++lastRoutingStats.searchesCutShort;
+      return {route.first, -1};
+    }
+    return {route.first, candidatePaths.view(route.second).front()};
+  }
+  typedef std::pair<float, int> QueueEntry;
+  // closest first
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>,
+                      std::greater<QueueEntry>> frontier;
+  frontier.push({0.0f, sourceIndex});
 
-  distance[sourceIndex] = 0.f;
+  // scratch storage is only valid where stamped by this search
+  const size_t nodeCount = triangulation.vertices.size();
+  if (searchDistance.size() != nodeCount) {
+    searchDistance.assign(nodeCount, 0.f);
+    searchReached.assign(nodeCount, 0);
+    searchSettled.assign(nodeCount, 0);
+    searchPrevious.assign(nodeCount, -1);
+    bestPrevious.assign(nodeCount, -1);
+    searchStamp = 0;
+  }
+  if (++searchStamp == 0) {
+    std::fill(searchReached.begin(), searchReached.end(), 0);
+    std::fill(searchSettled.begin(), searchSettled.end(), 0);
+    searchStamp = 1;
+  }
+  searchDistance[sourceIndex] = 0.f;
+  searchReached[sourceIndex] = searchStamp;
+  searchPrevious[sourceIndex] = -1;
 
   WagonType t  = cargoInfo.wagonTypeForCargo(need);
+  // the graph may be shared with other scenarios, so only read it here
+  const CargoGraph& graph = *network;
 
   while (!frontier.empty()) {
     auto u_pair = frontier.top();
     frontier.pop();
     float dist_u = u_pair.first;
     int u = u_pair.second;
-    if (indexIsIndustry(u)) {
-      if (industries[u].outputType() == need) {
-        float remaining_capacity = network.nodes[u];
-        if (remaining_capacity >= quantity) {
-          std::vector<int> path {u};
-          while (previous[u] >= 0) {
-            u = previous[u];
-            path.push_back(u);
-          }
-          return {dist_u, path};
-        }   // if (remaning_capacity < capacity)
-      }   // if (industries[u].outputType() == need)
-    }   // if (indexIsIndustry(u))
-    visited[u] = true;
-    for (const auto& v_gr : network.storage[u]) {
+    if (searchSettled[u] == searchStamp) {
+      continue;  // stale entry
+    }
+    if (dist_u > costBound) {
+      // every supplier still to be found costs at least this much
+      ++lastRoutingStats.searchesCutShort;
+      return {dist_u, -1};
+    }
+    if (entities.produces(u, need)) {
+      float remaining_capacity = remainingCapacity(u);
+      if (remaining_capacity >= quantity) {
+        // the path is only built for the winning candidate
+        if (settled) {
+          settled->push_back(u);
+        }
+        return {dist_u, u};
+      }   // if (remaning_capacity < capacity)
+    }   // if (entities.produces(u, need))
+    searchSettled[u] = searchStamp;
+    if (settled) {
+      settled->push_back(u);
+    }
+    for (const auto& v_gr : graph.neighbors(u)) {
       const int v = v_gr.first;
-      if (visited[v]) {
+      if (searchSettled[v] == searchStamp) {
         continue;
       }
-      float outbound_flow = v_gr.second.second[t];
-      float inbound_flow = network.storage[v][u].second[t];
-      float available_capacity = inbound_flow - outbound_flow;
-
-      float effective_quantity = quantity;
-      if (available_capacity > 0) {
-        if (available_capacity >= quantity) {
-          effective_quantity = 0;
-        } else {
-          effective_quantity -= available_capacity;
-        }
-      }
-      float cost = v_gr.second.first * effective_quantity;
+      float outbound_flow = edgeFlows(u, v, v_gr.second)[t];
+      float inbound_flow = edgeFlows(v, u, graph.storage.at(v).at(u))[t];
+      float cost = edgeCostUsingCapacity(v_gr.second.first, outbound_flow,
+                                         inbound_flow, quantity);
 
       float alt = dist_u + cost;
-      if (alt < distance[v]) {
-        distance[v] = alt;
-        previous[v] = u;
+      if (searchReached[v] != searchStamp || alt < searchDistance[v]) {
+        searchReached[v] = searchStamp;
+        searchDistance[v] = alt;
+        searchPrevious[v] = u;
         frontier.emplace(alt, v);
       }
     }
   }   // while
-  return {};  // zero cost and empty path
+  // no supplier at any cost
+  return {std::numeric_limits<float>::infinity(), -1};
 }
 
 
 void Map::triangulateAllLocations() {
-  std::vector<Point2D> allLocations {};
-  for (auto & industry : industries) {
-    allLocations.push_back(industry.location());
-  }
-  for (auto & town : towns) {
-    allLocations.push_back(town.location());
-  }
-  triangulation = IndexedDelaunay(allLocations);
+  triangulation = IndexedDelaunay(entities.locations());
+  MemoryReport report = memoryUsage();
+  report.triangulation = triangulation.memoryUsageDuringConstruction();
+  recordMemoryUsage(MemoryPhase::Triangulation, report);
   triangulation.maskSliverTrianglesOnBoundary(0.15);
+  pointLocator.build(triangulation);
+  recordMemoryUsage(MemoryPhase::Triangulation, memoryUsage());
 }
 
 void Map::buildNetworkGraph() {
-  network = CargoGraph(triangulation);
-  for (const auto& edge : network.allEdges()) {
+  network = std::make_shared<CargoGraph>(triangulation);
+  overlay = CargoGraphOverlay();
+  triangulationEdges.clear();
+  for (const auto& edge : network->edges()) {
+    triangulationEdges.push_back(edge);
+  }
+  std::sort(triangulationEdges.begin(), triangulationEdges.end(),
+            [](const IndexedEdge& x, const IndexedEdge& y) {
+              return x.a != y.a ? x.a < y.a : x.b < y.b;
+            });
+  std::vector<LineSegment> segments;
+  segments.reserve(triangulationEdges.size());
+  for (const auto& edge : triangulationEdges) {
+    segments.emplace_back(triangulation.vertices[edge.a],
+                          triangulation.vertices[edge.b]);
+  }
+  edgeGrid.build(segments);
+  freeEdgeSlots.clear();
+  edgeBlockCount.assign(triangulationEdges.size(), 0);
+  edgesBlockedByLine.assign(impassableLines.size(), {});
+  blockedEdges.clear();
+  for (int i = 0; i < impassableLines.size(); ++i) {
+    if (!impassableLineRemoved[i]) {
+      blockEdgesCrossing(i);
+    }
+  }
+  for (int i = 0; i < industryCount(); ++i) {
+    network->nodes[i] = IndustryInfo::maxProduction(entities.outputType(i));
+  }
+  if (isRenumbered()) {
+    network->layOutInNodeOrder();
+  }
+  buildSupplierIndex();
+  recordMemoryUsage(MemoryPhase::NetworkGraph, memoryUsage());
+}
+
+bool Map::hasConnections() const {
+  if (!all_paths.empty() || !committedConnections.empty()
+      || pathPool.size() > 0) {
+    return true;
+  }
+  // connections released to a sink still used supplier capacity
+  for (const auto& node : network->nodes) {
+    if (node.first < industryCount()
+        && node.second != IndustryInfo::maxProduction(
+             entities.outputType(node.first))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Map::renumberForLocality() {
+  const int nodeCount = static_cast<int>(triangulation.vertices.size());
+  if (hasConnections()) {
+    // paths, flows and re-planning records would all need renumbering
+    return false;
+  }
+  if (nodeCount == 0) {
+    return true;
+  }
+  const BBox bounds(triangulation.vertices);
+  std::vector<uint64_t> key(nodeCount);
+  for (int i = 0; i < nodeCount; ++i) {
+    key[i] = hilbertIndex(triangulation.vertices[i], bounds);
+  }
+  // order[n] is the node renumbered n, industries staying before towns
+  std::vector<int> order(nodeCount);
+  for (int i = 0; i < nodeCount; ++i) {
+    order[i] = i;
+  }
+  auto byKey = [&key](int a, int b) {return key[a] < key[b];};
+  std::stable_sort(order.begin(), order.begin() + industryCount(), byKey);
+  std::stable_sort(order.begin() + industryCount(), order.end(), byKey);
+  std::vector<int> newIndex(nodeCount);
+  for (int n = 0; n < nodeCount; ++n) {
+    newIndex[order[n]] = n;
+  }
+
+  std::vector<int> external(nodeCount);
+  for (int n = 0; n < nodeCount; ++n) {
+    external[n] = toExternal(order[n]);
+  }
+  entities.permute(order);
+  triangulation.renumberVertices(newIndex);
+  pointLocator.build(triangulation);
+  externalNode.swap(external);
+  internalNode.assign(nodeCount, 0);
+  externalNodeLocations.resize(nodeCount);
+  for (int n = 0; n < nodeCount; ++n) {
+    internalNode[externalNode[n]] = n;
+    externalNodeLocations[externalNode[n]] = triangulation.vertices[n];
+  }
+
+  // requirements set so far
+  std::unordered_map<NodeAndNeed, float, NodeAndNeed_hash> renumberedNeeds;
+  for (const auto& p : connectionsToMake) {
+    renumberedNeeds[{newIndex[p.first.first], p.first.second}] = p.second;
+  }
+  connectionsToMake.swap(renumberedNeeds);
+  buildNetworkGraph();
+  return true;
+}
+
+void Map::restoreNumbering() {
+  if (!isRenumbered()) {
+    return;
+  }
+  // externalNode holds the original index of each node
+  const std::vector<int>& originalIndex = externalNode;
+  entities.permute(internalNode);
+  triangulation.renumberVertices(originalIndex);
+  pointLocator.build(triangulation);
+  renumberNodeRecords(originalIndex);
+  buildSupplierIndex();
+  externalNode.clear();
+  internalNode.clear();
+  externalNodeLocations.clear();
+}
+
+void Map::renumberNodeRecords(const std::vector<int>& newIndex) {
+  writableNetwork().renumberNodes(newIndex);
+  overlay = CargoGraphOverlay();
+
+  // edges keep their positions, so barriers still refer to them, and the
+  // edge grid, which only holds positions and coordinates, stays valid
+  std::unordered_map<IndexedEdge, std::array<CargoGraph::WeightedEdge, 2>>
+    renumberedBlockedEdges;
+  for (IndexedEdge& edge : triangulationEdges) {
+    if (edge.a < 0) {
+      continue;  // a free slot
+    }
+    const IndexedEdge renumbered(newIndex[edge.a], newIndex[edge.b]);
+    const bool reversed = renumbered.a > renumbered.b;
+    auto blocked = blockedEdges.find(edge);
+    edge = reversed ? IndexedEdge(renumbered.b, renumbered.a) : renumbered;
+    if (blocked != blockedEdges.end()) {
+      // flows are stored from a to b, then from b to a
+      auto& flows = renumberedBlockedEdges[edge];
+      flows = blocked->second;
+      if (reversed) {
+        std::swap(flows[0], flows[1]);
+      }
+    }
+  }
+  blockedEdges.swap(renumberedBlockedEdges);
+
+  // paths of connections since ripped up may still hold a node removed
+  pathPool.renumberNodes(newIndex);
+  for (auto* connections : {&all_paths, &committedConnections}) {
+    for (ConnectionInformation& info : *connections) {
+      // slots of ripped up connections may hold a node already removed
+      for (int* node : {&info.supplierIndex, &info.consumerIndex}) {
+        if (*node >= 0) {
+          *node = newIndex[*node];
+        }
+      }
+    }
+  }
+  // requirements of a node removed have already been dropped
+  auto renumberNeeds = [&newIndex](auto& byNeed) {
+    std::remove_reference_t<decltype(byNeed)> renumbered;
+    for (auto& p : byNeed) {
+      if (newIndex[p.first.first] >= 0) {
+        renumbered[{newIndex[p.first.first], p.first.second}] =
+          std::move(p.second);
+      }
+    }
+    byNeed.swap(renumbered);
+  };
+  renumberNeeds(committedByConsumer);
+  renumberNeeds(lastSearchCost);
+  renumberNeeds(connectionsToMake);
+  std::unordered_map<int, std::vector<size_t>> renumberedBySupplier;
+  for (auto& p : committedBySupplier) {
+    if (newIndex[p.first] >= 0) {
+      renumberedBySupplier[newIndex[p.first]] = std::move(p.second);
+    }
+  }
+  committedBySupplier.swap(renumberedBySupplier);
+  candidates.clear();
+  candidateForKey.clear();
+  settledBy.clear();
+  greedySearches.clear();
+  greedySearchForKey.clear();
+  greedySettledBy.clear();
+}
+
+void Map::buildSupplierIndex() {
+  std::vector<CargoType> outputTypes;
+  for (int i = 0; i < industryCount(); ++i) {
+    outputTypes.push_back(entities.outputType(i));
+  }
+  supplierIndex.build(*network,
+                      static_cast<int>(triangulation.vertices.size()),
+                      outputTypes);
+}
+
+std::vector<int> Map::blockEdgesCrossing(int barrier) {
+  const Line2D& line = impassableLines[barrier];
+  std::vector<int> candidates;
+  for (int i = 0, j = 1; j < line.size(); ++i, ++j) {
+    edgeGrid.query(LineSegment(line[i], line[j]), candidates);
+  }
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                   candidates.end());
+
+  std::vector<int> removed;
+  for (int e : candidates) {
+    const IndexedEdge& edge = triangulationEdges[e];
     LineSegment l = {triangulation.vertices[edge.a],
                      triangulation.vertices[edge.b]};
-    for (const auto& line : impassableLines) {
-      if (l.intersectsLine(line)) {
-        network.removeEdge(edge);
-      }
+    if (l.intersectsLine(line) && blockEdge(barrier, e)) {
+      removed.push_back(e);
+    }
+  }
+  return removed;
+}
+
+bool Map::blockEdge(int barrier, int e) {
+  edgesBlockedByLine[barrier].push_back(e);
+  if (edgeBlockCount[e]++ > 0) {
+    return false;
+  }
+  const IndexedEdge& edge = triangulationEdges[e];
+  CargoGraph& graph = writableNetwork();
+  blockedEdges.emplace(edge, std::array<CargoGraph::WeightedEdge, 2> {
+    graph.storage[edge.a][edge.b], graph.storage[edge.b][edge.a]});
+  graph.removeEdge(edge);
+  return true;
+}
+
+void Map::addTriangulationEdge(IndexedEdge edge) {
+  const LineSegment segment(triangulation.vertices[edge.a],
+                            triangulation.vertices[edge.b]);
+  writableNetwork().addEdge(edge, (segment.b - segment.a).length());
+  int e = static_cast<int>(triangulationEdges.size());
+  if (freeEdgeSlots.empty()) {
+    triangulationEdges.push_back(edge);
+    edgeBlockCount.push_back(0);
+  } else {
+    e = freeEdgeSlots.back();
+    freeEdgeSlots.pop_back();
+    triangulationEdges[e] = edge;
+  }
+  edgeGrid.insert(e, segment);
+  for (int i = 0; i < impassableLines.size(); ++i) {
+    if (!impassableLineRemoved[i]
+        && segment.intersectsLine(impassableLines[i])) {
+      blockEdge(i, e);
+    }
+  }
+}
+
+void Map::removeTriangulationEdge(int e) {
+  const IndexedEdge edge = triangulationEdges[e];
+  if (edgeBlockCount[e] > 0) {
+    blockedEdges.erase(edge);
+    for (auto& blocked : edgesBlockedByLine) {
+      blocked.erase(std::remove(blocked.begin(), blocked.end(), e),
+                    blocked.end());
+    }
+    edgeBlockCount[e] = 0;
+  } else {
+    writableNetwork().removeEdge(edge);
+  }
+  // the locations of its ends, which the triangulation may have renumbered
+  edgeGrid.remove(e, LineSegment(entities.location(edge.a),
+                                 entities.location(edge.b)));
+  triangulationEdges[e] = IndexedEdge(-1, -1);
+  freeEdgeSlots.push_back(e);
+}
+
+IndexedDelaunay::LocalChange
+Map::retriangulate(const std::vector<Point2D>& locations,
+                   const std::vector<int>& oldIndex) {
+  IndexedDelaunay rebuilt(locations);
+  rebuilt.maskSliverTrianglesOnBoundary(triangulation.sliverAngle);
+  std::unordered_set<IndexedEdge> before;
+  for (const IndexedEdge& edge : triangulationEdges) {
+    if (edge.a >= 0) {
+      before.insert(edge);
+    }
+  }
+  std::unordered_set<IndexedEdge> after;
+  for (int t = 0; t < rebuilt.triangleCount(); ++t) {
+    if (rebuilt.isTriangleMasked(t)) {
+      continue;
+    }
+    for (const auto& edge : rebuilt.triangles[t].edges()) {
+      const int a = oldIndex[edge.a];
+      const int b = oldIndex[edge.b];
+      after.insert({std::min(a, b), std::max(a, b)});
     }
   }
-  for (int i = 0; i < industries.size(); ++i) {
-    network.nodes[i] = industries[i].maxOutput();
+  IndexedDelaunay::LocalChange change;
+  for (const IndexedEdge& edge : before) {
+    if (after.count(edge) == 0) {
+      change.edgesRemoved.push_back(edge);
+    }
+  }
+  for (const IndexedEdge& edge : after) {
+    if (before.count(edge) == 0) {
+      change.edgesAdded.push_back(edge);
+    }
   }
+  triangulation = std::move(rebuilt);
+  return change;
+}
+
+template <class F>
+size_t Map::applyTriangulationChange(
+    const IndexedDelaunay::LocalChange& change,
+    std::unordered_map<NodeAndNeed, float, NodeAndNeed_hash>& requirements,
+    F renumber) {
+  std::unordered_set<IndexedEdge> edgesRemoved(change.edgesRemoved.begin(),
+                                               change.edgesRemoved.end());
+  std::vector<int> removed;
+  for (int e = 0; e < triangulationEdges.size(); ++e) {
+    if (edgesRemoved.count(triangulationEdges[e]) != 0) {
+      removed.push_back(e);
+    }
+  }
+  // flows on removed edges go with them, so rip up their connections first
+  for (const NodeAndNeed& key : connectionsUsing(removed, false)) {
+    const NodeAndNeed internal {toInternal(key.first), key.second};
+    requirements.emplace(internal, currentRequirement(internal));
+  }
+  std::vector<NodeAndNeed> keys;
+  std::vector<float> quantities;
+  for (const auto& requirement : requirements) {
+    keys.push_back(requirement.first);
+    quantities.push_back(requirement.second);
+  }
+  ripUpRequirements(keys, quantities);
+  for (int e : removed) {
+    removeTriangulationEdge(e);
+  }
+
+  const std::vector<int> newIndex = renumber();
+  for (const IndexedEdge& edge : change.edgesAdded) {
+    const int a = newIndex[edge.a];
+    const int b = newIndex[edge.b];
+    addTriangulationEdge({std::min(a, b), std::max(a, b)});
+  }
+  pointLocator.build(triangulation);
+  overlay = CargoGraphOverlay();
+  buildSupplierIndex();
+  return removed.size() + change.edgesAdded.size();
+}
+
+Map::LocationUpdate Map::insertIndustry(const Industry& industry) {
+  LocationUpdate update;
+  restoreNumbering();
+  update.node = static_cast<int>(industryCount());
+  if (!edgeGrid.isBuilt()) {
+    entities.addIndustry(industry);
+    return update;
+  }
+  const bool replan = hasConnections();
+  lastRoutingStats = RoutingStats();
+  traceRunStarted();
+  const int n = static_cast<int>(triangulation.vertices.size());
+  IndexedDelaunay::LocalChange change;
+  update.inPlace = triangulation.insertVertex(industry.location(), change);
+  if (!update.inPlace) {
+    std::vector<Point2D> locations = triangulation.vertices;
+    locations.push_back(industry.location());
+    std::vector<int> oldIndex(n + 1);
+    for (int i = 0; i <= n; ++i) {
+      oldIndex[i] = i;
+    }
+    change = retriangulate(locations, oldIndex);
+  }
+  std::unordered_map<NodeAndNeed, float, NodeAndNeed_hash> requirements;
+  update.edgesChanged = applyTriangulationChange(change, requirements, [&]() {
+    // the new vertex, numbered n, becomes the last industry
+    std::vector<int> newIndex(n + 1);
+    for (int i = 0; i < n; ++i) {
+      newIndex[i] = i < update.node ? i : i + 1;
+    }
+    newIndex[n] = update.node;
+    entities.addIndustry(industry);
+    triangulation.renumberVertices(newIndex);
+    renumberNodeRecords(newIndex);
+    writableNetwork().nodes[update.node] =
+      IndustryInfo::maxProduction(industry.outputType());
+    return newIndex;
+  });
+  update.requirementsReplanned = requirements.size();
+  if (replan) {
+    routeOutstandingRequirements();
+  } else {
+    traceRunFinished();
+  }
+  return update;
+}
+
+Map::LocationUpdate Map::insertTown(Town town) {
+  LocationUpdate update;
+  restoreNumbering();
+  update.node = static_cast<int>(entities.nodeCount());
+  if (!edgeGrid.isBuilt()) {
+    entities.addTown(std::move(town));
+    return update;
+  }
+  const bool replan = hasConnections();
+  lastRoutingStats = RoutingStats();
+  traceRunStarted();
+  const int n = update.node;
+  IndexedDelaunay::LocalChange change;
+  update.inPlace = triangulation.insertVertex(town.location(), change);
+  if (!update.inPlace) {
+    std::vector<Point2D> locations = triangulation.vertices;
+    locations.push_back(town.location());
+    std::vector<int> oldIndex(n + 1);
+    for (int i = 0; i <= n; ++i) {
+      oldIndex[i] = i;
+    }
+    change = retriangulate(locations, oldIndex);
+  }
+  std::unordered_map<NodeAndNeed, float, NodeAndNeed_hash> requirements;
+  update.edgesChanged = applyTriangulationChange(change, requirements, [&]() {
+    // the new vertex is already numbered after the other towns
+    std::vector<int> newIndex(n + 1);
+    for (int i = 0; i <= n; ++i) {
+      newIndex[i] = i;
+    }
+    entities.addTown(std::move(town));
+    return newIndex;
+  });
+  update.requirementsReplanned = requirements.size();
+  if (replan) {
+    routeOutstandingRequirements();
+  } else {
+    traceRunFinished();
+  }
+  return update;
+}
+
+Map::LocationUpdate Map::removeLocation(int node) {
+  LocationUpdate update;
+  restoreNumbering();
+  update.node = node;
+  if (node < 0 || node >= entities.nodeCount()) {
+    return update;
+  }
+  // the requirements of the location are dropped
+  std::unordered_map<NodeAndNeed, float, NodeAndNeed_hash> requirements;
+  for (const auto& p : connectionsToMake) {
+    if (p.first.first == node) {
+      requirements[p.first] = 0.f;
+    }
+  }
+  for (const auto& p : committedByConsumer) {
+    if (p.first.first == node) {
+      requirements[p.first] = 0.f;
+    }
+  }
+  const int n = static_cast<int>(entities.nodeCount());
+  std::vector<int> newIndex(n);
+  for (int i = 0; i < n; ++i) {
+    newIndex[i] = i < node ? i : i == node ? -1 : i - 1;
+  }
+  if (!edgeGrid.isBuilt()) {
+    for (const auto& requirement : requirements) {
+      connectionsToMake.erase(requirement.first);
+    }
+    entities.remove(node);
+    renumberNodeRecords(newIndex);
+    return update;
+  }
+  const bool replan = hasConnections();
+  lastRoutingStats = RoutingStats();
+  traceRunStarted();
+  IndexedDelaunay::LocalChange change;
+  update.inPlace = triangulation.removeVertex(node, change);
+  if (!update.inPlace) {
+    std::vector<Point2D> locations = triangulation.vertices;
+    locations.erase(locations.begin() + node);
+    std::vector<int> oldIndex(n - 1);
+    for (int i = 0; i < n - 1; ++i) {
+      oldIndex[i] = i < node ? i : i + 1;
+    }
+    change = retriangulate(locations, oldIndex);
+  }
+  update.edgesChanged = applyTriangulationChange(change, requirements, [&]() {
+    CargoGraph& graph = writableNetwork();
+    graph.storage.erase(node);
+    graph.nodes.erase(node);
+    entities.remove(node);
+    renumberNodeRecords(newIndex);
+    return newIndex;
+  });
+  update.requirementsReplanned = requirements.size();
+  if (replan) {
+    routeOutstandingRequirements();
+  } else {
+    traceRunFinished();
+  }
+  return update;
+}
+
+std::vector<Map::NodeAndNeed>
+Map::connectionsUsing(const std::vector<int>& edges, bool byNode) const {
+  std::unordered_set<IndexedEdge> edgeSet;
+  std::unordered_set<int> nodeSet;
+  for (int e : edges) {
+    edgeSet.insert(triangulationEdges[e]);
+    nodeSet.insert(triangulationEdges[e].a);
+    nodeSet.insert(triangulationEdges[e].b);
+  }
+  std::vector<NodeAndNeed> result;
+  std::unordered_set<NodeAndNeed, NodeAndNeed_hash> seen;
+  for (size_t c = 0; c < committedConnections.size(); ++c) {
+    if (!committedConnectionActive[c]) {
+      continue;
+    }
+    const ConnectionInformation& info = committedConnections[c];
+    PathPool::View path = pathPool.view(info.path);
+    bool uses = false;
+    for (int i = 0, j = 1; j < path.size() && !uses; ++i, ++j) {
+      uses = byNode
+        ? nodeSet.count(path[i]) || nodeSet.count(path[j])
+        : edgeSet.count({std::min(path[i], path[j]),
+                         std::max(path[i], path[j])});
+    }
+    NodeAndNeed key {toExternal(info.consumer()), info.cargoType};
+    if (uses && seen.insert(key).second) {
+      result.push_back(key);
+    }
+  }
+  return result;
+}
+
+Map::BarrierUpdate Map::addImpassableLine(const Line2D& line) {
+  BarrierUpdate update;
+  update.barrier = static_cast<int>(impassableLines.size());
+  impassableLines.push_back(line);
+  impassableLineRemoved.push_back(false);
+  if (!edgeGrid.isBuilt()) {
+    return update;
+  }
+  edgesBlockedByLine.emplace_back();
+  std::vector<int> removed = blockEdgesCrossing(update.barrier);
+  update.edgesChanged = removed.size();
+  if (!removed.empty()) {
+    // components may have split, and overlay cells no longer match
+    overlay = CargoGraphOverlay();
+    buildSupplierIndex();
+    update.connectionsToReroute = connectionsUsing(removed, false);
+  }
+  return update;
+}
+
+Map::BarrierUpdate Map::removeImpassableLine(int barrier) {
+  BarrierUpdate update;
+  update.barrier = barrier;
+  if (barrier < 0 || barrier >= impassableLines.size()
+      || impassableLineRemoved[barrier]) {
+    return update;
+  }
+  impassableLineRemoved[barrier] = true;
+  if (!edgeGrid.isBuilt()) {
+    return update;
+  }
+  CargoGraph& graph = writableNetwork();
+  std::vector<int> restored;
+  for (int e : edgesBlockedByLine[barrier]) {
+    if (--edgeBlockCount[e] > 0) {
+      continue;
+    }
+    const IndexedEdge& edge = triangulationEdges[e];
+    auto it = blockedEdges.find(edge);
+    graph.storage[edge.a][edge.b] = it->second[0];
+    graph.storage[edge.b][edge.a] = it->second[1];
+    blockedEdges.erase(it);
+    restored.push_back(e);
+  }
+  edgesBlockedByLine[barrier].clear();
+  edgesBlockedByLine[barrier].shrink_to_fit();
+  update.edgesChanged = restored.size();
+  if (!restored.empty()) {
+    overlay = CargoGraphOverlay();
+    buildSupplierIndex();
+    update.connectionsToReroute = connectionsUsing(restored, true);
+  }
+  return update;
+}
+
+Map::TriangleLocation Map::locate(Point2D p) const {
+  TriangleLocation location {false, {-1, -1, -1}};
+  int i = pointLocator.locate(triangulation, p);
+  if (i >= 0) {
+    const IndexedTriangle& tri = triangulation.triangles[i];
+    location = {true, {toExternal(tri.a), toExternal(tri.b),
+                       toExternal(tri.c)}};
+  }
+  return location;
+}
+
+int Map::nearestNode(Point2D p) const {
+  int node = pointLocator.nearestVertex(triangulation, p);
+  return node < 0 ? -1 : toExternal(node);
+}
+
+bool Map::enableOverlayRouting(int levelCount, int cellSize) {
+  return overlay.build(*network, triangulation.vertices, levelCount, cellSize);
 }
 
 void Map::setUniformTownCargoRequirement(float town_cargo_need) {
-  for (int i = 0; i < towns.size(); ++i) {
+  for (int i = 0; i < entities.townCount(); ++i) {
     int id = static_cast<int>(industryCount()) + i;
-    for (auto req : towns[i].cargoRequired()) {
+    for (auto req : entities.cargoRequired(id)) {
       connectionsToMake[{id, req}] = town_cargo_need;
     }
   }
 }
 
+void Map::setCargoRequirement(int node, CargoType need, float quantity) {
+  node = toInternal(node);
+  if (quantity > 0.f) {
+    connectionsToMake[{node, need}] = quantity;
+  } else {
+    connectionsToMake.erase({node, need});
+  }
+}
+
 Map::ConnectionInformation Map::findCheapestOutstandingConnection() {
-  ConnectionInformation result {std::numeric_limits<float>::infinity()};
+  const float infinity = std::numeric_limits<float>::infinity();
+  ConnectionInformation result {infinity};
+  candidatePaths.clear();
+  PathPool::Handle bestCandidatePath;
+  int bestSupplier = -1;
+  // searches are only kept when they record the nodes they settle, which
+  // the overlay does not
+  const bool reuseSearches = !overlay.isBuilt();
+
+  // search the connections that were cheap last time first, so the best
+  // so far soon bounds the searches for the rest
+  struct Outstanding {
+    float estimate;
+    size_t position;
+    NodeAndNeed key;
+    float quantity;
+    /// whether a search of an earlier round still holds
+    bool hasKept;
+    GreedySearch kept;
+  };
+  std::vector<Outstanding> outstanding;
+  outstanding.reserve(connectionsToMake.size());
   for (auto &p : connectionsToMake) {
-    int id = p.first.first;
-    CargoType need = p.first.second;
     float quantity = p.second;
     if (quantity == 0.f) {
       continue;
@@ -131,17 +818,150 @@ Map::ConnectionInformation Map::findCheapestOutstandingConnection() {
     if (quantity > industry_max_production) {
       quantity = industry_max_production;
     }
-    auto path = shortestRouteUsingCapacity(id, need, quantity);
-    if (path.first < result.cost) {
-      result.cost = path.first;
-      result.path = path.second;
-      result.cargoType = need;
-      result.quantity = quantity;
+    auto last = lastSearchCost.find(p.first);
+    float estimate = last == lastSearchCost.end() ? 0.f : last->second;
+    GreedySearch kept {};
+    auto search = greedySearchForKey.find(p.first);
+    if (search != greedySearchForKey.end()) {
+      kept = greedySearches[search->second];
+    }
+    outstanding.push_back({estimate, outstanding.size(), p.first, quantity,
+                           kept.valid && kept.quantity == quantity, kept});
+  }
+
+  // routes found in earlier rounds which no connection made since has
+  // touched still cost the same, only the cheapest of them needs its path
+  size_t bestPosition = 0;
+  bool bestKept = false;
+  for (const auto& o : outstanding) {
+    if (o.hasKept && o.kept.supplier >= 0
+        && (bestSupplier < 0 || o.kept.cost < result.cost
+            || (o.kept.cost == result.cost && o.position < bestPosition))) {
+      result.cost = o.kept.cost;
+      result.cargoType = o.key.second;
+      result.quantity = o.quantity;
+      result.supplierIndex = o.kept.supplier;
+      result.consumerIndex = o.key.first;
+      bestSupplier = o.kept.supplier;
+      bestPosition = o.position;
+      bestKept = true;
+    }
+  }
+  std::stable_sort(outstanding.begin(), outstanding.end(),
+                   [](const Outstanding& a, const Outstanding& b) {
+                     return a.estimate < b.estimate;
+                   });
+
+  for (const auto& o : outstanding) {
+    int id = o.key.first;
+    CargoType need = o.key.second;
+    if (deadlinePassed()) {
+      // an unfinished round cannot tell which connection is cheapest
+      return ConnectionInformation {infinity};
+    }
+    // ties go to the connection first in the outstanding list, as they
+    // would if every connection were searched in list order
+    float costBound = infinity;
+    if (bestSupplier >= 0) {
+      costBound = o.position < bestPosition
+        ? result.cost : std::nextafter(result.cost, -infinity);
     }
+    if (o.hasKept && (o.kept.supplier >= 0 || o.kept.cost > costBound
+                      || o.kept.cost == infinity)) {
+      continue;  // counted above, or cannot be the cheapest
+    }
+    size_t candidatePathsSize = candidatePaths.size();
+    std::vector<int>* settled = nullptr;
+    if (reuseSearches) {
+      settled = &settledScratch;
+      settled->clear();
+    }
+    auto route = shortestRouteUsingCapacity(id, need, o.quantity, settled,
+                                            costBound);
+    lastSearchCost[o.key] = route.first;
+    if (reuseSearches) {
+      auto inserted = greedySearchForKey.emplace(o.key,
+                                                 greedySearches.size());
+      if (inserted.second) {
+        greedySearches.push_back({});
+      }
+      GreedySearch& search = greedySearches[inserted.first->second];
+      search = {o.quantity, route.first, route.second,
+                cargoInfo.wagonTypeForCargo(need), search.generation + 1,
+                true};
+      if (route.first != infinity) {
+        // a connection which cannot be reached now never can be in this
+        // run, as supplier capacity only falls
+        for (int node : *settled) {
+          greedySettledBy[node].emplace_back(inserted.first->second,
+                                             search.generation);
+        }
+      }
+    }
+    if (route.second < 0) {
+      continue;  // no supplier with enough capacity, or none cheap enough
+    }
+    result.cost = route.first;
+    result.cargoType = need;
+    result.quantity = o.quantity;
+    result.supplierIndex = route.second;
+    result.consumerIndex = id;
+    bestSupplier = route.second;
+    bestPosition = o.position;
+    bestKept = false;
+    if (overlay.isBuilt()) {
+      bestCandidatePath = {static_cast<uint32_t>(candidatePathsSize),
+        static_cast<uint32_t>(candidatePaths.size() - candidatePathsSize)};
+    } else {
+      // keep the predecessors of this search, the next one reuses the
+      // other buffer
+      std::swap(searchPrevious, bestPrevious);
+    }
+  }
+  if (bestKept) {
+    // searching again retraces the same route
+    shortestRouteUsingCapacity(result.consumerIndex, result.cargoType,
+                               result.quantity, nullptr, result.cost);
+    std::swap(searchPrevious, bestPrevious);
+  }
+  if (bestSupplier >= 0) {
+    result.path = overlay.isBuilt()
+      ? pathPool.append(candidatePaths, bestCandidatePath)
+      : pathPool.appendChain(bestPrevious, bestSupplier);
   }
   return result;
 }
 
+void Map::invalidateGreedySearches(const ConnectionInformation& info) {
+  // The flows along the path changed, which only matters to searches of
+  // the same wagon type which relaxed an edge of the path. Searches which
+  // never settled a node of it would run exactly as before.
+  WagonType wagonType = cargoInfo.wagonTypeForCargo(info.cargoType);
+  for (int node : pathPool.view(info.path)) {
+    auto& entries = greedySettledBy[node];
+    size_t kept = 0;
+    for (const auto& entry : entries) {
+      GreedySearch& search = greedySearches[entry.first];
+      if (search.generation != entry.second) {
+        continue;  // searched again since
+      }
+      if (search.wagonType == wagonType) {
+        search.valid = false;
+        continue;
+      }
+      entries[kept++] = entry;
+    }
+    entries.resize(kept);
+  }
+  float remaining_capacity = remainingCapacity(info.supplier());
+  for (auto& search : greedySearches) {
+    if (search.supplier == info.supplier()
+        && remaining_capacity < search.quantity) {
+      search.valid = false;
+    }
+  }
+}
+
 void Map::removeConnectionFromOutstanding(const ConnectionInformation& info) {
   int id = info.consumer();
   CargoType need = info.cargoType;
@@ -150,40 +970,214 @@ void Map::removeConnectionFromOutstanding(const ConnectionInformation& info) {
 
   if (connectionsToMake[{id, need}] == 0) {
     connectionsToMake.erase({id, need});
+    lastSearchCost.erase({id, need});
   }
 }
 
-void Map::addPathOrInreaseCapacity(const ConnectionInformation& info) {
+void Map::addPathOrInreaseCapacity(ConnectionInformation& info) {
   for (auto& p : all_paths) {
     if (p.cargoType == info.cargoType
         && p.consumer() == info.consumer()
         && p.supplier() == info.supplier()
-        && p.path == info.path) {
+        && pathPool.equal(p.path, info.path)) {
       p.quantity += info.quantity;
       p.cost += info.cost;
+      pathPool.discardLast(info.path);
+      info.path = p.path;
       return;
     }
   }
   all_paths.push_back(info);
 }
 
+std::array<float, WagonTypeCount>& Map::writableEdgeFlows(int x, int y) {
+  if (isScenario) {
+    return scenarioFlows.writableFlows(x, y,
+                                       network->storage.at(x).at(y).second);
+  }
+  return writableNetwork().storage[x][y].second;
+}
+
+float& Map::writableCapacity(int supplier) {
+  if (isScenario) {
+    return scenarioFlows.writableCapacity(supplier,
+                                          network->nodes.at(supplier));
+  }
+  return writableNetwork().nodes[supplier];
+}
+
 void Map::registerFlowsInNetwork(
-        const ConnectionInformation &info) {
+        ConnectionInformation &info) {
   CargoType _need = info.cargoType;
   WagonType t = cargoInfo.wagonTypeForCargo(_need);
-  for (int i = 0, j = 1; j < info.path.size(); ++i, ++j) {
-    int u = info.path[i];
-    int v = info.path[j];
+  PathPool::View path = pathPool.view(info.path);
+  for (int i = 0, j = 1; j < path.size(); ++i, ++j) {
+    int u = path[i];
+    int v = path[j];
     // path is from supplier to consumer, so add flows in reverse direction
-    network.storage[v][u].second[t] += info.quantity;
+    writableEdgeFlows(v, u)[t] += info.quantity;
+    overlay.edgeFlowChanged(u, v, t);
+  }
+  float& capacity = writableCapacity(info.supplier());
+  capacity -= info.quantity;
+  supplierIndex.capacityChanged(info.supplier(), capacity);
+  if (connectionSink) {
+    connectionSink({info.cargoType, t, toExternal(info.supplier()),
+                    toExternal(info.consumer()), info.quantity, info.cost,
+                    externalPath(path)});
+  }
+  if (decisionTrace) {
+    decisionTrace->connection(false, info.cargoType,
+                              toExternal(info.supplier()),
+                              toExternal(info.consumer()), info.quantity,
+                              info.cost, externalPath(path));
+  }
+  if (retainConnections) {
+    addPathOrInreaseCapacity(info);
+  } else {
+    pathPool.discardLast(info.path);
+    info.path = PathPool::Handle();
   }
-  network.nodes[info.supplier()] -= info.quantity;
-  addPathOrInreaseCapacity(info);
+}
+
+void Map::removePathOrDecreaseCapacity(const ConnectionInformation& info) {
+  for (auto it = all_paths.begin(); it != all_paths.end(); ++it) {
+    if (it->cargoType == info.cargoType
+        && pathPool.equal(it->path, info.path)) {
+      it->quantity -= info.quantity;
+      it->cost -= info.cost;
+      if (it->quantity <= 0.f) {
+        all_paths.erase(it);
+      }
+      return;
+    }
+  }
+}
+
+void Map::unregisterFlowsInNetwork(const ConnectionInformation &info) {
+  WagonType t = cargoInfo.wagonTypeForCargo(info.cargoType);
+  const CargoGraph& graph = isScenario ? *network : writableNetwork();
+  PathPool::View path = pathPool.view(info.path);
+  for (int i = 0, j = 1; j < path.size(); ++i, ++j) {
+    int u = path[i];
+    int v = path[j];
+    auto from = graph.storage.find(v);
+    if (from != graph.storage.end() && from->second.count(u) != 0) {
+      writableEdgeFlows(v, u)[t] -= info.quantity;
+      overlay.edgeFlowChanged(u, v, t);
+    } else {
+      // the edge has since been removed by an impassable line
+      auto& blocked = blockedEdges.at({std::min(u, v), std::max(u, v)});
+      blocked[v < u ? 0 : 1].second[t] -= info.quantity;
+    }
+  }
+  float& capacity = writableCapacity(info.supplier());
+  capacity += info.quantity;
+  supplierIndex.capacityChanged(info.supplier(), capacity);
+  if (connectionSink) {
+    connectionSink({info.cargoType, t, toExternal(info.supplier()),
+                    toExternal(info.consumer()), -info.quantity, -info.cost,
+                    externalPath(path)});
+  }
+  if (decisionTrace) {
+    decisionTrace->connection(true, info.cargoType,
+                              toExternal(info.supplier()),
+                              toExternal(info.consumer()), info.quantity,
+                              info.cost, externalPath(path));
+  }
+  removePathOrDecreaseCapacity(info);
+}
+
+void Map::recordCommittedConnection(const ConnectionInformation &info) {
+  if (!retainConnections) {
+    return;
+  }
+  size_t index = committedConnections.size();
+  if (freeCommittedSlots.empty()) {
+    committedConnections.push_back(info);
+    committedConnectionActive.push_back(true);
+  } else {
+    index = freeCommittedSlots.back();
+    freeCommittedSlots.pop_back();
+    committedConnections[index] = info;
+    committedConnectionActive[index] = true;
+  }
+  committedByConsumer[{info.consumer(), info.cargoType}].push_back(index);
+  committedBySupplier[info.supplier()].push_back(index);
+}
+
+void Map::ripUpCommittedConnection(size_t index) {
+  const ConnectionInformation& info = committedConnections[index];
+  unregisterFlowsInNetwork(info);
+  committedConnectionActive[index] = false;
+  freeCommittedSlots.push_back(index);
+  auto removeIndex = [index](auto& indices, const auto& key) {
+    auto it = indices.find(key);
+    if (it == indices.end()) {
+      return;
+    }
+    it->second.erase(std::remove(it->second.begin(), it->second.end(), index),
+                     it->second.end());
+    if (it->second.empty()) {
+      indices.erase(it);
+    }
+  };
+  removeIndex(committedByConsumer,
+              NodeAndNeed(info.consumer(), info.cargoType));
+  removeIndex(committedBySupplier, info.supplier());
+}
+
+void Map::compactPathPool() {
+  size_t used = 0;
+  for (const auto& p : all_paths) {
+    used += p.path.length;
+  }
+  for (size_t i = 0; i < committedConnections.size(); ++i) {
+    if (committedConnectionActive[i]) {
+      used += committedConnections[i].path.length;
+    }
+  }
+  if (pathPool.size() <= 2 * used) {
+    return;
+  }
+  // a committed connection shares its path with its copy in all_paths
+  PathPool compacted;
+  std::unordered_map<uint32_t, PathPool::Handle> moved;
+  auto move = [&](PathPool::Handle& h) {
+    auto it = moved.find(h.offset);
+    if (it == moved.end()) {
+      it = moved.emplace(h.offset, compacted.append(pathPool, h)).first;
+    }
+    h = it->second;
+  };
+  for (auto& p : all_paths) {
+    move(p.path);
+  }
+  for (size_t i = 0; i < committedConnections.size(); ++i) {
+    if (committedConnectionActive[i]) {
+      move(committedConnections[i].path);
+    }
+  }
+  pathPool = std::move(compacted);
+}
+
+float Map::committedQuantitySuppliedBy(int supplier) const {
+  float quantity = 0.f;
+  auto it = committedBySupplier.find(supplier);
+  if (it == committedBySupplier.end()) {
+    return quantity;
+  }
+  for (size_t index : it->second) {
+    if (committedConnectionActive[index]) {
+      quantity += committedConnections[index].quantity;
+    }
+  }
+  return quantity;
 }
 
 void Map::addUpstreamIndustryChainToOutstanding(
           const ConnectionInformation &path) {
-  auto requirements = supplyChainInfo
+  const auto& requirements = supplyChainInfo
     .requirementsForIndustryProducing(path.cargoType);
   for (auto& requirement : requirements) {
     float required_amount = path.quantity * requirement.quantity;
@@ -193,8 +1187,9 @@ void Map::addUpstreamIndustryChainToOutstanding(
 }
 
 void Map::printAllEdges(std::ostream& out) {
-  for (auto & edge : network.allEdges()) {
-    out << "(" << edge.a << ", " << edge.b << ")" << std::endl;
+  for (const auto& edge : network->edges()) {
+    out << "(" << toExternal(edge.a) << ", " << toExternal(edge.b) << ")"
+      << std::endl;
   }
 }
 
@@ -205,8 +1200,8 @@ void Map::printAllPaths(std::ostream& out) {
     out << p.cargoType << "\t" <<
       cargoInfo.wagonTypeForCargo(p.cargoType) << "\t" << p.quantity <<
       "\t" << p.cost << "\t[ ";
-    for (auto& node : p.path) {
-      out << node << " ";
+    for (int node : pathPool.view(p.path)) {
+      out << toExternal(node) << " ";
     }
     out << "]" << std::endl;
   }
@@ -215,56 +1210,893 @@ void Map::printIndustryInfo(std::ostream & out) {
   out << industryCount() << " industries\n"
     << "node_id\tname\tx_coord\ty_coord" << std::endl;
   for (int i = 0; i < industryCount(); ++i) {
-    Industry& industry = industries[i];
+    const int node = toInternal(i);
     std::string name =
-      IndustryInfo::nameOfIndustryProducing(industry.outputType());
-    out << i << "\t" << name << "\t" << industry.location().x << "\t" <<
-      industry.location().y << std::endl;
+      IndustryInfo::nameOfIndustryProducing(entities.outputType(node));
+    out << i << "\t" << name << "\t" << entities.location(node).x << "\t" <<
+      entities.location(node).y << std::endl;
   }
 }
 
 void Map::printTownInfo(std::ostream & out) {
-  out << towns.size() << " towns\n"
+  out << entities.townCount() << " towns\n"
     << "node_id\tname\tx_coord\ty_coord" << std::endl;
-  for (int i = 0; i < towns.size(); ++i) {
-    Town& town = towns[i];
-    const std::string& name = town.name();
+  for (int i = 0; i < entities.townCount(); ++i) {
+    const int node = toInternal(i + industryCount());
+    const std::string& name = entities.townName(node);
     out << (i + industryCount()) << "\t" << name << "\t" <<
-      town.location().x << "\t" << town.location().y << std::endl;
+      entities.location(node).x << "\t" << entities.location(node).y
+      << std::endl;
   }
 }
 
+void Map::connectionMade() {
+  ++lastRoutingStats.connectionsMade;
+  publishSnapshotIfDue();
+  if (routingProgress) {
+    routingProgress({lastRoutingStats.connectionsMade,
+                     connectionsToMake.size(),
+                     std::chrono::steady_clock::now() - routingStart});
+  }
+}
+
+Map::AnytimeResult Map::makeAllConnectionsWithin(
+    std::chrono::duration<double> budget, ProgressCallback progress) {
+  routingProgress = progress;
+  routingStart = std::chrono::steady_clock::now();
+  routingDeadline = routingStart
+    + std::chrono::duration_cast<std::chrono::steady_clock::duration>(budget);
+  routingTimedOut = false;
+  makeAllConnections();
+  AnytimeResult result {routingTimedOut, {}};
+  routingTimedOut = false;
+  routingDeadline = std::chrono::steady_clock::time_point::max();
+  routingProgress = nullptr;
+
+  for (const auto& p : connectionsToMake) {
+    if (p.second > 0.f) {
+      result.unmetDemand.push_back({toExternal(p.first.first), p.first.second,
+                                    p.second});
+    }
+  }
+  std::sort(result.unmetDemand.begin(), result.unmetDemand.end(),
+            [](const UnmetDemand& a, const UnmetDemand& b) {
+    return a.node < b.node || (a.node == b.node && a.cargoType < b.cargoType);
+  });
+  return result;
+}
+
 void Map::makeAllConnections() {
-  while (!connectionsToMake.empty()) {
+  lastRoutingStats = RoutingStats();
+  if (routingDeadline == std::chrono::steady_clock::time_point::max()) {
+    routingStart = std::chrono::steady_clock::now();
+  }
+  traceRunStarted();
+  if (routingEngine == RoutingEngine::MinCostFlow) {
+    makeConnectionsUsingMinCostFlow();
+  } else if (routingEngine == RoutingEngine::BatchedGreedy) {
+    makeOutstandingConnectionsInBatches();
+  } else {
+    makeOutstandingConnections();
+  }
+  traceRunFinished();
+  if (snapshotsEnabled) {
+    publishSnapshot();
+  }
+}
+
+void Map::roundStarted() {
+  ++lastRoutingStats.rounds;
+  if (decisionTrace) {
+    decisionTrace->roundStarted(
+      static_cast<uint32_t>(lastRoutingStats.rounds),
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceStart).count());
+  }
+}
+
+void Map::traceRunStarted() {
+  if (decisionTrace) {
+    traceStart = std::chrono::steady_clock::now();
+    decisionTrace->runStarted(static_cast<uint8_t>(routingEngine),
+      static_cast<uint32_t>(triangulation.vertices.size()));
+  }
+}
+
+void Map::traceRunFinished() {
+  if (decisionTrace) {
+    decisionTrace->runFinished(
+      static_cast<uint32_t>(lastRoutingStats.connectionsMade),
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceStart).count());
+  }
+}
+
+Map::ReplayResult Map::replayDecisionTrace(std::istream& in) {
+  typedef std::chrono::steady_clock Clock;
+  ReplayResult result;
+  DecisionTrace::Reader reader(in);
+  DecisionTrace::Record record;
+  // the replay itself is not traced
+  DecisionTrace* trace = decisionTrace;
+  decisionTrace = nullptr;
+  const int nodeCount = static_cast<int>(triangulation.vertices.size());
+  auto isNode = [nodeCount](int node) {
+    return node >= 0 && node < nodeCount;
+  };
+  bool valid = reader.isValid();
+  while (valid && reader.next(record)) {
+    switch (record.type) {
+      case DecisionTrace::RunStarted:
+        ++result.runs;
+        break;
+      case DecisionTrace::RoundStarted:
+        ++result.rounds;
+        break;
+      case DecisionTrace::Search: {
+        if (!isNode(record.consumer)
+            || (record.supplier != -1 && !isNode(record.supplier))) {
+          valid = false;
+          break;
+        }
+        ++result.searches;
+        result.recordedSearchTime +=
+          std::chrono::nanoseconds(record.nanoseconds);
+        candidatePaths.clear();
+        settledScratch.clear();
+        auto start = Clock::now();
+        auto route = searchForRoute(toInternal(record.consumer),
+                                    record.cargoType, record.quantity,
+                                    record.flags ? &settledScratch : nullptr,
+                                    record.costBound);
+        result.searchTime += Clock::now() - start;
+        int supplier = record.supplier < 0 ? -1 : toInternal(record.supplier);
+        if (route.first != record.cost || route.second != supplier) {
+          ++result.mismatches;
+        }
+        break;
+      }
+      case DecisionTrace::ConnectionMade:
+      case DecisionTrace::ConnectionRippedUp: {
+        const bool rippedUp = record.type == DecisionTrace::ConnectionRippedUp;
+        valid = record.path.size() > 1 && isNode(record.supplier)
+          && isNode(record.consumer)
+          && record.path.front() == record.supplier
+          && record.path.back() == record.consumer
+          && indexIsIndustry(toInternal(record.supplier));
+        std::vector<int> nodes;
+        for (int i = 0; valid && i < record.path.size(); ++i) {
+          valid = isNode(record.path[i]);
+          if (valid) {
+            nodes.push_back(toInternal(record.path[i]));
+          }
+          if (valid && i > 0) {
+            // flows are stored against the direction of travel
+            const int u = nodes[i - 1];
+            const int v = nodes[i];
+            auto vu = network->storage.find(v);
+            valid = (vu != network->storage.end()
+                     && vu->second.count(u) > 0)
+              || (rippedUp && blockedEdges.count({std::min(u, v),
+                                                  std::max(u, v)}) > 0);
+          }
+        }
+        if (!valid) {
+          break;
+        }
+        ConnectionInformation info {record.cost, record.quantity,
+                                    pathPool.append(nodes.begin(),
+                                                    nodes.end()),
+                                    record.cargoType,
+                                    toInternal(record.supplier),
+                                    toInternal(record.consumer)};
+        auto start = Clock::now();
+        if (rippedUp) {
+          unregisterFlowsInNetwork(info);
+          pathPool.discardLast(info.path);
+          ++result.connectionsRippedUp;
+        } else {
+          registerFlowsInNetwork(info);
+          ++result.connectionsMade;
+        }
+        result.flowTime += Clock::now() - start;
+        break;
+      }
+      case DecisionTrace::RunFinished:
+        break;
+    }
+  }
+  result.complete = valid && reader.atEnd();
+  decisionTrace = trace;
+  return result;
+}
+
+void Map::enableSnapshots(std::chrono::duration<double> interval) {
+  snapshotsEnabled = true;
+  snapshotInterval =
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval);
+  publishSnapshot();
+}
+
+void Map::publishSnapshotIfDue() {
+  if (snapshotsEnabled && std::chrono::steady_clock::now() - lastSnapshotTime
+      >= snapshotInterval) {
+    publishSnapshot();
+  }
+}
+
+void Map::publishSnapshot() {
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->epoch = ++snapshotEpoch;
+  snapshot->connectionsMade = lastRoutingStats.connectionsMade;
+  const CargoGraph& graph = *network;
+  const auto edges = graph.edges();
+  for (auto it = edges.begin(); it != edges.end(); ++it) {
+    IndexedEdge edge = *it;
+    // the flow stored on (x, y) is cargo travelling from y to x
+    const auto& ba = edgeFlows(edge.a, edge.b, it.weightedEdge());
+    const auto& ab = edgeFlows(edge.b, edge.a,
+                               graph.storage.at(edge.b).at(edge.a));
+    int a = toExternal(edge.a);
+    int b = toExternal(edge.b);
+    if (a < b) {
+      snapshot->edges.push_back({a, b, ab, ba});
+    } else {
+      snapshot->edges.push_back({b, a, ba, ab});
+    }
+  }
+  std::sort(snapshot->edges.begin(), snapshot->edges.end(),
+            [](const Snapshot::Edge& x, const Snapshot::Edge& y) {
+              return x.a != y.a ? x.a < y.a : x.b < y.b;
+            });
+  snapshot->supplierCapacity.resize(industryCount());
+  for (int i = 0; i < industryCount(); ++i) {
+    snapshot->supplierCapacity[toExternal(i)] =
+      graph.nodes.count(i) != 0 ? remainingCapacity(i) : 0.f;
+  }
+  for (const auto& p : all_paths) {
+    PathPool::View path = pathPool.view(p.path);
+    snapshot->paths.push_back({p.cargoType, p.quantity, p.cost,
+                               snapshot->pathNodes.size(), path.size()});
+    for (int node : path) {
+      snapshot->pathNodes.push_back(toExternal(node));
+    }
+  }
+  std::atomic_store(&latestSnapshot,
+                    std::shared_ptr<const Snapshot>(std::move(snapshot)));
+  lastSnapshotTime = std::chrono::steady_clock::now();
+}
+
+PathPool::View Map::externalPath(PathPool::View path) {
+  if (!isRenumbered()) {
+    return path;
+  }
+  eventPath.clear();
+  for (int node : path) {
+    eventPath.push_back(toExternal(node));
+  }
+  return {eventPath.data(), eventPath.data() + eventPath.size()};
+}
+
+void Map::setConnectionSink(ConnectionSink sink, bool retainConnections) {
+  connectionSink = sink;
+  this->retainConnections = retainConnections;
+}
+
+void Map::makeOutstandingConnections() {
+  // sample memory usage now and then, a report visits every node
+  const size_t connectionsPerSample = 64;
+  recordMemoryUsage(MemoryPhase::Routing, memoryUsage());
+  greedySearches.clear();
+  greedySearchForKey.clear();
+  greedySettledBy.resize(triangulation.vertices.size());
+  for (auto& entries : greedySettledBy) {
+    entries.clear();
+  }
+  for (size_t made = 1; !connectionsToMake.empty(); ++made) {
+    roundStarted();
     ConnectionInformation costliestPath =  findCheapestOutstandingConnection();
+    if (costliestPath.isEmpty()) {
+      break;  // remaining demand cannot be supplied
+    }
     removeConnectionFromOutstanding(costliestPath);
     registerFlowsInNetwork(costliestPath);
+    invalidateGreedySearches(costliestPath);
+    recordCommittedConnection(costliestPath);
     addUpstreamIndustryChainToOutstanding(costliestPath);
+    connectionMade();
+    if (made % connectionsPerSample == 0) {
+      recordMemoryUsage(MemoryPhase::Routing, memoryUsage());
+    }
+  }
+  recordMemoryUsage(MemoryPhase::Routing, memoryUsage());
+}
+
+void Map::evaluateCandidate(const NodeAndNeed& key) {
+  auto outstanding = connectionsToMake.find(key);
+  if (outstanding == connectionsToMake.end() || outstanding->second == 0.f) {
+    return;
+  }
+  float quantity = std::min(outstanding->second, 100.f);
+  std::vector<int>& settled = settledScratch;
+  settled.clear();
+  auto route = shortestRouteUsingCapacity(key.first, key.second, quantity,
+                                          &settled);
+  if (route.second < 0) {
+    // supplier capacity only falls, so this stays unreachable
+    candidateForKey[key] = noCandidate;
+    return;
+  }
+  size_t index = candidates.size();
+  candidates.push_back({key, quantity, route.first, route.first, route.second,
+                        cargoInfo.wagonTypeForCargo(key.second),
+                        candidatePaths.appendChain(searchPrevious, route.second),
+                        true, true});
+  candidateForKey[key] = index;
+  for (int node : settled) {
+    settledBy[node].emplace_back(index, searchDistance[node]);
+  }
+}
+
+void Map::commitCandidate(size_t index) {
+  const RoutingCandidate candidate = candidates[index];
+  candidates[index].active = false;
+  PathPool::View nodes = candidatePaths.view(candidate.path);
+  ConnectionInformation info {candidate.cost, candidate.quantity,
+                              pathPool.append(nodes.begin(), nodes.end()),
+                              candidate.key.second, candidate.supplier,
+                              candidate.key.first};
+  removeConnectionFromOutstanding(info);
+  registerFlowsInNetwork(info);
+  recordCommittedConnection(info);
+  addUpstreamIndustryChainToOutstanding(info);
+  connectionMade();
+
+  // The path now gives return capacity against its own direction, so a
+  // search of the same wagon type entering it at a node u may now find a
+  // cheaper route, but one costing at least the distance to u. Searches
+  // which never reached the path are unaffected, and those which did may
+  // also have become more expensive.
+  for (size_t k = 0; k + 1 < nodes.size(); ++k) {
+    for (const auto& entry : settledBy[nodes[k]]) {
+      RoutingCandidate& other = candidates[entry.first];
+      if (other.active && other.wagonType == candidate.wagonType) {
+        other.exact = false;
+        other.lowerBound = std::min(other.lowerBound, entry.second);
+      }
+    }
+  }
+  // a supplier which can no longer supply a route makes it more expensive
+  float remaining_capacity = remainingCapacity(candidate.supplier);
+  for (auto& other : candidates) {
+    if (other.active && other.supplier == candidate.supplier
+        && remaining_capacity < other.quantity) {
+      other.exact = false;
+    }
+  }
+
+  // outstanding connections which are new, or whose quantity changed
+  std::vector<NodeAndNeed> changed {candidate.key};
+  for (auto& requirement : supplyChainInfo
+       .requirementsForIndustryProducing(candidate.key.second)) {
+    changed.push_back({candidate.supplier, requirement.cargoType});
+  }
+  for (const NodeAndNeed& key : changed) {
+    auto it = candidateForKey.find(key);
+    if (it == candidateForKey.end()
+        || (it->second != noCandidate && !candidates[it->second].active)) {
+      evaluateCandidate(key);
+    } else if (it->second != noCandidate) {
+      // a larger quantity can only cost more
+      RoutingCandidate& other = candidates[it->second];
+      if (std::min(connectionsToMake[key], 100.f) != other.quantity) {
+        other.exact = false;
+      }
+    }
+  }
+}
+
+void Map::makeOutstandingConnectionsInBatches() {
+  // Each round evaluates every outstanding connection, then repeatedly
+  // makes the one with the lowest cost bound, as long as its cost is
+  // still exact. Every other connection then costs at least as much, so
+  // the greedy loop would have made the same one next.
+  const size_t connectionsPerSample = 64;
+  recordMemoryUsage(MemoryPhase::Routing, memoryUsage());
+  settledBy.resize(triangulation.vertices.size());
+  while (!connectionsToMake.empty()) {
+    roundStarted();
+    candidates.clear();
+    candidatePaths.clear();
+    candidateForKey.clear();
+    for (auto& entries : settledBy) {
+      entries.clear();
+    }
+    std::vector<NodeAndNeed> keys;
+    for (const auto& p : connectionsToMake) {
+      keys.push_back(p.first);
+    }
+    for (const auto& key : keys) {
+      if (deadlinePassed()) {
+        // an unfinished round cannot tell which connection is cheapest
+        candidates.clear();
+        break;
+      }
+      evaluateCandidate(key);
+    }
+
+    size_t madeThisRound = 0;
+    while (!deadlinePassed()) {
+      size_t best = noCandidate;
+      for (size_t i = 0; i < candidates.size(); ++i) {
+        if (candidates[i].active && (best == noCandidate
+            || candidates[i].lowerBound < candidates[best].lowerBound)) {
+          best = i;
+        }
+      }
+      if (best == noCandidate || !candidates[best].exact) {
+        break;
+      }
+      commitCandidate(best);
+      ++madeThisRound;
+      if (lastRoutingStats.connectionsMade % connectionsPerSample == 0) {
+        recordMemoryUsage(MemoryPhase::Routing, memoryUsage());
+      }
+    }
+    if (madeThisRound == 0) {
+      break;  // remaining demand cannot be supplied
+    }
+  }
+  recordMemoryUsage(MemoryPhase::Routing, memoryUsage());
+}
+
+std::vector<CargoType> Map::cargoTypesDownstreamFirst() {
+  // depth first, a cargo type is added once all cargo types whose
+  // producers require it have been added
+  std::array<std::vector<CargoType>, CargoTypeCount> requiredBy;
+  for (size_t c = 0; c < CargoTypeCount; ++c) {
+    for (auto& requirement : supplyChainInfo
+         .requirementsForIndustryProducing(CargoType(c))) {
+      requiredBy[requirement.cargoType].push_back(CargoType(c));
+    }
+  }
+  std::vector<CargoType> order;
+  std::array<bool, CargoTypeCount> added {};
+  std::function<void(CargoType)> add = [&](CargoType c) {
+    if (added[c]) {
+      return;
+    }
+    added[c] = true;
+    for (CargoType downstream : requiredBy[c]) {
+      add(downstream);
+    }
+    order.push_back(c);
+  };
+  for (size_t c = 0; c < CargoTypeCount; ++c) {
+    add(CargoType(c));
+  }
+  return order;
+}
+
+void Map::makeConnectionsUsingMinCostFlow() {
+  const double infinity = std::numeric_limits<double>::infinity();
+  const int nodeCount = static_cast<int>(triangulation.vertices.size());
+  const int source = nodeCount;
+  const int sink = nodeCount + 1;
+  PathPool flowPaths;
+  recordMemoryUsage(MemoryPhase::Routing, memoryUsage());
+  for (CargoType cargo : cargoTypesDownstreamFirst()) {
+    if (deadlinePassed()) {
+      break;
+    }
+    // demand for this cargo is complete once all cargo types downstream
+    // of it have been routed
+    MinCostFlow flow(nodeCount + 2);
+    bool hasDemand = false;
+    for (const auto& p : connectionsToMake) {
+      if (p.first.second == cargo && p.second > 0.f) {
+        flow.addArc(p.first.first, sink, p.second, 0.);
+        hasDemand = true;
+      }
+    }
+    if (!hasDemand) {
+      continue;
+    }
+    roundStarted();
+    for (int i = 0; i < industryCount(); ++i) {
+      if (entities.produces(i, cargo) && remainingCapacity(i) > 0.f) {
+        flow.addArc(source, i, remainingCapacity(i), 0.);
+      }
+    }
+    // as in the greedy search, cargo travels free of charge up to the
+    // amount by which the return flow of its wagon type exceeds the
+    // flow in its own direction, and pays the edge weight beyond that
+    const WagonType t = cargoInfo.wagonTypeForCargo(cargo);
+    const CargoGraph& graph = *network;
+    for (const auto& a : graph.storage) {
+      for (const auto& b : a.second) {
+        // cargo travelling from a to b
+        float returnFlow = edgeFlows(a.first, b.first, b.second)[t];
+        float ownFlow = edgeFlows(b.first, a.first,
+                                  graph.storage.at(b.first).at(a.first))[t];
+        if (returnFlow > ownFlow) {
+          flow.addArc(a.first, b.first, returnFlow - ownFlow, 0.);
+        }
+        flow.addArc(a.first, b.first, infinity, b.second.first);
+      }
+    }
+    // a cut short solve leaves the cheapest flow of the quantity sent,
+    // which is registered like a complete one
+    flow.solve(source, sink, [this]() {return deadlinePassed();});
+
+    flowPaths.clear();
+    for (const auto& flowPath : flow.decompose(source, sink, flowPaths)) {
+      PathPool::View nodes = flowPaths.view(flowPath.path);
+      ConnectionInformation info {static_cast<float>(flowPath.cost),
+                                  static_cast<float>(flowPath.quantity),
+                                  pathPool.append(nodes.begin(), nodes.end()),
+                                  cargo, nodes.front(), nodes.back()};
+      removeConnectionFromOutstanding(info);
+      registerFlowsInNetwork(info);
+      recordCommittedConnection(info);
+      addUpstreamIndustryChainToOutstanding(info);
+      connectionMade();
+    }
+    // drop demand left over from rounding, what remains cannot be supplied
+    for (auto it = connectionsToMake.begin(); it != connectionsToMake.end();) {
+      if (it->first.second == cargo && it->second <= MinCostFlow::epsilon) {
+        it = connectionsToMake.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    recordMemoryUsage(MemoryPhase::Routing, memoryUsage());
+  }
+}
+
+void Map::changeCargoRequirement(int node, CargoType need, float quantity) {
+  replanRequirements({{toInternal(node), need}}, {quantity});
+}
+
+float Map::currentRequirement(const NodeAndNeed& key) const {
+  float quantity = 0.f;
+  auto outstanding = connectionsToMake.find(key);
+  if (outstanding != connectionsToMake.end()) {
+    quantity += outstanding->second;
+  }
+  auto committed = committedByConsumer.find(key);
+  if (committed != committedByConsumer.end()) {
+    for (size_t index : committed->second) {
+      if (committedConnectionActive[index]) {
+        quantity += committedConnections[index].quantity;
+      }
+    }
+  }
+  return quantity;
+}
+
+void Map::replanConnections(
+    const std::vector<std::pair<int, CargoType>>& requirements) {
+  std::vector<NodeAndNeed> keys;
+  std::vector<float> quantities;
+  for (const auto& requirement : requirements) {
+    keys.push_back({toInternal(requirement.first), requirement.second});
+    quantities.push_back(currentRequirement(keys.back()));
+  }
+  replanRequirements(keys, quantities);
+}
+
+void Map::replanRequirements(const std::vector<NodeAndNeed>& requirements,
+                             const std::vector<float>& quantities) {
+  traceRunStarted();
+  lastRoutingStats = RoutingStats();
+  ripUpRequirements(requirements, quantities);
+  routeOutstandingRequirements();
+}
+
+void Map::ripUpRequirements(const std::vector<NodeAndNeed>& requirements,
+                            const std::vector<float>& quantities) {
+  // suppliers which lost output, with the cargo type they produce
+  std::vector<std::pair<int, CargoType>> suppliersToCheck;
+  auto ripUp = [&](size_t index) {
+    const ConnectionInformation& info = committedConnections[index];
+    suppliersToCheck.push_back({info.supplier(), info.cargoType});
+    ripUpCommittedConnection(index);
+  };
+
+  // rip up the connections for these requirements, nothing is delivered
+  // to them any more, so the outstanding quantity is the whole need
+  for (size_t i = 0; i < requirements.size(); ++i) {
+    auto it = committedByConsumer.find(requirements[i]);
+    if (it != committedByConsumer.end()) {
+      const std::vector<size_t> indices = it->second;
+      for (size_t index : indices) {
+        ripUp(index);
+      }
+    }
+    if (quantities[i] > 0.f) {
+      connectionsToMake[requirements[i]] = quantities[i];
+    } else {
+      connectionsToMake.erase(requirements[i]);
+    }
+  }
+
+  // walk up the supply chain: a supplier which lost output keeps the
+  // cheapest of its inputs which its remaining output still needs, and
+  // only the rest are ripped up
+  while (!suppliersToCheck.empty()) {
+    const auto supplier = suppliersToCheck.back();
+    suppliersToCheck.pop_back();
+    const float output = committedQuantitySuppliedBy(supplier.first);
+    for (auto& requirement : supplyChainInfo
+         .requirementsForIndustryProducing(supplier.second)) {
+      const NodeAndNeed key {supplier.first, requirement.cargoType};
+      const float needed = output * requirement.quantity;
+      float kept = 0.f;
+      auto it = committedByConsumer.find(key);
+      if (it != committedByConsumer.end()) {
+        std::vector<size_t> inputs = it->second;
+        std::sort(inputs.begin(), inputs.end(), [this](size_t a, size_t b) {
+          const ConnectionInformation& x = committedConnections[a];
+          const ConnectionInformation& y = committedConnections[b];
+          return x.cost * y.quantity < y.cost * x.quantity;
+        });
+        // allow for rounding in the sums of quantities
+        const float slack = 1e-4f * needed;
+        for (size_t index : inputs) {
+          const float quantity = committedConnections[index].quantity;
+          if (kept + quantity <= needed + slack) {
+            kept += quantity;
+          } else {
+            ripUp(index);
+          }
+        }
+      }
+      if (needed > kept) {
+        connectionsToMake[key] = needed - kept;
+      } else {
+        connectionsToMake.erase(key);
+      }
+    }
   }
 }
 
-float Map::calculatePathLength(const std::vector<int> &path) {
+void Map::routeOutstandingRequirements() {
+  if (routingEngine == RoutingEngine::BatchedGreedy) {
+    makeOutstandingConnectionsInBatches();
+  } else {
+    makeOutstandingConnections();
+  }
+  compactPathPool();
+  traceRunFinished();
+  if (snapshotsEnabled) {
+    publishSnapshot();
+  }
+}
+
+float Map::calculatePathLength(PathPool::View path) const {
   float pathLength = 0.f;
   for (int i = 0, j = 1; j < path.size(); ++i, ++j) {
-    pathLength += network.storage[path[i]][path[j]].first;
+    // edges may since have been removed by impassable lines
+    pathLength += (triangulation.vertices[path[j]]
+                   - triangulation.vertices[path[i]]).length();
   }
   return pathLength;
 }
 
-void Map::printEfficiencyStats(std::ostream& out) {
-  float totalNaiveCost = 0.f;
-  float totalCost = 0.f;
-  float totalQuantity = 0.f;
+Map::EfficiencyStats Map::efficiencyStats() const {
+  EfficiencyStats stats;
   for (const auto& c_info : all_paths) {
-    float pathLength = calculatePathLength(c_info.path);
-    totalNaiveCost += pathLength * c_info.quantity;
-    totalCost += c_info.cost;
-    totalQuantity += c_info.quantity;
+    float pathLength = calculatePathLength(pathPool.view(c_info.path));
+    stats.naiveCost += pathLength * c_info.quantity;
+    stats.actualCost += c_info.cost;
+    stats.totalQuantity += c_info.quantity;
   }
-  float saving = (totalNaiveCost - totalCost) / totalNaiveCost;
+  return stats;
+}
+
+void Map::printEfficiencyStats(std::ostream& out) {
+  EfficiencyStats stats = efficiencyStats();
   out << "Efficiency statistics:\n";
-  out << "total cargo volume:  " << totalQuantity << "\n";
-  out << "naive total cost:    " << totalNaiveCost << "\n";
-  out << "actual total cost:   " << totalCost << "\n";
-  out << "cost saving          " << (saving * 100) << "%\n";
+  out << "total cargo volume:  " << stats.totalQuantity << "\n";
+  out << "naive total cost:    " << stats.naiveCost << "\n";
+  out << "actual total cost:   " << stats.actualCost << "\n";
+  out << "cost saving          " << (stats.saving() * 100) << "%\n";
+}
+
+Map::MemoryReport Map::memoryUsage() const {
+  MemoryReport report;
+  report.triangulation = triangulation.memoryUsage();
+  report.network = network->memoryUsage();
+  report.overlay = overlay.memoryUsage();
+  report.supplierIndex = supplierIndex.memoryUsage();
+  report.nodeIds = vectorBytes(externalNode) + vectorBytes(internalNode)
+    + vectorBytes(externalNodeLocations) + vectorBytes(eventPath);
+  report.pointIndex = pointLocator.memoryUsage();
+  report.edgeIndex = edgeGrid.memoryUsage() + vectorBytes(triangulationEdges)
+    + vectorBytes(edgeBlockCount) + vectorBytes(edgesBlockedByLine)
+    + hashNodeBytes(blockedEdges) + hashBucketBytes(blockedEdges);
+  for (const auto& edges : edgesBlockedByLine) {
+    report.edgeIndex += vectorBytes(edges);
+  }
+  report.connectionsToMake = hashNodeBytes(connectionsToMake)
+    + hashBucketBytes(connectionsToMake) + hashNodeBytes(lastSearchCost)
+    + hashBucketBytes(lastSearchCost);
+  report.paths = vectorBytes(all_paths) + pathPool.memoryUsage()
+    + vectorBytes(committedConnections) + vectorBytes(committedConnectionActive)
+    + vectorBytes(freeCommittedSlots)
+    + hashNodeBytes(committedByConsumer) + hashBucketBytes(committedByConsumer)
+    + hashNodeBytes(committedBySupplier) + hashBucketBytes(committedBySupplier);
+  for (const auto& c : committedByConsumer) {
+    report.paths += vectorBytes(c.second);
+  }
+  for (const auto& c : committedBySupplier) {
+    report.paths += vectorBytes(c.second);
+  }
+  report.searchScratch = vectorBytes(searchDistance)
+    + vectorBytes(searchReached) + vectorBytes(searchSettled)
+    + vectorBytes(searchPrevious) + vectorBytes(bestPrevious)
+    + candidatePaths.memoryUsage() + vectorBytes(greedySearches)
+    + hashNodeBytes(greedySearchForKey) + hashBucketBytes(greedySearchForKey)
+    + vectorBytes(greedySettledBy);
+  for (const auto& entries : greedySettledBy) {
+    report.searchScratch += vectorBytes(entries);
+  }
+  report.entities = entities.memoryUsage();
+  report.nodeCount = entities.nodeCount();
+  return report;
+}
+
+void Map::recordMemoryUsage(MemoryPhase phase, const MemoryReport& report) {
+  MemoryHighWaterMark& mark = memoryHighWaterMarks[static_cast<int>(phase)];
+  MemoryReport& peak = mark.components;
+  peak.triangulation.vertices = std::max(peak.triangulation.vertices,
+                                         report.triangulation.vertices);
+  peak.triangulation.triangles = std::max(peak.triangulation.triangles,
+                                          report.triangulation.triangles);
+  peak.triangulation.mask = std::max(peak.triangulation.mask,
+                                     report.triangulation.mask);
+  peak.triangulation.circumcircles = std::max(
+    peak.triangulation.circumcircles, report.triangulation.circumcircles);
+  peak.network.hashNodes = std::max(peak.network.hashNodes,
+                                    report.network.hashNodes);
+  peak.network.buckets = std::max(peak.network.buckets,
+                                  report.network.buckets);
+  peak.network.edgePayloads = std::max(peak.network.edgePayloads,
+                                       report.network.edgePayloads);
+  peak.overlay = std::max(peak.overlay, report.overlay);
+  peak.supplierIndex = std::max(peak.supplierIndex, report.supplierIndex);
+  peak.edgeIndex = std::max(peak.edgeIndex, report.edgeIndex);
+  peak.pointIndex = std::max(peak.pointIndex, report.pointIndex);
+  peak.nodeIds = std::max(peak.nodeIds, report.nodeIds);
+  peak.entities = std::max(peak.entities, report.entities);
+  peak.connectionsToMake = std::max(peak.connectionsToMake,
+                                    report.connectionsToMake);
+  peak.paths = std::max(peak.paths, report.paths);
+  peak.searchScratch = std::max(peak.searchScratch, report.searchScratch);
+  peak.nodeCount = std::max(peak.nodeCount, report.nodeCount);
+  mark.total = std::max(mark.total, report.total());
+}
+
+void Map::printMemoryReport(std::ostream& out) {
+  const MemoryReport current = memoryUsage();
+  const MemoryReport* reports[] = {
+    &current,
+    &memoryHighWaterMark(MemoryPhase::Triangulation).components,
+    &memoryHighWaterMark(MemoryPhase::NetworkGraph).components,
+    &memoryHighWaterMark(MemoryPhase::Routing).components
+  };
+  auto row = [&](const char* name, std::function<size_t(const MemoryReport&)>
+                 bytes) {
+    out << name;
+    for (const MemoryReport* r : reports) {
+      out << "\t" << bytes(*r);
+    }
+    out << "\n";
+  };
+  out << "Memory usage (bytes):\n"
+    << "component\tcurrent\ttriangulation_peak\tnetwork_peak\trouting_peak\n";
+  row("triangulation_vertices",
+      [](const MemoryReport& r) {return r.triangulation.vertices;});
+  row("triangulation_triangles",
+      [](const MemoryReport& r) {return r.triangulation.triangles;});
+  row("triangulation_mask",
+      [](const MemoryReport& r) {return r.triangulation.mask;});
+  row("triangulation_circumcircles",
+      [](const MemoryReport& r) {return r.triangulation.circumcircles;});
+  row("network_hash_nodes",
+      [](const MemoryReport& r) {return r.network.hashNodes;});
+  row("network_buckets",
+      [](const MemoryReport& r) {return r.network.buckets;});
+  row("network_edge_payloads",
+      [](const MemoryReport& r) {return r.network.edgePayloads;});
+  row("overlay", [](const MemoryReport& r) {return r.overlay;});
+  row("supplier_index", [](const MemoryReport& r) {return r.supplierIndex;});
+  row("edge_index", [](const MemoryReport& r) {return r.edgeIndex;});
+  row("point_index", [](const MemoryReport& r) {return r.pointIndex;});
+  row("node_ids", [](const MemoryReport& r) {return r.nodeIds;});
+  row("entities", [](const MemoryReport& r) {return r.entities;});
+  row("connections_to_make",
+      [](const MemoryReport& r) {return r.connectionsToMake;});
+  row("paths", [](const MemoryReport& r) {return r.paths;});
+  row("search_scratch", [](const MemoryReport& r) {return r.searchScratch;});
+  out << "total\t" << current.total();
+  for (auto phase : {MemoryPhase::Triangulation, MemoryPhase::NetworkGraph,
+                     MemoryPhase::Routing}) {
+    out << "\t" << memoryHighWaterMark(phase).total;
+  }
+  out << "\nbytes_per_node\t" << current.bytesPerNode();
+  for (auto phase : {MemoryPhase::Triangulation, MemoryPhase::NetworkGraph,
+                     MemoryPhase::Routing}) {
+    const MemoryHighWaterMark& mark = memoryHighWaterMark(phase);
+    out << "\t" << (mark.components.nodeCount
+      ? static_cast<float>(mark.total) / mark.components.nodeCount : 0.f);
+  }
+  out << std::endl;
+}
+
+void Map::printRoutingStats(std::ostream& out) {
+  out << "Routing statistics:\n";
+  out << "connections made:    " << lastRoutingStats.connectionsMade << "\n";
+  out << "routing rounds:      " << lastRoutingStats.rounds << "\n";
+  out << "rounds saved:        " << lastRoutingStats.roundsSaved() << "\n";
+  out << "route searches:      " << lastRoutingStats.searches << "\n";
+  out << "searches cut short:  " << lastRoutingStats.searchesCutShort << "\n";
+  out << "searches rejected:   " << lastRoutingStats.searchesRejected << "\n";
+}
+
+Map::Map(const Map& base, ScenarioTag)
+  : entities(base.entities), network(base.network), isScenario(true),
+    overlay(base.overlay), supplierIndex(base.supplierIndex),
+    externalNode(base.externalNode), internalNode(base.internalNode),
+    cargoInfo(base.cargoInfo), supplyChainInfo(base.supplyChainInfo),
+    connectionsToMake(base.connectionsToMake), all_paths(base.all_paths),
+    pathPool(base.pathPool), routingEngine(base.routingEngine) {
+  // routing only needs the locations of the nodes
+  triangulation.vertices = base.triangulation.vertices;
+}
+
+std::vector<Map::SweepResult> Map::sweepUniformTownCargoRequirement(
+    const std::vector<float>& townCargoNeeds, unsigned threadCount) const {
+  std::vector<SweepResult> results(townCargoNeeds.size());
+  std::atomic<size_t> nextScenario {0};
+  auto runScenarios = [&]() {
+    for (size_t i = nextScenario++; i < townCargoNeeds.size();
+         i = nextScenario++) {
+      // scenarios run on worker threads, so start without the trace, sink
+      // and snapshots of this map
+      Map scenario(*this, ScenarioTag());
+      scenario.setUniformTownCargoRequirement(townCargoNeeds[i]);
+      scenario.makeAllConnections();
+      results[i] = {townCargoNeeds[i], scenario.all_paths.size(),
+                    scenario.efficiencyStats()};
+    }
+  };
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threadCount = std::min<unsigned>(threadCount,
+                                   static_cast<unsigned>(results.size()));
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threadCount; ++i) {
+    workers.emplace_back(runScenarios);
+  }
+  runScenarios();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  return results;
+}
+
+void Map::printSweepResults(const std::vector<SweepResult>& results,
+                            std::ostream& out) {
+  out << results.size() << " scenarios\n"
+    << "town_cargo_need\tconnections\tquantity\tnaive_cost\tcost\tsaving"
+    << std::endl;
+  for (const auto& r : results) {
+    out << r.townCargoNeed << "\t" << r.connectionCount << "\t" <<
+      r.stats.totalQuantity << "\t" << r.stats.naiveCost << "\t" <<
+      r.stats.actualCost << "\t" << (r.stats.saving() * 100) << "%" <<
+      std::endl;
+  }
 }
@@ -8,21 +8,31 @@
 #define NETGEN_MAP_H_
 
 #include <array>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <iostream>
 #include <utility>
 #include "routing/indexed_delaunay.h"
-#include "Graph.h"
+#include "routing/cargo_graph.h"
+#include "routing/cargo_graph_overlay.h"
+#include "routing/path_pool.h"
+#include "routing/supplier_index.h"
+#include "routing/edge_grid.h"
+#include "routing/point_locator.h"
+#include "routing/scenario_flows.h"
 #include "data/cargo_type.h"
 #include "data/wagon_type.h"
 #include "data/industry.h"
 #include "data/town.h"
+#include "data/entity_store.h"
 #include "data/cargo_information.h"
 #include "data/supply_chain_information.h"
 
-typedef IntGraph<std::array<float, WagonTypeCount>, float, float> CargoGraph;
-
+class DecisionTrace;
 
 /// Represents a game map
 ///
@@ -37,15 +47,60 @@ class Map {
       }
   };
   struct ConnectionInformation;
+  struct RoutingCandidate;
+  struct GreedySearch;
 
   /* storage of user information */
-  std::vector<Industry> industries;
-  std::vector<Town> towns;
+  /// towns and industries, by node index
+  EntityStore entities;
   std::vector<Line2D> impassableLines;
+  /// whether each impassable line has been removed, so that the indices
+  /// of the others stay the same
+  std::vector<bool> impassableLineRemoved;
 
   /* storage of derived network data */
   IndexedDelaunay triangulation;
-  CargoGraph network;
+  /// network graph, shared between copies of the map until one of them
+  /// registers flows, and read-only by the scenarios of a parameter sweep
+  std::shared_ptr<CargoGraph> network = std::make_shared<CargoGraph>();
+  /// flows and supplier capacities changed by a scenario
+  ScenarioFlows scenarioFlows;
+  /// whether this map is a scenario of a parameter sweep, sharing the
+  /// network graph of the map it was made from
+  bool isScenario = false;
+  /// multi-level overlay of the network, used for routing once built
+  CargoGraphOverlay overlay;
+  /// suppliers of each cargo type by remaining capacity, used to reject
+  /// connections which cannot be supplied without searching
+  SupplierIndex supplierIndex;
+  /// edges of the triangulation, a < b, including those removed by
+  /// impassable lines
+  std::vector<IndexedEdge> triangulationEdges;
+  /// spatial index of triangulationEdges
+  EdgeGrid edgeGrid;
+  /// spatial index of the triangulation, for locate and nearestNode
+  PointLocator pointLocator;
+  /// the number of impassable lines crossing each triangulation edge
+  std::vector<int> edgeBlockCount;
+  /// triangulation edges crossed by each impassable line
+  std::vector<std::vector<int>> edgesBlockedByLine;
+  /// weights and flows of each edge removed by impassable lines, from a
+  /// to b then from b to a, restored when the last line crossing it is
+  /// removed
+  std::unordered_map<IndexedEdge, std::array<CargoGraph::WeightedEdge, 2>>
+    blockedEdges;
+  /// positions in triangulationEdges of edges removed as locations were
+  /// added or removed, holding {-1, -1} until reused
+  std::vector<int> freeEdgeSlots;
+
+  /// external index of each node, and node of each external index, once
+  /// renumbered for locality
+  std::vector<int> externalNode;
+  std::vector<int> internalNode;
+  /// node locations by external index, once renumbered
+  std::vector<Point2D> externalNodeLocations;
+  /// the path of the current connection event, by external index
+  std::vector<int> eventPath;
 
   /* information for supply chain routing */
   CargoInformation cargoInfo;
@@ -54,11 +109,136 @@ class Map {
   /* variables for route finding */
   std::unordered_map<NodeAndNeed, float, NodeAndNeed_hash> connectionsToMake;
   std::vector<ConnectionInformation> all_paths;
+  /// nodes of the paths of all connections made
+  PathPool pathPool;
+
+  /* scratch storage for route searches, reused between searches */
+  std::vector<float> searchDistance;
+  std::vector<unsigned> searchReached;
+  std::vector<unsigned> searchSettled;
+  unsigned searchStamp = 0;
+  /// predecessors towards the consumer, from the last search
+  std::vector<int> searchPrevious;
+  /// predecessors of the cheapest candidate of the current round
+  std::vector<int> bestPrevious;
+  /// paths of the candidates of the current round, when using the overlay
+  /// or committing in batches
+  PathPool candidatePaths;
+
+  /* scratch storage for committing connections in batches */
+  std::vector<RoutingCandidate> candidates;
+  /// cost of each outstanding connection when it was last searched, or
+  /// the bound its search gave up at, used to search cheap ones first
+  std::unordered_map<NodeAndNeed, float, NodeAndNeed_hash> lastSearchCost;
+
+  /// the candidates whose search settled each node, with its distance
+  std::vector<std::vector<std::pair<size_t, float>>> settledBy;
+  /// the latest candidate for each outstanding connection, or
+  /// noCandidate if it cannot be supplied
+  std::unordered_map<NodeAndNeed, size_t, NodeAndNeed_hash> candidateForKey;
+  static constexpr size_t noCandidate = static_cast<size_t>(-1);
+  std::vector<int> settledScratch;
+
+  /* searches of the greedy loop, kept for the rest of its run */
+  std::vector<GreedySearch> greedySearches;
+  /// the latest search of each outstanding connection
+  std::unordered_map<NodeAndNeed, size_t, NodeAndNeed_hash>
+    greedySearchForKey;
+  /// the searches which settled each node, with their generation
+  std::vector<std::vector<std::pair<size_t, uint32_t>>> greedySettledBy;
+
+  /// Mark the greedy searches a connection just made may have changed
+  /// @param info the connection, whose flows are already registered
+  void invalidateGreedySearches(const ConnectionInformation& info);
+
+  /* record of individual connections, for incremental re-planning */
+  std::vector<ConnectionInformation> committedConnections;
+  std::vector<bool> committedConnectionActive;
+  /// slots of connections which have been ripped up, reused first
+  std::vector<size_t> freeCommittedSlots;
+  /// indices of the active connections to each requirement and from
+  /// each supplier
+  std::unordered_map<NodeAndNeed, std::vector<size_t>, NodeAndNeed_hash>
+    committedByConsumer;
+  std::unordered_map<int, std::vector<size_t>> committedBySupplier;
 
   /* methods for indexed cargo routing */
 
+  /// The network graph for modification
+  ///
+  /// Copies the graph first if it is still shared with another map,
+  /// so that flows registered by one scenario are not seen by others.
+  inline CargoGraph& writableNetwork() {
+    if (network.use_count() > 1) {
+      network = std::make_shared<CargoGraph>(*network);
+    }
+    return *network;
+  }
+
+  /// The flows stored on a network edge, see CargoGraph
+  /// @param x the first node of the edge
+  /// @param y the second node of the edge
+  /// @param stored what the network graph stores for (x, y)
+  inline const std::array<float, WagonTypeCount>&
+  edgeFlows(int x, int y, const CargoGraph::WeightedEdge& stored) const {
+    return scenarioFlows.flows(x, y, stored.second);
+  }
+
+  /// The flows stored on a network edge, for modification
+  /// @param x the first node of the edge
+  /// @param y the second node of the edge
+  ///
+  /// @note a scenario keeps its own flows, other maps write the graph
+  std::array<float, WagonTypeCount>& writableEdgeFlows(int x, int y);
+
+  /// The remaining capacity of a supplier
+  /// @param supplier the index of the supplying industry
+  inline float remainingCapacity(int supplier) const {
+    return scenarioFlows.capacity(supplier, network->nodes.at(supplier));
+  }
+
+  /// The remaining capacity of a supplier, for modification
+  /// @param supplier the index of the supplying industry
+  ///
+  /// @note a scenario keeps its own capacities, other maps write the graph
+  float& writableCapacity(int supplier);
+
   /// The number of industries
-  inline size_t industryCount() const {return industries.size();}
+  inline size_t industryCount() const {return entities.industryCount();}
+
+  /// Whether nodes have been renumbered for locality
+  inline bool isRenumbered() const {return !externalNode.empty();}
+
+  /// The index by which callers know a node
+  /// @param node the index of the node within the map
+  inline int toExternal(int node) const {
+    return isRenumbered() ? externalNode[node] : node;
+  }
+
+  /// The node of an index by which callers know it
+  /// @param node the external index of the node
+  inline int toInternal(int node) const {
+    return isRenumbered() ? internalNode[node] : node;
+  }
+
+  /// Put industries and towns back in the order they were added, so that
+  /// more can be added
+  ///
+  /// Renumbers the triangulation, network graph, barrier records and
+  /// connections back, keeping flows, and rebuilds the point and supplier
+  /// indices. Discards the overlay, as buildNetworkGraph does.
+  void restoreNumbering();
+
+  /// Renumber every record of the nodes of the network graph, once the
+  /// entities and triangulation have been renumbered
+  /// @param newIndex the new index of each node, or -1 for a node removed,
+  /// which no edge, connection or requirement may still use
+  ///
+  /// Discards the overlay and routing candidates.
+  void renumberNodeRecords(const std::vector<int>& newIndex);
+
+  /// Whether any connection has been made, even if no longer retained
+  bool hasConnections() const;
 
   /// Does index belong to an industry
   /// @param i index to check
@@ -70,8 +250,25 @@ class Map {
   /// @param sourceIndex the index of the consumer
   /// @param need the cargo type needed
   /// @param quantity the quantity needed
-  std::pair<float, std::vector<int>>
-  shortestRouteUsingCapacity(int sourceIndex, CargoType need, float quantity);
+  /// @param settled if given, nodes settled by the search are appended
+  /// here, including the supplier, and the overlay is not used
+  /// @param costBound give up once every remaining route costs more
+  /// @returns the cost of the route and the index of the supplier, or a
+  /// lower bound on the cost and -1 if no supplier can be reached within
+  /// costBound, which is infinite if no supplier can be reached at all
+  ///
+  /// The route itself is left in searchPrevious, or appended to
+  /// candidatePaths when routing via the overlay.
+  std::pair<float, int>
+  shortestRouteUsingCapacity(int sourceIndex, CargoType need, float quantity,
+                             std::vector<int>* settled = nullptr,
+                             float costBound =
+                               std::numeric_limits<float>::infinity());
+
+  /// shortestRouteUsingCapacity, without tracing
+  std::pair<float, int>
+  searchForRoute(int sourceIndex, CargoType need, float quantity,
+                 std::vector<int>* settled, float costBound);
 
   /// the lowest-cost connection still to be made
   ConnectionInformation findCheapestOutstandingConnection();
@@ -85,7 +282,7 @@ class Map {
   ///
   /// Registers the quantity of the relevant wagon type for each edge travelled.
   /// This means empty return journey capacity can be used by subsewuent routes
-  void registerFlowsInNetwork(const ConnectionInformation &info);
+  void registerFlowsInNetwork(ConnectionInformation &info);
 
   /// Add direct upstream industry chain info to list of outstanding connections
   /// @param info the information of the connection just made
@@ -96,31 +293,564 @@ class Map {
 
   /// calculates the length of a path
   /// @param path the path whose length should be calculated
-  float calculatePathLength(const std::vector<int>& path);
+  float calculatePathLength(PathPool::View path) const;
 
   /// Add a path or increase the quantity of identical registered path
   /// @param info the information of the path to add or increase
-  void addPathOrInreaseCapacity(const ConnectionInformation & info);
+  ///
+  /// If an identical path is already registered, the storage of the
+  /// newly made path is released and info refers to the registered one.
+  void addPathOrInreaseCapacity(ConnectionInformation & info);
+
+  /// Decrease the quantity of a registered path, removing it if none remains
+  /// @param info the information of the path to decrease
+  void removePathOrDecreaseCapacity(const ConnectionInformation & info);
+
+  /// unregister flows in network
+  /// @param info the information for the connection to be unregistered
+  ///
+  /// Reverses registerFlowsInNetwork, restoring edge flows, supplier
+  /// capacity and the list of paths
+  void unregisterFlowsInNetwork(const ConnectionInformation &info);
+
+  /// Index suppliers by the remaining capacity of the network graph
+  void buildSupplierIndex();
+
+  /// Remove the edges of the network crossed by an impassable line
+  /// @param barrier the index of the impassable line
+  /// @returns the triangulation edges removed, which no other line crossed
+  std::vector<int> blockEdgesCrossing(int barrier);
+
+  /// Record that an impassable line crosses a triangulation edge,
+  /// removing it from the network unless another line already did
+  /// @param barrier the index of the impassable line
+  /// @param e the index of the edge in triangulationEdges
+  /// @returns whether the edge was removed
+  bool blockEdge(int barrier, int e);
+
+  /// Add an edge of the triangulation to the network graph and the edge
+  /// records, removing it again if an impassable line crosses it
+  /// @param edge the edge, a < b
+  void addTriangulationEdge(IndexedEdge edge);
+
+  /// Remove an edge of the triangulation from the network graph and the
+  /// edge records, with any flows on it
+  /// @param e the index of the edge in triangulationEdges
+  void removeTriangulationEdge(int e);
+
+  /// Triangulate all locations again, for a change which could not be
+  /// made in place
+  /// @param locations the location of each node after the change
+  /// @param oldIndex the index before the change of each node after it,
+  /// a node added being numbered after the existing ones
+  /// @returns the edges of unmasked triangles removed and added, numbered
+  /// as before the change
+  IndexedDelaunay::LocalChange
+  retriangulate(const std::vector<Point2D>& locations,
+                const std::vector<int>& oldIndex);
+
+  /// Bring the network graph and edge records in line with a change of
+  /// the triangulation, ripping up the connections using removed edges
+  /// @param change the edges changed, numbered as the network graph
+  /// @param requirements the requirements to rip up, with the quantity of
+  /// each, to which those of the connections ripped up are added
+  /// @param renumber renumbers the nodes once removed edges are gone,
+  /// before the added edges are numbered by it
+  /// @returns the number of edges changed
+  template <class F>
+  size_t applyTriangulationChange(
+    const IndexedDelaunay::LocalChange& change,
+    std::unordered_map<NodeAndNeed, float, NodeAndNeed_hash>& requirements,
+    F renumber);
+
+  /// Active committed connections whose path uses an edge or a node
+  /// @param edges the triangulation edges to look for
+  /// @param byNode whether a path touching an end of an edge counts
+  /// @returns the external index of the consumer and the cargo type of
+  /// each connection, once each
+  std::vector<NodeAndNeed> connectionsUsing(const std::vector<int>& edges,
+                                            bool byNode) const;
+
+  /// Quantity of a requirement, both supplied and outstanding
+  /// @param key the consumer and cargo type
+  float currentRequirement(const NodeAndNeed& key) const;
+
+  /// Set the quantity of several requirements and re-plan them
+  /// @param requirements the consumer and cargo type of each requirement
+  /// @param quantities the new quantity of each, zero to remove it
+  ///
+  /// See changeCargoRequirement.
+  void replanRequirements(const std::vector<NodeAndNeed>& requirements,
+                          const std::vector<float>& quantities);
+
+  /// Set the quantity of several requirements, ripping up their
+  /// connections and the inputs their suppliers no longer need, but
+  /// leaving the demand freed outstanding
+  /// @param requirements the consumer and cargo type of each requirement
+  /// @param quantities the new quantity of each, zero to remove it
+  void ripUpRequirements(const std::vector<NodeAndNeed>& requirements,
+                         const std::vector<float>& quantities);
+
+  /// Route the outstanding demand with the routing engine, as the last
+  /// step of a re-plan
+  void routeOutstandingRequirements();
+
+  /// A path by external node indices
+  /// @param path the nodes of the path
+  /// @returns the path itself, or a copy in eventPath if renumbered
+  PathPool::View externalPath(PathPool::View path);
+
+  /// Record a connection just made, so that it can later be ripped up
+  /// @param info the information of the connection
+  void recordCommittedConnection(const ConnectionInformation &info);
+
+  /// Rip up a recorded connection, restoring its flows and freeing its slot
+  /// @param index the index of the connection in committedConnections
+  void ripUpCommittedConnection(size_t index);
+
+  /// Move the paths still in use to a new pool, once paths of ripped up
+  /// connections take up most of it
+  void compactPathPool();
+
+  /// Total active quantity supplied by a node, over all cargo types
+  /// @param supplier the index of the supplying industry
+  float committedQuantitySuppliedBy(int supplier) const;
+
+  /// make connections until no outstanding connection can be made
+  void makeOutstandingConnections();
+
+  /// Search the route of an outstanding connection for the current batch
+  /// @param key the consumer and cargo type of the connection
+  void evaluateCandidate(const NodeAndNeed& key);
+
+  /// Make a connection of the current batch
+  /// @param index the index of the candidate to make
+  ///
+  /// Marks other candidates whose cost may have changed as inexact,
+  /// and evaluates outstanding connections added or changed by it
+  void commitCandidate(size_t index);
+
+  /// make connections until no outstanding connection can be made,
+  /// making several per round where this gives the same connections
+  void makeOutstandingConnectionsInBatches();
+
+  /// Cargo types ordered so that each comes before the cargo types
+  /// its producers require
+  std::vector<CargoType> cargoTypesDownstreamFirst();
+
+  /// make all outstanding connections by solving a min-cost flow problem
+  /// for each cargo type in turn, downstream cargo first
+  void makeConnectionsUsingMinCostFlow();
 
  public:
+  /// Algorithms for making the connections for cargo required
+  enum class RoutingEngine {
+    /// repeatedly make the cheapest outstanding connection,
+    /// of at most 100 units
+    Greedy,
+    /// make the same connections as Greedy, but make several per round
+    /// when later ones are provably unaffected by earlier ones
+    BatchedGreedy,
+    /// route all demand for one cargo type at a time as a min-cost flow
+    MinCostFlow
+  };
+
+  /// Statistics about the efficiency of the generated network
+  struct EfficiencyStats {
+    float totalQuantity = 0.f;
+    float naiveCost = 0.f;
+    float actualCost = 0.f;
+    /// relative saving of the actual cost over the naive cost
+    inline float saving() const {return (naiveCost - actualCost) / naiveCost;}
+  };
+
+  /// Counts of the work done by the last routing run
+  struct RoutingStats {
+    size_t connectionsMade = 0;
+    /// rounds in which all outstanding connections were evaluated
+    size_t rounds = 0;
+    /// route searches run, and those given up as too expensive
+    size_t searches = 0;
+    size_t searchesCutShort = 0;
+    /// searches not run as no supplier could be reached
+    size_t searchesRejected = 0;
+    /// rounds saved compared to making one connection per round
+    inline size_t roundsSaved() const {
+      return connectionsMade > rounds ? connectionsMade - rounds : 0;
+    }
+  };
+
+  /// Progress of a routing run, passed to progress callbacks
+  struct RoutingProgress {
+    size_t connectionsMade;
+    /// outstanding connections, including any which cannot be made
+    size_t outstandingConnections;
+    /// time since the routing run started
+    std::chrono::duration<double> elapsed;
+  };
+  typedef std::function<void(const RoutingProgress&)> ProgressCallback;
+
+  /// A connection as its flows are added to or removed from the network,
+  /// passed to connection sinks
+  struct ConnectionEvent {
+    CargoType cargoType;
+    WagonType wagonType;
+    int supplier;
+    int consumer;
+    /// flow added to each edge of the path, for the wagon type and in the
+    /// direction of travel, negative when a connection is ripped up
+    float quantity;
+    float cost;
+    /// nodes of the path from supplier to consumer, only valid during the
+    /// call
+    PathPool::View path;
+  };
+  /// Receives connection events, only ever called on the thread routing
+  /// the map it was set on, never from the scenarios of a parameter sweep
+  typedef std::function<void(const ConnectionEvent&)> ConnectionSink;
+
+  /// Work done replaying a decision trace, see replayDecisionTrace
+  struct ReplayResult {
+    /// whether the whole trace was read and every connection in it
+    /// followed edges of the network
+    bool complete = false;
+    size_t runs = 0;
+    size_t rounds = 0;
+    size_t searches = 0;
+    /// searches whose cost or supplier differed from the trace
+    size_t mismatches = 0;
+    size_t connectionsMade = 0;
+    size_t connectionsRippedUp = 0;
+    /// time the traced searches took when recorded, and when replayed
+    std::chrono::duration<double> recordedSearchTime {};
+    std::chrono::duration<double> searchTime {};
+    /// time taken replaying changes of flow
+    std::chrono::duration<double> flowTime {};
+  };
+
+  /// The triangle containing a point, see locate
+  struct TriangleLocation {
+    /// whether the point lies in a triangle of the triangulation which
+    /// has not been masked
+    bool found;
+    /// nodes at the corners of the triangle, counter-clockwise
+    std::array<int, 3> nodes;
+  };
+
+  /// Demand left unsupplied by a routing run
+  struct UnmetDemand {
+    int node;
+    CargoType cargoType;
+    float quantity;
+  };
+
+  /// Consistent copy of the routing state, for readers on other threads
+  ///
+  /// Nodes are external indices, as everywhere else.
+  struct Snapshot {
+    /// An undirected edge of the network graph, a < b
+    struct Edge {
+      int a;
+      int b;
+      /// flow of each wagon type from a to b, then from b to a
+      std::array<float, WagonTypeCount> flowAB;
+      std::array<float, WagonTypeCount> flowBA;
+    };
+    /// A path of all_paths, see printAllPaths
+    struct Path {
+      CargoType cargoType;
+      float quantity;
+      float cost;
+      /// nodes of the path from supplier to consumer are pathNodes
+      /// [offset] to pathNodes[offset + length - 1]
+      size_t offset;
+      size_t length;
+    };
+    /// increases with every snapshot published by a map
+    uint64_t epoch = 0;
+    /// connections made by the routing run in progress or last finished
+    size_t connectionsMade = 0;
+    /// edges ordered by a, then b
+    std::vector<Edge> edges;
+    /// remaining output capacity of each industry
+    std::vector<float> supplierCapacity;
+    std::vector<Path> paths;
+    std::vector<int> pathNodes;
+  };
+
+  /// Result of adding or removing an impassable line
+  struct BarrierUpdate {
+    /// the index of the impassable line
+    int barrier;
+    /// the number of edges removed from or restored to the network
+    size_t edgesChanged = 0;
+    /// consumer and cargo type of the committed connections to re-plan,
+    /// which used a removed edge, or may be cheaper using a restored one,
+    /// see replanConnections
+    std::vector<std::pair<int, CargoType>> connectionsToReroute;
+  };
+
+  /// Result of adding or removing a location
+  struct LocationUpdate {
+    /// the index of the location added or removed
+    int node = -1;
+    /// whether the triangulation was changed in place, rather than
+    /// triangulated again where the boundary is concave
+    bool inPlace = true;
+    /// the number of edges removed from or added to the network
+    size_t edgesChanged = 0;
+    /// the number of requirements re-planned: those of a location
+    /// removed, and those whose connections used a removed edge
+    size_t requirementsReplanned = 0;
+  };
+
+  /// Result of a routing run with a time budget
+  struct AnytimeResult {
+    /// whether the budget ran out before routing finished
+    bool timedOut;
+    /// demand which has not been supplied, by node and cargo type
+    std::vector<UnmetDemand> unmetDemand;
+  };
+
+  /// Bytes allocated by the data structures of a map
+  ///
+  /// @note hash map sizes are estimates, see routing/memory_usage.h
+  struct MemoryReport {
+    IndexedDelaunay::MemoryUsage triangulation;
+    CargoGraph::MemoryUsage network;
+    size_t overlay = 0;
+    size_t supplierIndex = 0;
+    /// spatial index of edges and edges removed by impassable lines
+    size_t edgeIndex = 0;
+    /// index of triangles and nodes by location
+    size_t pointIndex = 0;
+    /// maps between node indices and external indices
+    size_t nodeIds = 0;
+    /// locations, cargo types and names of towns and industries
+    size_t entities = 0;
+    /// outstanding connections
+    size_t connectionsToMake = 0;
+    /// connections made, their paths and the record kept for re-planning
+    size_t paths = 0;
+    /// scratch storage of route searches
+    size_t searchScratch = 0;
+    /// the number of towns and industries
+    size_t nodeCount = 0;
+    inline size_t total() const {
+      return triangulation.total() + network.total() + overlay
+        + supplierIndex + edgeIndex + pointIndex + nodeIds + entities
+        + connectionsToMake + paths + searchScratch;
+    }
+    inline float bytesPerNode() const {
+      return nodeCount ? static_cast<float>(total()) / nodeCount : 0.f;
+    }
+  };
+
+  /// Phases of network generation with separate memory high-water marks
+  enum class MemoryPhase {Triangulation, NetworkGraph, Routing};
+
+  /// Largest memory usage seen during a phase
+  struct MemoryHighWaterMark {
+    /// the largest value of each component, which may have been
+    /// reached at different times
+    MemoryReport components;
+    /// the largest total
+    size_t total = 0;
+  };
+
+ private:
+  RoutingEngine routingEngine = RoutingEngine::Greedy;
+  RoutingStats lastRoutingStats;
+
+  /* limits of the current routing run */
+  std::chrono::steady_clock::time_point routingStart;
+  std::chrono::steady_clock::time_point routingDeadline =
+    std::chrono::steady_clock::time_point::max();
+  ProgressCallback routingProgress;
+  /// called as connections are made and ripped up, if set
+  ConnectionSink connectionSink;
+  /// records routing decisions, if set
+  DecisionTrace* decisionTrace = nullptr;
+  /// start of the traced run
+  std::chrono::steady_clock::time_point traceStart;
+
+  /// Count a routing round, and trace it if tracing
+  void roundStarted();
+  /// Trace the start of a routing run or re-plan, if tracing
+  void traceRunStarted();
+  /// Trace the end of a routing run or re-plan, if tracing
+  void traceRunFinished();
+
+  /* snapshots for readers on other threads */
+  /// the latest snapshot, only accessed through std::atomic_load and
+  /// std::atomic_store
+  std::shared_ptr<const Snapshot> latestSnapshot;
+  bool snapshotsEnabled = false;
+  std::chrono::steady_clock::duration snapshotInterval {};
+  std::chrono::steady_clock::time_point lastSnapshotTime;
+  uint64_t snapshotEpoch = 0;
+
+  /// Copy the routing state into a new snapshot and publish it
+  void publishSnapshot();
+
+  /// Publish a snapshot if snapshots are enabled and the interval has
+  /// passed since the last one
+  void publishSnapshotIfDue();
+  /// whether connections made are kept, see setConnectionSink
+  bool retainConnections = true;
+  bool routingTimedOut = false;
+
+  /// Whether the current routing run has used up its time budget
+  ///
+  /// @note records that the run was cut short if so
+  inline bool deadlinePassed() {
+    if (routingDeadline != std::chrono::steady_clock::time_point::max()
+        && std::chrono::steady_clock::now() >= routingDeadline) {
+      routingTimedOut = true;
+    }
+    return routingTimedOut;
+  }
+
+  /// Count a connection made, and report progress if requested
+  void connectionMade();
+
+  /* memory accounting */
+  std::array<MemoryHighWaterMark, 3> memoryHighWaterMarks;
+
+  /// Raise the high-water marks of a phase to a memory report
+  /// @param phase the phase in progress
+  /// @param report the memory usage to include
+  void recordMemoryUsage(MemoryPhase phase, const MemoryReport& report);
+
+ public:
+
+  /// Result of one scenario of a parameter sweep
+  struct SweepResult {
+    float townCargoNeed;
+    size_t connectionCount;
+    EfficiencyStats stats;
+  };
+
   inline Map() {}
 
+ private:
+  struct ScenarioTag {};
+
+  /// Construct a scenario of a parameter sweep
+  /// @param base the map to start from, which must stay unchanged and
+  /// outlive the scenario
+  ///
+  /// Copies the demand, connections and supplier index of the base, and
+  /// shares its network graph read-only, keeping changed flows and
+  /// supplier capacities in scenarioFlows. Structures only needed to edit
+  /// the map, re-plan or answer queries by location are left empty.
+  Map(const Map& base, ScenarioTag);
+
+ public:
+
   /* methods for constructing the map */
 
   /// Add industry
   /// @param industry add this industry to the map
-  inline void addIndustry(Industry industry) {industries.push_back(industry);}
+  ///
+  /// @note undoes renumberForLocality
+  inline void addIndustry(const Industry& industry) {
+    restoreNumbering();
+    entities.addIndustry(industry);
+  }
 
   /// Add town
   /// @param town add this town to the map
-  inline void addTown(Town town) {towns.push_back(town);}
+  ///
+  /// @note undoes renumberForLocality
+  inline void addTown(Town town) {
+    restoreNumbering();
+    entities.addTown(std::move(town));
+  }
+
+  /// Add industries
+  /// @param industries add these industries to the map
+  ///
+  /// @note undoes renumberForLocality
+  inline void addIndustries(const std::vector<Industry>& industries) {
+    restoreNumbering();
+    entities.addIndustries(industries);
+  }
+
+  /// Add towns
+  /// @param towns add these towns to the map, moving their names
+  ///
+  /// @note undoes renumberForLocality
+  inline void addTowns(std::vector<Town> towns) {
+    restoreNumbering();
+    entities.addTowns(std::move(towns));
+  }
 
   /// Add impassable line
   /// @param line add this impassable line to the map
   ///
+  /// @returns the index of the line, and once the network graph has been
+  /// built, the edges removed and the connections using them
+  ///
   /// @note connections which cross impassable lines will not be present
   /// in the final generated network
-  inline void addImpassableLine(Line2D line) {impassableLines.push_back(line);}
+  ///
+  /// Once the network graph has been built, only the edges crossing the
+  /// line are removed, found using a spatial index of the edges. The
+  /// connections using them are left in place until re-planned with
+  /// replanConnections. Any overlay is discarded, call
+  /// enableOverlayRouting again to route using it.
+  BarrierUpdate addImpassableLine(const Line2D& line);
+
+  /// Remove an impassable line
+  /// @param barrier the index returned when the line was added
+  /// @returns the edges restored to the network, and the connections
+  /// which may now be cheaper, once the network graph has been built
+  ///
+  /// Edges still crossed by another line stay removed. As for
+  /// addImpassableLine, connections are not re-planned and any overlay
+  /// is discarded.
+  BarrierUpdate removeImpassableLine(int barrier);
+
+  /// Add an industry, updating the network in place once built
+  /// @param industry the industry, which is numbered after the other
+  /// industries, moving towns up by one
+  /// @returns the index of the industry, and once the network graph has
+  /// been built, what changed
+  ///
+  /// Only the triangles whose circumcircle contains the location are
+  /// replaced. Their edges are replaced in the network, checked against
+  /// impassable lines and updated in the edge index in place. Once
+  /// connections have been made, those which used a removed edge are
+  /// ripped up and re-planned, as by replanConnections. The point and
+  /// supplier indices are rebuilt and any overlay is discarded. Before
+  /// the network graph is built, the same as addIndustry.
+  ///
+  /// @note undoes renumberForLocality
+  LocationUpdate insertIndustry(const Industry& industry);
+
+  /// Add a town, updating the network in place once built
+  /// @param town the town, which is numbered after the other towns
+  /// @returns the index of the town, and what changed
+  ///
+  /// As insertIndustry. The town has no requirements until set with
+  /// changeCargoRequirement.
+  LocationUpdate insertTown(Town town);
+
+  /// Remove an industry or town
+  /// @param node the index of the location, those after it being numbered
+  /// one lower afterwards
+  /// @returns what changed, with edgesChanged zero before the network
+  /// graph has been built
+  ///
+  /// The requirements of the location are dropped. Its triangles are
+  /// replaced by a triangulation of the polygon of its neighbours, and
+  /// their edges in the network and edge index in place. Once connections
+  /// have been made, those which used a removed edge, and so any supplied
+  /// by the location, are ripped up and re-planned, as for insertIndustry.
+  ///
+  /// @note undoes renumberForLocality
+  LocationUpdate removeLocation(int node);
 
   /* methods for making network connections*/
 
@@ -128,28 +858,260 @@ class Map {
   void triangulateAllLocations();
   /// build the network graph from the triangulation
   void buildNetworkGraph();
+  /// renumber nodes so that nearby nodes have nearby indices internally
+  ///
+  /// Orders industries, and separately towns, along a Hilbert curve, so
+  /// that route searches touch less scattered memory. Callers keep using
+  /// the node indices of before, which are translated wherever the map
+  /// takes or reports nodes, including printed output. Rebuilds the
+  /// network graph, laying it out in node order.
+  /// @returns false, changing nothing, once connections have been made
+  ///
+  /// @note call after buildNetworkGraph and before making connections,
+  /// and before enableOverlayRouting. Not available through the C API.
+  bool renumberForLocality();
+  /// build a multi-level overlay of the network graph for faster routing
+  /// @param levelCount the number of levels of cells, at least one
+  /// @param cellSize the approximate number of nodes in the finest cells,
+  /// at least one
+  /// @returns false, changing nothing, if levelCount or cellSize is out
+  /// of range
+  ///
+  /// Worthwhile on large maps. Must be called after buildNetworkGraph,
+  /// which discards the overlay.
+  bool enableOverlayRouting(int levelCount = 3, int cellSize = 64);
   /// set uniform cargo requirements for all needs of each town
   /// @param town_cargo_need the amount of each cargo type needed by each town
   void setUniformTownCargoRequirement(float town_cargo_need);
+  /// set the requirement of one node for one cargo type, without routing
+  /// @param node the index of the consuming node
+  /// @param need the cargo type needed
+  /// @param quantity the quantity needed, zero to remove the requirement
+  void setCargoRequirement(int node, CargoType need, float quantity);
+  /// select the algorithm used by makeAllConnections
+  /// @param engine the routing engine to use
+  ///
+  /// @note changeCargoRequirement re-plans greedily when the min-cost
+  /// flow engine is selected
+  inline void setRoutingEngine(RoutingEngine engine) {routingEngine = engine;}
+  /// receive each connection as soon as its flows are registered
+  /// @param sink called on the routing thread for every connection made,
+  /// and for every connection ripped up with a negative quantity, or
+  /// nullptr to stop
+  /// @param retainConnections whether the map still keeps the connections
+  /// made
+  ///
+  /// Without retaining connections, the paths of connections made are
+  /// released once passed to the sink, so memory no longer grows with
+  /// the number of connections. printAllPaths, efficiencyStats and
+  /// re-planning then only see connections made while they were
+  /// retained. To write connections out while routing continues, pass
+  /// the sink of a ConnectionStream. The scenarios of
+  /// sweepUniformTownCargoRequirement neither call the sink nor release
+  /// their connections.
+  void setConnectionSink(ConnectionSink sink, bool retainConnections = true);
+
+  /// record the decisions made while routing
+  /// @param trace the trace to append to, or nullptr to stop; it must
+  /// stay alive until tracing stops
+  ///
+  /// Each routing run and re-plan records its rounds, every route search
+  /// with its cost and time taken, and the connections made and ripped up
+  /// with their paths. See DecisionTrace for the format. The scenarios of
+  /// sweepUniformTownCargoRequirement are not traced.
+  inline void setDecisionTrace(DecisionTrace* trace) {decisionTrace = trace;}
+
+  /// re-execute the route searches and flow changes of a decision trace
+  /// @param in a trace recorded on a map with the same locations,
+  /// impassable lines and network state as this one
+  /// @returns the work done, and whether it matched the trace
+  ///
+  /// Searches are repeated as recorded, and the flows of the connections
+  /// in the trace are added to and removed from the network. Outstanding
+  /// demand is left unchanged. Stops at the first connection along an
+  /// edge missing from the network.
+  ReplayResult replayDecisionTrace(std::istream& in);
   /// make all supply connections to supply towns with required cargo
   /// and all supply chains needed.
+  ///
+  /// @note stops early if the remaining demand cannot be supplied
   void makeAllConnections();
 
+  /// make connections as makeAllConnections, but stop once a time
+  /// budget has been used up
+  /// @param budget the time allowed
+  /// @param progress if given, called after each connection is made
+  /// @returns whether the budget ran out, and the demand left unmet
+  ///
+  /// Connections made before the budget runs out are kept, so the
+  /// network is usable but may be incomplete. The budget is checked
+  /// between route searches, and between augmenting paths with the
+  /// min-cost flow engine, so it may be overrun by up to one of these
+  /// steps.
+  AnytimeResult makeAllConnectionsWithin(std::chrono::duration<double> budget,
+                                         ProgressCallback progress = nullptr);
+
+  /// change the requirement of one node for one cargo type and re-plan
+  /// @param node the index of the consuming node
+  /// @param need the cargo type needed
+  /// @param quantity the new quantity needed
+  ///
+  /// Rips up the connections supplying this requirement and restores
+  /// their flows and supplier capacities. Each supplier which lost output
+  /// keeps its cheapest inputs per unit which its remaining output still
+  /// needs, and only the rest are ripped up, and so on up the supply
+  /// chain. Only the demand this frees is routed again.
+  ///
+  /// @note the recorded costs of connections which are kept are not
+  /// re-evaluated, even if they used return capacity of ripped up paths
+  void changeCargoRequirement(int node, CargoType need, float quantity);
+
+  /// re-plan the connections of several requirements, keeping the
+  /// quantities required
+  /// @param requirements the consumer and cargo type of each requirement,
+  /// such as BarrierUpdate::connectionsToReroute
+  ///
+  /// Rips up and re-plans as changeCargoRequirement, for all requirements
+  /// at once.
+  void replanConnections(
+    const std::vector<std::pair<int, CargoType>>& requirements);
+
+  /// run the routing once for each of several uniform town demands
+  /// @param townCargoNeeds the uniform town cargo need of each scenario
+  /// @param threadCount the number of scenarios to run in parallel,
+  /// or zero to use one thread per hardware core
+  /// @returns the results of each scenario, in the order given
+  ///
+  /// The triangulation and network graph must already have been built.
+  /// Each scenario starts from the current demand and connections of the
+  /// map and shares its network graph read-only, keeping only the flows
+  /// and supplier capacities it changes. Scenarios do not call the
+  /// connection sink, are not traced and do not publish snapshots. This
+  /// map itself is left unchanged.
+  std::vector<SweepResult> sweepUniformTownCargoRequirement(
+    const std::vector<float>& townCargoNeeds, unsigned threadCount = 0) const;
+
+  /// publish snapshots of the routing state for readers on other threads
+  /// @param interval the least time between snapshots while routing,
+  /// zero for a snapshot after every connection
+  ///
+  /// Publishes one snapshot at once, then during routing at most once
+  /// per interval and once when each routing run or re-plan finishes.
+  /// Each snapshot copies the edge flows, supplier capacities and paths,
+  /// so the interval bounds the time the routing thread spends on them.
+  void enableSnapshots(std::chrono::duration<double> interval =
+                         std::chrono::milliseconds(100));
+
+  /// the latest snapshot, or nullptr before snapshots are enabled
+  ///
+  /// Safe to call from any thread while this map is routing. The
+  /// snapshot stays valid and unchanged for as long as it is held.
+  inline std::shared_ptr<const Snapshot> snapshot() const {
+    return std::atomic_load(&latestSnapshot);
+  }
+
+  /* queries by location */
+
+  /// the triangle of the triangulation containing a point
+  /// @param p the point
+  ///
+  /// Walks from a triangle found in a grid, so takes constant time for
+  /// evenly spread locations. Safe to call from several threads at once,
+  /// also while routing, but not while the triangulation changes.
+  ///
+  /// @note call after triangulateAllLocations
+  TriangleLocation locate(Point2D p) const;
+
+  /// the node nearest to a point
+  /// @param p the point
+  /// @returns the node, or -1 if the map has no locations
+  ///
+  /// Thread safe and fast as locate.
+  ///
+  /// @note call after triangulateAllLocations
+  int nearestNode(Point2D p) const;
+
   /* methods for reporting network structure */
   void printAllEdges(std::ostream& out = std::cout);
   void printAllPaths(std::ostream& out = std::cout);
   void printIndustryInfo(std::ostream& out = std::cout);
   void printTownInfo(std::ostream& out = std::cout);
   void printEfficiencyStats(std::ostream& out = std::cout);
+  static void printSweepResults(const std::vector<SweepResult>& results,
+                                std::ostream& out = std::cout);
+  void printMemoryReport(std::ostream& out = std::cout);
+  void printRoutingStats(std::ostream& out = std::cout);
+
+  /// statistics about the efficiency of the network
+  EfficiencyStats efficiencyStats() const;
+
+  /// work done by the last call of makeAllConnections or
+  /// changeCargoRequirement
+  inline const RoutingStats& routingStats() const {return lastRoutingStats;}
+
+  /// bytes currently allocated by the map
+  MemoryReport memoryUsage() const;
+
+  /// the largest memory usage seen during a phase
+  /// @param phase the phase of network generation
+  ///
+  /// @note usage during routing is sampled after every few connections
+  inline const MemoryHighWaterMark& memoryHighWaterMark(
+      MemoryPhase phase) const {
+    return memoryHighWaterMarks[static_cast<int>(phase)];
+  }
+
+  /// Locations of all nodes, indexed by node, once triangulated
+  inline const std::vector<Point2D>& nodeLocations() const {
+    return isRenumbered() ? externalNodeLocations : triangulation.vertices;
+  }
+
+  /// C API handle, which reads results in place
+  friend struct netgen_map;
 };
 
 struct Map::ConnectionInformation {
   float cost;
   float quantity;
-  std::vector<int> path;
+  /// path from supplier to consumer, stored in the path pool of the map
+  PathPool::Handle path;
   CargoType cargoType;
-  inline int supplier() const {return path.front();}
-  inline int consumer() const {return path.back();}
+  int supplierIndex;
+  int consumerIndex;
+  inline int supplier() const {return supplierIndex;}
+  inline int consumer() const {return consumerIndex;}
+  inline bool isEmpty() const {return path.length == 0;}
+};
+
+struct Map::RoutingCandidate {
+  NodeAndNeed key;
+  float quantity;
+  float cost;
+  /// the least the connection can cost after the connections made since
+  /// it was evaluated
+  float lowerBound;
+  int supplier;
+  WagonType wagonType;
+  /// path from supplier to consumer, in candidatePaths
+  PathPool::Handle path;
+  /// whether cost is still the cost of the cheapest route
+  bool exact;
+  /// whether the candidate has neither been made nor replaced
+  bool active;
+};
+
+struct Map::GreedySearch {
+  float quantity;
+  /// the cost of the route, or a lower bound on it if supplier is -1,
+  /// which is infinite if no supplier can be reached at all
+  float cost;
+  int supplier;
+  WagonType wagonType;
+  /// counts searches of the connection, older settledBy entries are stale
+  uint32_t generation;
+  /// whether no connection made since has touched the nodes it settled
+  /// or used up its supplier
+  bool valid;
 };
 
 #endif  // NETGEN_MAP_H_
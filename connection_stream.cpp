@@ -0,0 +1,62 @@
+//  Copyright 2022 Peter Aisher
+//
+//  connection_stream.cpp
+//  NetGen
+//
+
+#include <utility>
+#include "connection_stream.h"
+
+ConnectionStream::ConnectionStream(Writer writer, size_t capacity)
+  : writer(std::move(writer)), capacity(capacity > 0 ? capacity : 1),
+    thread(&ConnectionStream::run, this) {}
+
+ConnectionStream::~ConnectionStream() {
+  close();
+}
+
+Map::ConnectionSink ConnectionStream::sink() {
+  return [this](const Map::ConnectionEvent& event) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this] {return queue.size() < capacity;});
+    std::vector<int> path;
+    if (!spare.empty()) {
+      path = std::move(spare.back());
+      spare.pop_back();
+    }
+    path.assign(event.path.begin(), event.path.end());
+    queue.push_back({event.cargoType, event.wagonType, event.supplier,
+                     event.consumer, event.quantity, event.cost,
+                     std::move(path)});
+    notEmpty.notify_one();
+  };
+}
+
+void ConnectionStream::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    notEmpty.wait(lock, [this] {return closed || !queue.empty();});
+    if (queue.empty()) {
+      return;
+    }
+    Connection connection = std::move(queue.front());
+    queue.pop_front();
+    notFull.notify_one();
+    lock.unlock();
+    writer(connection);
+    lock.lock();
+    spare.push_back(std::move(connection.path));
+  }
+}
+
+void ConnectionStream::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed) {
+      return;
+    }
+    closed = true;
+  }
+  notEmpty.notify_one();
+  thread.join();
+}
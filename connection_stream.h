@@ -0,0 +1,75 @@
+//  Copyright 2022 Peter Aisher
+//
+//  connection_stream.h
+//  NetGen
+//
+
+#ifndef connection_stream_h
+#define connection_stream_h
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Map.h"
+
+/// Passes connections from a map's routing thread to a writer on a thread
+/// of its own, so that writing them out overlaps routing
+///
+/// Connections are copied into a bounded queue. Routing waits while the
+/// queue is full, so a slow writer limits memory use rather than letting
+/// it grow.
+class ConnectionStream {
+ public:
+  /// A connection or rip-up, as Map::ConnectionEvent but owning its path
+  struct Connection {
+    CargoType cargoType;
+    WagonType wagonType;
+    int supplier;
+    int consumer;
+    float quantity;
+    float cost;
+    std::vector<int> path;
+  };
+  typedef std::function<void(const Connection&)> Writer;
+
+ private:
+  Writer writer;
+  size_t capacity;
+  std::deque<Connection> queue {};
+  /// path storage of written connections, reused for queued ones
+  std::vector<std::vector<int>> spare {};
+  bool closed = false;
+  std::mutex mutex {};
+  std::condition_variable notEmpty {};
+  std::condition_variable notFull {};
+  std::thread thread;
+
+  /// Write connections as they arrive until closed and drained
+  void run();
+
+ public:
+  /// Start the writer thread
+  /// @param writer called on the writer thread for each connection, in
+  /// the order they were made
+  /// @param capacity the most connections queued before routing waits
+  explicit ConnectionStream(Writer writer, size_t capacity = 1024);
+  /// Closes the stream
+  ~ConnectionStream();
+
+  ConnectionStream(const ConnectionStream&) = delete;
+  ConnectionStream& operator=(const ConnectionStream&) = delete;
+
+  /// A sink queueing connections for the writer, see Map::setConnectionSink
+  ///
+  /// @note the sink must not be called once the stream is closed
+  Map::ConnectionSink sink();
+
+  /// Wait until every queued connection has been written, then stop the
+  /// writer thread
+  void close();
+};
+
+#endif /* connection_stream_h */
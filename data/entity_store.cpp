@@ -0,0 +1,129 @@
+//  Copyright 2022 Peter Aisher
+//
+//  entity_store.cpp
+//  NetGen
+//
+
+#include <algorithm>
+#include <utility>
+#include "entity_store.h"
+#include "../routing/memory_usage.h"
+
+EntityStore::EntityStore(const EntityStore& other)
+  : _locations(other._locations), _outputs(other._outputs),
+    _industryCount(other._industryCount),
+    _townRequirements(other._townRequirements),
+    _townNames(other._townNames), _names(other._names) {
+  for (uint32_t i = 0; i < _names.size(); ++i) {
+    _nameIndex.emplace(_names[i], i);
+  }
+}
+
+EntityStore& EntityStore::operator=(const EntityStore& other) {
+  if (this != &other) {
+    EntityStore copy(other);
+    *this = std::move(copy);
+  }
+  return *this;
+}
+
+uint32_t EntityStore::intern(std::string&& name) {
+  auto it = _nameIndex.find(name);
+  if (it != _nameIndex.end()) {
+    return it->second;
+  }
+  const uint32_t index = static_cast<uint32_t>(_names.size());
+  _names.push_back(std::move(name));
+  _nameIndex.emplace(_names.back(), index);
+  return index;
+}
+
+void EntityStore::addIndustry(const Industry& industry) {
+  _locations.insert(_locations.begin() + _industryCount, industry.location());
+  _outputs.insert(_outputs.begin() + _industryCount,
+                  static_cast<uint8_t>(industry.outputType()));
+  ++_industryCount;
+}
+
+void EntityStore::addTown(Town&& town) {
+  _locations.push_back(town.location());
+  _outputs.push_back(noOutput);
+  _townRequirements.push_back(town.cargoRequired());
+  _townNames.push_back(intern(std::move(town._name)));
+}
+
+void EntityStore::addIndustries(const std::vector<Industry>& industries) {
+  // open a gap for the industries before the towns
+  const size_t townsAt = _industryCount;
+  const size_t count = industries.size();
+  _locations.resize(_locations.size() + count);
+  _outputs.resize(_outputs.size() + count);
+  std::move_backward(_locations.begin() + townsAt,
+                     _locations.end() - count, _locations.end());
+  std::move_backward(_outputs.begin() + townsAt,
+                     _outputs.end() - count, _outputs.end());
+  for (size_t i = 0; i < count; ++i) {
+    _locations[townsAt + i] = industries[i].location();
+    _outputs[townsAt + i] = static_cast<uint8_t>(industries[i].outputType());
+  }
+  _industryCount += count;
+}
+
+void EntityStore::addTowns(std::vector<Town>&& towns) {
+  _locations.reserve(_locations.size() + towns.size());
+  _outputs.reserve(_outputs.size() + towns.size());
+  _townRequirements.reserve(_townRequirements.size() + towns.size());
+  _townNames.reserve(_townNames.size() + towns.size());
+  for (Town& town : towns) {
+    addTown(std::move(town));
+  }
+  towns.clear();
+}
+
+void EntityStore::remove(int node) {
+  _locations.erase(_locations.begin() + node);
+  _outputs.erase(_outputs.begin() + node);
+  if (node < _industryCount) {
+    --_industryCount;
+  } else {
+    _townRequirements.erase(_townRequirements.begin()
+                            + (node - _industryCount));
+    _townNames.erase(_townNames.begin() + (node - _industryCount));
+  }
+}
+
+void EntityStore::permute(const std::vector<int>& order) {
+  std::vector<Point2D> locations;
+  std::vector<uint8_t> outputs;
+  std::vector<std::array<CargoType, 2>> townRequirements;
+  std::vector<uint32_t> townNames;
+  locations.reserve(nodeCount());
+  outputs.reserve(nodeCount());
+  townRequirements.reserve(townCount());
+  townNames.reserve(townCount());
+  for (int n = 0; n < order.size(); ++n) {
+    locations.push_back(_locations[order[n]]);
+    outputs.push_back(_outputs[order[n]]);
+    if (n >= _industryCount) {
+      townRequirements.push_back(_townRequirements[order[n] - _industryCount]);
+      townNames.push_back(_townNames[order[n] - _industryCount]);
+    }
+  }
+  _locations.swap(locations);
+  _outputs.swap(outputs);
+  _townRequirements.swap(townRequirements);
+  _townNames.swap(townNames);
+}
+
+size_t EntityStore::memoryUsage() const {
+  size_t bytes = vectorBytes(_locations) + vectorBytes(_outputs)
+    + vectorBytes(_townRequirements) + vectorBytes(_townNames)
+    + hashNodeBytes(_nameIndex) + hashBucketBytes(_nameIndex);
+  for (const std::string& name : _names) {
+    bytes += sizeof(std::string);
+    if (name.capacity() > std::string().capacity()) {
+      bytes += name.capacity() + 1;
+    }
+  }
+  return bytes;
+}
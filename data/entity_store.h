@@ -0,0 +1,114 @@
+//  Copyright 2022 Peter Aisher
+//
+//  entity_store.h
+//  NetGen
+//
+
+#ifndef entity_store_h
+#define entity_store_h
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../vector/vector2.h"
+#include "cargo_type.h"
+#include "industry.h"
+#include "town.h"
+
+/// Towns and industries of a map, stored as one array per field
+///
+/// Nodes are numbered as in the network graph: industries first, then
+/// towns. Locations and output cargo are held for every node, so a route
+/// search checks for a supplier with a single byte load. Town names are
+/// interned, each distinct name being stored once.
+class EntityStore {
+  /// location of each node
+  std::vector<Point2D> _locations {};
+  /// cargo produced by each node, noOutput for towns
+  std::vector<uint8_t> _outputs {};
+  size_t _industryCount = 0;
+  /// cargo required by each town, indexed from the first town
+  std::vector<std::array<CargoType, 2>> _townRequirements {};
+  /// index in _names of the name of each town
+  std::vector<uint32_t> _townNames {};
+  /// distinct town names; a deque so that the views in _nameIndex stay
+  /// valid as names are added
+  std::deque<std::string> _names {};
+  std::unordered_map<std::string_view, uint32_t> _nameIndex {};
+
+  /// Index of a name, adding it if new
+  uint32_t intern(std::string&& name);
+
+ public:
+  /// Output of nodes which produce nothing
+  static constexpr uint8_t noOutput = 0xFF;
+
+  /// Construct an empty store
+  inline EntityStore() {}
+
+  /// Copies must rebuild the name index, which refers to their own names
+  EntityStore(const EntityStore& other);
+  EntityStore& operator=(const EntityStore& other);
+  EntityStore(EntityStore&&) = default;
+  EntityStore& operator=(EntityStore&&) = default;
+
+  /// Add an industry after the existing ones, moving towns up by one
+  void addIndustry(const Industry& industry);
+
+  /// Add a town after the existing ones
+  void addTown(Town&& town);
+
+  /// Add industries, reserving space for all of them first
+  void addIndustries(const std::vector<Industry>& industries);
+
+  /// Add towns, reserving space for all of them first and moving their
+  /// names into the store
+  void addTowns(std::vector<Town>&& towns);
+
+  /// Remove a node, moving those after it down by one
+  void remove(int node);
+
+  /// Reorder nodes
+  /// @param order order[n] is the node to be numbered n, industries
+  /// staying before towns
+  void permute(const std::vector<int>& order);
+
+  inline size_t industryCount() const {return _industryCount;}
+  inline size_t townCount() const {return _townRequirements.size();}
+  inline size_t nodeCount() const {return _locations.size();}
+
+  /// Location of every node, by node index
+  inline const std::vector<Point2D>& locations() const {return _locations;}
+  inline Point2D location(int node) const {return _locations[node];}
+
+  /// Whether a node produces a cargo type
+  inline bool produces(int node, CargoType cargo) const {
+    return _outputs[node] == cargo;
+  }
+
+  /// Cargo produced by an industry
+  inline CargoType outputType(int node) const {
+    return CargoType(_outputs[node]);
+  }
+
+  /// Cargo required by a town
+  /// @param node the node index of the town
+  inline std::array<CargoType, 2> cargoRequired(int node) const {
+    return _townRequirements[node - _industryCount];
+  }
+
+  /// Name of a town
+  /// @param node the node index of the town
+  inline const std::string& townName(int node) const {
+    return _names[_townNames[node - _industryCount]];
+  }
+
+  /// Bytes allocated by the store
+  size_t memoryUsage() const;
+};
+
+#endif /* entity_store_h */
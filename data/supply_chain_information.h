@@ -23,7 +23,7 @@ class SupplyChainInformation {
     {{Steel, 1.0f}, {Plastic, 1.0f}}, {{Steel, 1.0f}, {Planks, 1.0f}}
   };
 public:
-  inline CargoRequirements requirementsForIndustryProducing(CargoType cargo) {return industryRequirements[cargo];}
+  inline const CargoRequirements& requirementsForIndustryProducing(CargoType cargo) const {return industryRequirements[cargo];}
 };
 
 #endif /* supply_chain_information_h */
@@ -7,17 +7,20 @@
 #ifndef town_h
 #define town_h
 
+#include <array>
 #include <string>
+#include <utility>
 #include "vector2.h"
 #include "located_entity.h"
 
 /// Represents a town, which consumes two types of cargo
 class Town: public LocatedEntity {
+  friend class EntityStore;
   std::array<CargoType, 2> _cargoRequired;
   std::string _name;
 public:
-  inline Town(Point2D location, std::array<CargoType, 2> requirements, const char* name)
-    : LocatedEntity(location), _cargoRequired(requirements), _name(name) {}
+  inline Town(Point2D location, std::array<CargoType, 2> requirements, std::string name)
+    : LocatedEntity(location), _cargoRequired(requirements), _name(std::move(name)) {}
   inline std::array<CargoType, 2> cargoRequired() const {return _cargoRequired;}
   inline const std::string& name() const {return _name;}
 };
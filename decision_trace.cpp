@@ -0,0 +1,143 @@
+//  Copyright 2022 Peter Aisher
+//
+//  decision_trace.cpp
+//  NetGen
+//
+
+#include <algorithm>
+#include "decision_trace.h"
+
+namespace {
+
+const char magic[4] = {'N', 'G', 'T', 'R'};
+
+}  // namespace
+
+const uint32_t DecisionTrace::version;
+
+DecisionTrace::DecisionTrace(std::ostream& out) : out(out) {
+  buffer.append(magic, sizeof(magic));
+  append(version);
+}
+
+DecisionTrace::~DecisionTrace() {
+  flush();
+}
+
+void DecisionTrace::runStarted(uint8_t engine, uint32_t nodeCount) {
+  append(RunStarted);
+  append(engine);
+  append(nodeCount);
+  recordAppended();
+}
+
+void DecisionTrace::roundStarted(uint32_t round, uint64_t nanoseconds) {
+  append(RoundStarted);
+  append(round);
+  append(nanoseconds);
+  recordAppended();
+}
+
+void DecisionTrace::search(int consumer, CargoType cargoType, float quantity,
+                           float costBound, bool settled, float cost,
+                           int supplier, uint64_t nanoseconds) {
+  append(Search);
+  append(static_cast<int32_t>(consumer));
+  append(static_cast<uint8_t>(cargoType));
+  append(quantity);
+  append(costBound);
+  append(static_cast<uint8_t>(settled));
+  append(cost);
+  append(static_cast<int32_t>(supplier));
+  append(static_cast<uint32_t>(std::min<uint64_t>(nanoseconds, UINT32_MAX)));
+  recordAppended();
+}
+
+void DecisionTrace::connection(bool rippedUp, CargoType cargoType,
+                               int supplier, int consumer, float quantity,
+                               float cost, PathPool::View path) {
+  append(rippedUp ? ConnectionRippedUp : ConnectionMade);
+  append(static_cast<uint8_t>(cargoType));
+  append(static_cast<int32_t>(supplier));
+  append(static_cast<int32_t>(consumer));
+  append(quantity);
+  append(cost);
+  append(static_cast<uint32_t>(path.size()));
+  for (int node : path) {
+    append(static_cast<int32_t>(node));
+  }
+  recordAppended();
+}
+
+void DecisionTrace::runFinished(uint32_t connections, uint64_t nanoseconds) {
+  append(RunFinished);
+  append(connections);
+  append(nanoseconds);
+  flush();
+}
+
+void DecisionTrace::flush() {
+  out.write(buffer.data(), buffer.size());
+  out.flush();
+  buffer.clear();
+}
+
+DecisionTrace::Reader::Reader(std::istream& in) : in(in) {
+  char header[sizeof(magic)];
+  uint32_t traceVersion = 0;
+  headerValid = in.read(header, sizeof(header))
+    && std::equal(header, header + sizeof(header), magic)
+    && read(traceVersion) && traceVersion == version;
+}
+
+bool DecisionTrace::Reader::next(Record& record) {
+  uint8_t type = 0;
+  if (!headerValid) {
+    return false;
+  }
+  if (!read(type)) {
+    finished = in.eof();
+    return false;
+  }
+  record = Record();
+  record.type = RecordType(type);
+  int32_t consumer = 0;
+  int32_t supplier = 0;
+  uint8_t cargoType = 0;
+  bool ok = false;
+  switch (type) {
+    case RunStarted:
+      ok = read(record.flags) && read(record.count);
+      break;
+    case RoundStarted:
+    case RunFinished:
+      ok = read(record.count) && read(record.nanoseconds);
+      break;
+    case Search: {
+      uint32_t nanoseconds = 0;
+      ok = read(consumer) && read(cargoType) && read(record.quantity)
+        && read(record.costBound) && read(record.flags) && read(record.cost)
+        && read(supplier) && read(nanoseconds);
+      record.nanoseconds = nanoseconds;
+      break;
+    }
+    case ConnectionMade:
+    case ConnectionRippedUp: {
+      uint32_t length = 0;
+      ok = read(cargoType) && read(supplier) && read(consumer)
+        && read(record.quantity) && read(record.cost) && read(length);
+      for (uint32_t i = 0; ok && i < length; ++i) {
+        int32_t node = 0;
+        ok = read(node);
+        record.path.push_back(node);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  record.consumer = consumer;
+  record.supplier = supplier;
+  record.cargoType = CargoType(cargoType);
+  return ok && cargoType < CargoTypeCount;
+}
@@ -0,0 +1,135 @@
+//  Copyright 2022 Peter Aisher
+//
+//  decision_trace.h
+//  NetGen
+//
+
+#ifndef decision_trace_h
+#define decision_trace_h
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "data/cargo_type.h"
+#include "routing/path_pool.h"
+
+/// Compact binary log of the decisions made while routing, see
+/// Map::setDecisionTrace
+///
+/// A trace starts with the magic bytes "NGTR" and a 32 bit version,
+/// followed by records of one type byte and fixed size fields in host byte
+/// order:
+/// - 'B' run started: engine (8 bit), node count (32 bit)
+/// - 'R' round started: round number (32 bit), nanoseconds since the run
+///   started (64 bit)
+/// - 'S' route search: consumer (32 bit), cargo type (8 bit), quantity,
+///   cost bound (floats), whether settled nodes were collected (8 bit),
+///   cost (float), supplier or -1 (32 bit), nanoseconds taken (32 bit)
+/// - 'C' connection made, 'U' connection ripped up: cargo type (8 bit),
+///   supplier, consumer (32 bit), quantity, cost (floats), path length
+///   (32 bit), then the path from supplier to consumer (32 bit each)
+/// - 'E' run finished: connections made (32 bit), nanoseconds since the
+///   run started (64 bit)
+///
+/// Nodes are given by the indices callers know them by. The flow deltas of
+/// a connection are its quantity along each edge of its path.
+class DecisionTrace {
+  std::ostream& out;
+  /// records not yet written to out
+  std::string buffer {};
+
+  template <class T>
+  inline void append(const T& value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+  /// Write buffered records once there are enough of them
+  inline void recordAppended() {
+    if (buffer.size() >= 1 << 16) {
+      flush();
+    }
+  }
+
+ public:
+  static const uint32_t version = 1;
+
+  enum RecordType : uint8_t {
+    RunStarted = 'B',
+    RoundStarted = 'R',
+    Search = 'S',
+    ConnectionMade = 'C',
+    ConnectionRippedUp = 'U',
+    RunFinished = 'E'
+  };
+
+  /// A record read back from a trace, fields unused by its type are zero
+  struct Record {
+    RecordType type;
+    /// engine of a run, or whether a search collected settled nodes
+    uint8_t flags;
+    /// node count of a run, round number, or connections made in a run
+    uint32_t count;
+    /// time since the run started, or taken by a search
+    uint64_t nanoseconds;
+    CargoType cargoType;
+    int consumer;
+    int supplier;
+    float quantity;
+    float costBound;
+    float cost;
+    std::vector<int> path;
+  };
+
+  /// Start a trace
+  /// @param out the stream to write to, which must outlive the trace
+  explicit DecisionTrace(std::ostream& out);
+  /// Writes buffered records
+  ~DecisionTrace();
+
+  DecisionTrace(const DecisionTrace&) = delete;
+  DecisionTrace& operator=(const DecisionTrace&) = delete;
+
+  void runStarted(uint8_t engine, uint32_t nodeCount);
+  void roundStarted(uint32_t round, uint64_t nanoseconds);
+  void search(int consumer, CargoType cargoType, float quantity,
+              float costBound, bool settled, float cost, int supplier,
+              uint64_t nanoseconds);
+  void connection(bool rippedUp, CargoType cargoType, int supplier,
+                  int consumer, float quantity, float cost,
+                  PathPool::View path);
+  void runFinished(uint32_t connections, uint64_t nanoseconds);
+
+  /// Write buffered records to the stream
+  void flush();
+
+  /// Reads the records of a trace in order
+  class Reader {
+    std::istream& in;
+    bool headerValid = false;
+    /// whether the end of the trace fell between records
+    bool finished = false;
+
+    template <class T>
+    inline bool read(T& value) {
+      return static_cast<bool>(
+        in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+   public:
+    /// Start reading a trace, checking its header
+    explicit Reader(std::istream& in);
+
+    /// Whether the stream starts with a trace header of this version
+    inline bool isValid() const {return headerValid;}
+
+    /// Read the next record
+    /// @returns false at the end of the trace, or if the next record is
+    /// truncated or of an unknown type
+    bool next(Record& record);
+
+    /// Whether the whole trace has been read
+    inline bool atEnd() const {return finished;}
+  };
+};
+
+#endif /* decision_trace_h */
@@ -4,7 +4,9 @@
 //  NetGen
 //
 
+#include <fstream>
 #include <iostream>
+#include <memory>
 
 #include <array>
 #include <vector>
@@ -19,9 +21,21 @@
 
 #include "Graph.h"
 #include "Map.h"
+#include "decision_trace.h"
+#include "planning_server.h"
 
 
 int main(int argc, const char * argv[]) {
+  if (argc == 3 && std::string(argv[1]) == "--serve") {
+    // keep a map resident and answer planning requests until shut down
+    PlanningServer server(argv[2]);
+    if (!server.run()) {
+      std::cerr << "cannot listen on " << argv[2] << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
   // insert code here...
   Map m = Map();
 
@@ -90,9 +104,7 @@ int main(int argc, const char * argv[]) {
     {{2079.f, 2236.f}, {CargoType(13), CargoType(11)}, "Coulsdon"}
   };
 
-  for (const auto & town : towns) {
-    m.addTown(town);
-  }
+  m.addTowns(std::move(towns));
 
   std::vector<Line2D> impassable_lines = {
     {{1527.f, 2161.f}, {1613.f, 2295.f}, {1748.f, 2333.f}, {1940.f, 2226.f}},
@@ -147,6 +159,34 @@ int main(int argc, const char * argv[]) {
   m.triangulateAllLocations();
   m.buildNetworkGraph();
   m.setUniformTownCargoRequirement(200.f);
+
+  if (argc == 3 && std::string(argv[1]) == "--replay") {
+    // re-run the searches and flow changes of a trace of this map
+    std::ifstream in(argv[2], std::ios::binary);
+    Map::ReplayResult replay = m.replayDecisionTrace(in);
+    std::cout << "runs:              " << replay.runs << "\n"
+      << "rounds:            " << replay.rounds << "\n"
+      << "searches:          " << replay.searches << "\n"
+      << "mismatches:        " << replay.mismatches << "\n"
+      << "connections made:  " << replay.connectionsMade << "\n"
+      << "ripped up:         " << replay.connectionsRippedUp << "\n"
+      << "recorded search s: " << replay.recordedSearchTime.count() << "\n"
+      << "replayed search s: " << replay.searchTime.count() << "\n"
+      << "replayed flow s:   " << replay.flowTime.count() << std::endl;
+    if (!replay.complete) {
+      std::cerr << "trace " << argv[2] << " is invalid or does not match"
+        << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  std::ofstream traceFile;
+  std::unique_ptr<DecisionTrace> trace;
+  if (argc == 3 && std::string(argv[1]) == "--trace") {
+    traceFile.open(argv[2], std::ios::binary);
+    trace = std::make_unique<DecisionTrace>(traceFile);
+    m.setDecisionTrace(trace.get());
+  }
   m.makeAllConnections();
   m.printIndustryInfo();
   m.printTownInfo();
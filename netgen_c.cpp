@@ -0,0 +1,324 @@
+//  Copyright 2022 Peter Aisher
+//
+//  netgen_c.cpp
+//  NetGen
+//
+
+#include <algorithm>
+#include <new>
+#include <utility>
+#include <vector>
+#include "netgen_c.h"
+#include "Map.h"
+
+static_assert(NETGEN_CARGO_TYPE_COUNT == CargoTypeCount,
+              "cargo types are numbered as CargoType");
+static_assert(NETGEN_WAGON_TYPE_COUNT == WagonTypeCount,
+              "netgen_edge must hold a flow for every wagon type");
+static_assert(sizeof(netgen_point) == sizeof(Point2D)
+              && offsetof(Pair2D, x) == offsetof(netgen_point, x)
+              && offsetof(Pair2D, y) == offsetof(netgen_point, y),
+              "node locations are returned in place");
+static_assert(sizeof(int32_t) == sizeof(int),
+              "path nodes are returned in place");
+
+/// A map and the flattened results handed out by the C API
+///
+/// Node locations and path nodes are returned in place. Edges and
+/// connections are held in hash maps and records with handles, so they
+/// are flattened once after each change and the arrays handed out.
+struct netgen_map {
+  Map map;
+  bool networkBuilt = false;
+  bool connectionsMade = false;
+  /// whether edges and connections reflect the current map
+  bool edgesCurrent = false;
+  bool connectionsCurrent = false;
+  std::vector<netgen_edge> edges;
+  std::vector<netgen_connection> connections;
+
+  inline void changed() {
+    edgesCurrent = false;
+    connectionsCurrent = false;
+  }
+
+  void flattenEdges() {
+    edges.clear();
+    const CargoGraph& graph = *map.network;
+    const auto all = graph.edges();
+    for (auto it = all.begin(); it != all.end(); ++it) {
+      const IndexedEdge edge = *it;
+      const auto& ba = it.weightedEdge();
+      netgen_edge e {edge.a, edge.b, ba.first, {}, {}};
+      // the flow stored on (x, y) is cargo travelling from y to x
+      const auto& ab = graph.storage.at(edge.b).at(edge.a);
+      std::copy(ab.second.begin(), ab.second.end(), e.flow_ab);
+      std::copy(ba.second.begin(), ba.second.end(), e.flow_ba);
+      edges.push_back(e);
+    }
+    std::sort(edges.begin(), edges.end(),
+              [](const netgen_edge& l, const netgen_edge& r) {
+                return l.a < r.a || (l.a == r.a && l.b < r.b);
+              });
+    edgesCurrent = true;
+  }
+
+  void flattenConnections() {
+    connections.clear();
+    for (const auto& p : map.all_paths) {
+      connections.push_back({
+        static_cast<int32_t>(p.cargoType),
+        static_cast<int32_t>(map.cargoInfo.wagonTypeForCargo(p.cargoType)),
+        p.supplier(), p.consumer(), p.quantity, p.cost,
+        p.path.offset, p.path.length});
+    }
+    connectionsCurrent = true;
+  }
+
+  inline const PathPool& pathPool() const {return map.pathPool;}
+};
+
+namespace {
+
+/// Run a call on a map, keeping exceptions from crossing the C ABI
+template <class F>
+netgen_status guarded(netgen_map* map, F f) {
+  if (map == nullptr) {
+    return NETGEN_INVALID_ARGUMENT;
+  }
+  try {
+    return f();
+  } catch (...) {
+    return NETGEN_INTERNAL_ERROR;
+  }
+}
+
+inline bool isCargoType(int cargo_type) {
+  return cargo_type >= 0 && cargo_type < CargoTypeCount;
+}
+
+}  // namespace
+
+netgen_map* netgen_map_create(void) {
+  return new (std::nothrow) netgen_map();
+}
+
+void netgen_map_destroy(netgen_map* map) {
+  delete map;
+}
+
+netgen_status netgen_add_industry(netgen_map* map, float x, float y,
+                                  int cargo_type) {
+  return guarded(map, [&]() {
+    if (!isCargoType(cargo_type)) {
+      return NETGEN_INVALID_ARGUMENT;
+    }
+    if (map->networkBuilt) {
+      map->map.insertIndustry({{x, y}, CargoType(cargo_type)});
+      map->changed();
+    } else {
+      map->map.addIndustry({{x, y}, CargoType(cargo_type)});
+    }
+    return NETGEN_OK;
+  });
+}
+
+netgen_status netgen_add_town(netgen_map* map, float x, float y,
+                              int required_cargo_type_a,
+                              int required_cargo_type_b,
+                              const char* name) {
+  return guarded(map, [&]() {
+    if (!isCargoType(required_cargo_type_a)
+        || !isCargoType(required_cargo_type_b)) {
+      return NETGEN_INVALID_ARGUMENT;
+    }
+    Town town {{x, y}, {CargoType(required_cargo_type_a),
+                         CargoType(required_cargo_type_b)},
+               name ? name : ""};
+    if (map->networkBuilt) {
+      map->map.insertTown(std::move(town));
+      map->changed();
+    } else {
+      map->map.addTown(std::move(town));
+    }
+    return NETGEN_OK;
+  });
+}
+
+netgen_status netgen_remove_location(netgen_map* map, int node) {
+  return guarded(map, [&]() {
+    if (node < 0 || node >= map->map.nodeLocations().size()) {
+      return NETGEN_INVALID_ARGUMENT;
+    }
+    map->map.removeLocation(node);
+    if (map->networkBuilt) {
+      map->changed();
+    }
+    return NETGEN_OK;
+  });
+}
+
+netgen_status netgen_add_impassable_line(netgen_map* map,
+                                         const netgen_point* points,
+                                         size_t point_count) {
+  return guarded(map, [&]() {
+    if (points == nullptr && point_count > 0) {
+      return NETGEN_INVALID_ARGUMENT;
+    }
+    Line2D line;
+    for (size_t i = 0; i < point_count; ++i) {
+      line.emplace_back(points[i].x, points[i].y);
+    }
+    Map::BarrierUpdate update = map->map.addImpassableLine(line);
+    if (map->connectionsMade) {
+      map->map.replanConnections(update.connectionsToReroute);
+    }
+    if (map->networkBuilt) {
+      map->changed();
+    }
+    return NETGEN_OK;
+  });
+}
+
+netgen_status netgen_build_network(netgen_map* map) {
+  return guarded(map, [&]() {
+    map->map.triangulateAllLocations();
+    map->map.buildNetworkGraph();
+    map->networkBuilt = true;
+    map->connectionsMade = false;
+    map->changed();
+    return NETGEN_OK;
+  });
+}
+
+netgen_status netgen_set_uniform_town_cargo_requirement(netgen_map* map,
+                                                        float quantity) {
+  return guarded(map, [&]() {
+    if (!(quantity >= 0.f)) {
+      return NETGEN_INVALID_ARGUMENT;
+    }
+    map->map.setUniformTownCargoRequirement(quantity);
+    return NETGEN_OK;
+  });
+}
+
+netgen_status netgen_set_cargo_requirement(netgen_map* map, int node,
+                                           int cargo_type, float quantity) {
+  return guarded(map, [&]() {
+    if (!isCargoType(cargo_type) || !(quantity >= 0.f)) {
+      return NETGEN_INVALID_ARGUMENT;
+    }
+    if (!map->networkBuilt) {
+      return NETGEN_INVALID_STATE;
+    }
+    if (node < 0 || node >= map->map.nodeLocations().size()) {
+      return NETGEN_INVALID_ARGUMENT;
+    }
+    if (map->connectionsMade) {
+      map->map.changeCargoRequirement(node, CargoType(cargo_type), quantity);
+      map->changed();
+    } else {
+      map->map.setCargoRequirement(node, CargoType(cargo_type), quantity);
+    }
+    return NETGEN_OK;
+  });
+}
+
+netgen_status netgen_set_routing_engine(netgen_map* map,
+                                        netgen_routing_engine engine) {
+  return guarded(map, [&]() {
+    switch (engine) {
+      case NETGEN_ENGINE_GREEDY:
+        map->map.setRoutingEngine(Map::RoutingEngine::Greedy);
+        return NETGEN_OK;
+      case NETGEN_ENGINE_BATCHED_GREEDY:
+        map->map.setRoutingEngine(Map::RoutingEngine::BatchedGreedy);
+        return NETGEN_OK;
+      case NETGEN_ENGINE_MIN_COST_FLOW:
+        map->map.setRoutingEngine(Map::RoutingEngine::MinCostFlow);
+        return NETGEN_OK;
+    }
+    return NETGEN_INVALID_ARGUMENT;
+  });
+}
+
+netgen_status netgen_make_all_connections(netgen_map* map) {
+  return guarded(map, [&]() {
+    if (!map->networkBuilt) {
+      return NETGEN_INVALID_STATE;
+    }
+    map->map.makeAllConnections();
+    map->connectionsMade = true;
+    map->changed();
+    return NETGEN_OK;
+  });
+}
+
+const netgen_point* netgen_node_locations(const netgen_map* map,
+                                          size_t* count) {
+  const std::vector<Point2D>* locations =
+    map ? &map->map.nodeLocations() : nullptr;
+  if (count) {
+    *count = locations ? locations->size() : 0;
+  }
+  return locations && !locations->empty()
+    ? reinterpret_cast<const netgen_point*>(locations->data()) : nullptr;
+}
+
+const netgen_edge* netgen_edges(netgen_map* map, size_t* count) {
+  if (count) {
+    *count = 0;
+  }
+  if (guarded(map, [&]() {
+        if (!map->edgesCurrent) {
+          map->flattenEdges();
+        }
+        return NETGEN_OK;
+      }) != NETGEN_OK) {
+    return nullptr;
+  }
+  if (count) {
+    *count = map->edges.size();
+  }
+  return map->edges.empty() ? nullptr : map->edges.data();
+}
+
+const netgen_connection* netgen_connections(netgen_map* map, size_t* count) {
+  if (count) {
+    *count = 0;
+  }
+  if (guarded(map, [&]() {
+        if (!map->connectionsCurrent) {
+          map->flattenConnections();
+        }
+        return NETGEN_OK;
+      }) != NETGEN_OK) {
+    return nullptr;
+  }
+  if (count) {
+    *count = map->connections.size();
+  }
+  return map->connections.empty() ? nullptr : map->connections.data();
+}
+
+const int32_t* netgen_path_nodes(const netgen_map* map, size_t* count) {
+  if (count) {
+    *count = map ? map->pathPool().size() : 0;
+  }
+  return map && map->pathPool().size() > 0
+    ? reinterpret_cast<const int32_t*>(map->pathPool().data()) : nullptr;
+}
+
+netgen_status netgen_efficiency_stats(const netgen_map* map,
+                                      netgen_efficiency* stats) {
+  if (map == nullptr || stats == nullptr) {
+    return NETGEN_INVALID_ARGUMENT;
+  }
+  try {
+    Map::EfficiencyStats s = map->map.efficiencyStats();
+    *stats = {s.totalQuantity, s.naiveCost, s.actualCost};
+    return NETGEN_OK;
+  } catch (...) {
+    return NETGEN_INTERNAL_ERROR;
+  }
+}
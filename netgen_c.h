@@ -0,0 +1,185 @@
+/*
+ *  Copyright 2022 Peter Aisher
+ *
+ *  netgen_c.h
+ *  NetGen
+ */
+
+#ifndef netgen_c_h
+#define netgen_c_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Symbols of the C API are exported from the shared library, build it
+ * with NETGEN_BUILDING_LIBRARY defined */
+#if defined(_WIN32)
+#  ifdef NETGEN_BUILDING_LIBRARY
+#    define NETGEN_API __declspec(dllexport)
+#  else
+#    define NETGEN_API __declspec(dllimport)
+#  endif
+#else
+#  define NETGEN_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Version of the C API, raised when it changes incompatibly */
+#define NETGEN_API_VERSION 1
+
+/** The number of cargo types, which are numbered from zero as CargoType */
+#define NETGEN_CARGO_TYPE_COUNT 16
+
+/** The number of wagon types, and so of flows per edge direction */
+#define NETGEN_WAGON_TYPE_COUNT 4
+
+/** Result of C API calls */
+typedef enum netgen_status {
+  NETGEN_OK = 0,
+  /** an argument was out of range */
+  NETGEN_INVALID_ARGUMENT = 1,
+  /** the call is not valid before an earlier step, such as building the
+   *  network before routing */
+  NETGEN_INVALID_STATE = 2,
+  /** an internal error, such as running out of memory */
+  NETGEN_INTERNAL_ERROR = 3
+} netgen_status;
+
+/** Algorithms for making connections, see Map::RoutingEngine */
+typedef enum netgen_routing_engine {
+  NETGEN_ENGINE_GREEDY = 0,
+  NETGEN_ENGINE_BATCHED_GREEDY = 1,
+  NETGEN_ENGINE_MIN_COST_FLOW = 2
+} netgen_routing_engine;
+
+/** A map, opaque to callers */
+typedef struct netgen_map netgen_map;
+
+/** A location */
+typedef struct netgen_point {
+  float x;
+  float y;
+} netgen_point;
+
+/** An undirected edge of the network graph, with a < b */
+typedef struct netgen_edge {
+  int32_t a;
+  int32_t b;
+  float weight;
+  /** flow of each wagon type from a to b */
+  float flow_ab[NETGEN_WAGON_TYPE_COUNT];
+  /** flow of each wagon type from b to a */
+  float flow_ba[NETGEN_WAGON_TYPE_COUNT];
+} netgen_edge;
+
+/** A connection made between a supplier and a consumer */
+typedef struct netgen_connection {
+  int32_t cargo_type;
+  int32_t wagon_type;
+  int32_t supplier;
+  int32_t consumer;
+  float quantity;
+  float cost;
+  /** nodes of the path, from supplier to consumer, are path_length
+   *  entries of the path node array starting at path_offset */
+  uint32_t path_offset;
+  uint32_t path_length;
+} netgen_connection;
+
+/** Efficiency of the connections made, see Map::EfficiencyStats */
+typedef struct netgen_efficiency {
+  float total_quantity;
+  float naive_cost;
+  float actual_cost;
+} netgen_efficiency;
+
+/* Array results are views of storage owned by the map, which are not
+ * copied. A view stays valid until the next call which changes the map,
+ * or until the map is destroyed. */
+
+/** Create an empty map, or NULL if out of memory */
+NETGEN_API netgen_map* netgen_map_create(void);
+
+/** Destroy a map, which may be NULL */
+NETGEN_API void netgen_map_destroy(netgen_map* map);
+
+/** Add an industry producing a cargo type; it is given the next node
+ *  index, counting industries before towns, so towns move up by one
+ *
+ *  Once the network has been built, only the triangles around the
+ *  location are replaced, and once connections have been made, only those
+ *  using a replaced edge are re-planned, see Map::insertIndustry. */
+NETGEN_API netgen_status netgen_add_industry(netgen_map* map, float x,
+                                             float y, int cargo_type);
+
+/** Add a town requiring two cargo types, updated in place as for
+ *  netgen_add_industry; demand for it is set with
+ *  netgen_set_cargo_requirement once the network has been built */
+NETGEN_API netgen_status netgen_add_town(netgen_map* map, float x, float y,
+                                         int required_cargo_type_a,
+                                         int required_cargo_type_b,
+                                         const char* name);
+
+/** Remove an industry or town and its demand; nodes after it move down
+ *  by one. Updated in place as for netgen_add_industry, see
+ *  Map::removeLocation */
+NETGEN_API netgen_status netgen_remove_location(netgen_map* map, int node);
+
+/** Add an impassable polyline of point_count points
+ *
+ *  Once the network has been built, only the edges crossing the line are
+ *  removed, and once connections have been made, only those which used
+ *  them are re-planned. */
+NETGEN_API netgen_status netgen_add_impassable_line(
+    netgen_map* map, const netgen_point* points, size_t point_count);
+
+/** Triangulate all locations and build the network graph */
+NETGEN_API netgen_status netgen_build_network(netgen_map* map);
+
+/** Set the same demand for each cargo type required by every town */
+NETGEN_API netgen_status netgen_set_uniform_town_cargo_requirement(
+    netgen_map* map, float quantity);
+
+/** Set the demand of one node for one cargo type, zero to remove it.
+ *  Once connections have been made, only the connections for this demand
+ *  and their supply chains are re-planned, see
+ *  Map::changeCargoRequirement */
+NETGEN_API netgen_status netgen_set_cargo_requirement(netgen_map* map,
+                                                      int node,
+                                                      int cargo_type,
+                                                      float quantity);
+
+/** Choose the routing engine used by netgen_make_all_connections */
+NETGEN_API netgen_status netgen_set_routing_engine(
+    netgen_map* map, netgen_routing_engine engine);
+
+/** Make all connections for the cargo required */
+NETGEN_API netgen_status netgen_make_all_connections(netgen_map* map);
+
+/** Locations of all nodes, indexed by node, industries first */
+NETGEN_API const netgen_point* netgen_node_locations(const netgen_map* map,
+                                                     size_t* count);
+
+/** Edges of the network graph, with their flows */
+NETGEN_API const netgen_edge* netgen_edges(netgen_map* map, size_t* count);
+
+/** Connections made */
+NETGEN_API const netgen_connection* netgen_connections(netgen_map* map,
+                                                       size_t* count);
+
+/** Nodes of the paths of all connections, see netgen_connection */
+NETGEN_API const int32_t* netgen_path_nodes(const netgen_map* map,
+                                            size_t* count);
+
+/** Efficiency of the connections made */
+NETGEN_API netgen_status netgen_efficiency_stats(const netgen_map* map,
+                                                 netgen_efficiency* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* netgen_c_h */
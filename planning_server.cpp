@@ -0,0 +1,489 @@
+//  Copyright 2022 Peter Aisher
+//
+//  planning_server.cpp
+//  NetGen
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "planning_server.h"
+
+namespace {
+
+/// Reads values from a request in host byte order
+struct Reader {
+  const std::string& data;
+  size_t offset = 0;
+
+  template <class T>
+  bool read(T& value) {
+    if (data.size() - offset < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+  }
+};
+
+/// Append a value to a reply in host byte order
+template <class T>
+void write(std::string& out, const T& value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/// Overwrite a value previously appended at an offset
+template <class T>
+void writeAt(std::string& out, size_t offset, const T& value) {
+  std::memcpy(&out[offset], &value, sizeof(T));
+}
+
+bool readFully(int fd, char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = ::read(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool writeFully(int fd, const char* data, size_t size) {
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  while (size > 0) {
+    ssize_t n = ::send(fd, data, size, flags);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+/// Longest request accepted, so a bad length cannot exhaust memory
+constexpr uint32_t maximumRequestSize = 1 << 24;
+
+bool readFrame(int fd, std::string& frame) {
+  uint32_t size = 0;
+  if (!readFully(fd, reinterpret_cast<char*>(&size), sizeof(size))
+      || size > maximumRequestSize) {
+    return false;
+  }
+  frame.resize(size);
+  return readFully(fd, &frame[0], size);
+}
+
+bool writeFrame(int fd, const std::string& frame) {
+  uint32_t size = static_cast<uint32_t>(frame.size());
+  return writeFully(fd, reinterpret_cast<const char*>(&size), sizeof(size))
+    && writeFully(fd, frame.data(), frame.size());
+}
+
+inline bool isCargoType(uint8_t cargo_type) {
+  return cargo_type < NETGEN_CARGO_TYPE_COUNT;
+}
+
+}  // namespace
+
+PlanningServer::PlanningServer(std::string socketPath)
+: socketPath(socketPath) {}
+
+PlanningServer::~PlanningServer() {
+  netgen_map_destroy(map);
+}
+
+netgen_status PlanningServer::rebuild() {
+  netgen_map_destroy(map);
+  map = netgen_map_create();
+  if (map == nullptr) {
+    return NETGEN_INTERNAL_ERROR;
+  }
+  // the map numbers industries before towns
+  handleOfNode.clear();
+  nodeOfHandle.assign(locations.size(), -1);
+  for (bool industries : {true, false}) {
+    for (uint32_t h = 0; h < locations.size(); ++h) {
+      const Location& l = locations[h];
+      if (l.removed || (l.output >= 0) != industries) {
+        continue;
+      }
+      netgen_status status = industries
+        ? netgen_add_industry(map, l.position.x, l.position.y, l.output)
+        : netgen_add_town(map, l.position.x, l.position.y, l.required[0],
+                          l.required[1], nullptr);
+      if (status != NETGEN_OK) {
+        return status;
+      }
+      nodeOfHandle[h] = static_cast<int>(handleOfNode.size());
+      handleOfNode.push_back(h);
+    }
+  }
+  for (const auto& barrier : barriers) {
+    netgen_add_impassable_line(map, barrier.data(), barrier.size());
+  }
+  netgen_status status = netgen_build_network(map);
+  if (status == NETGEN_OK) {
+    status = netgen_set_routing_engine(map, routingEngine);
+  }
+  for (const auto& demand : demands) {
+    if (status == NETGEN_OK) {
+      status = netgen_set_cargo_requirement(
+        map, nodeOfHandle[demand.first.first], demand.first.second,
+        demand.second);
+    }
+  }
+  if (status == NETGEN_OK) {
+    status = netgen_make_all_connections(map);
+  }
+  rebuildNeeded = false;
+  pendingDemands.clear();
+  pendingBarriers.clear();
+  pendingLocations.clear();
+  return status;
+}
+
+netgen_status PlanningServer::updateLocation(uint32_t handle) {
+  const Location& l = locations[handle];
+  int node = nodeOfHandle[handle];
+  netgen_status status = NETGEN_OK;
+  if (l.removed && node >= 0) {
+    status = netgen_remove_location(map, node);
+    if (status == NETGEN_OK) {
+      handleOfNode.erase(handleOfNode.begin() + node);
+      nodeOfHandle[handle] = -1;
+    }
+  } else if (!l.removed && node < 0) {
+    // the map numbers industries before towns
+    auto towns = std::partition_point(
+      handleOfNode.begin(), handleOfNode.end(),
+      [&](uint32_t h) {return locations[h].output >= 0;});
+    node = static_cast<int>(l.output >= 0
+                            ? towns - handleOfNode.begin()
+                            : handleOfNode.size());
+    status = l.output >= 0
+      ? netgen_add_industry(map, l.position.x, l.position.y, l.output)
+      : netgen_add_town(map, l.position.x, l.position.y, l.required[0],
+                        l.required[1], nullptr);
+    if (status == NETGEN_OK) {
+      handleOfNode.insert(handleOfNode.begin() + node, handle);
+    }
+  } else {
+    return status;  // added and removed again since the last re-plan
+  }
+  // the nodes after it moved by one
+  for (size_t i = std::max(node, 0); i < handleOfNode.size(); ++i) {
+    nodeOfHandle[handleOfNode[i]] = static_cast<int>(i);
+  }
+  return status;
+}
+
+netgen_status PlanningServer::replan(std::string& reply) {
+  netgen_status status = NETGEN_OK;
+  if (rebuildNeeded || map == nullptr) {
+    status = rebuild();
+  } else {
+    nodeOfHandle.resize(locations.size(), -1);
+    for (uint32_t handle : pendingLocations) {
+      if (status == NETGEN_OK) {
+        status = updateLocation(handle);
+      }
+    }
+    pendingLocations.clear();
+    for (const auto& demand : pendingDemands) {
+      int node = nodeOfHandle[demand.first.first];
+      if (status == NETGEN_OK && node >= 0) {
+        status = netgen_set_cargo_requirement(map, node, demand.first.second,
+                                              demand.second);
+      }
+    }
+    pendingDemands.clear();
+    for (const auto& barrier : pendingBarriers) {
+      if (status == NETGEN_OK) {
+        status = netgen_add_impassable_line(map, barrier.data(),
+                                            barrier.size());
+      }
+    }
+    pendingBarriers.clear();
+  }
+  write<uint8_t>(reply, status);
+  if (status != NETGEN_OK) {
+    return status;
+  }
+
+  // paths, keyed by cargo type and the handles of their nodes
+  size_t connectionCount = 0;
+  size_t pathNodeCount = 0;
+  const netgen_connection* connections =
+    netgen_connections(map, &connectionCount);
+  const int32_t* pathNodes = netgen_path_nodes(map, &pathNodeCount);
+  std::map<std::vector<uint32_t>, ReportedPath> paths;
+  for (size_t i = 0; i < connectionCount; ++i) {
+    const netgen_connection& c = connections[i];
+    std::vector<uint32_t> key {static_cast<uint32_t>(c.cargo_type)};
+    for (uint32_t k = 0; k < c.path_length; ++k) {
+      key.push_back(handleOfNode[pathNodes[c.path_offset + k]]);
+    }
+    ReportedPath& path = paths[key];
+    path.quantity += c.quantity;
+    path.cost += c.cost;
+  }
+  size_t countOffset = reply.size();
+  uint32_t count = 0;
+  write(reply, count);
+  for (auto it = reportedPaths.begin(); it != reportedPaths.end();) {
+    if (paths.count(it->first)) {
+      ++it;
+      continue;
+    }
+    write(reply, it->second.id);
+    ++count;
+    it = reportedPaths.erase(it);
+  }
+  writeAt(reply, countOffset, count);
+  countOffset = reply.size();
+  count = 0;
+  write(reply, count);
+  for (auto& p : paths) {
+    auto reported = reportedPaths.find(p.first);
+    if (reported != reportedPaths.end()
+        && reported->second.quantity == p.second.quantity
+        && reported->second.cost == p.second.cost) {
+      continue;
+    }
+    p.second.id = reported != reportedPaths.end()
+      ? reported->second.id : nextPathId++;
+    reportedPaths[p.first] = p.second;
+    write(reply, p.second.id);
+    write(reply, static_cast<uint8_t>(p.first[0]));
+    write(reply, p.second.quantity);
+    write(reply, p.second.cost);
+    write(reply, static_cast<uint32_t>(p.first.size() - 1));
+    for (size_t k = 1; k < p.first.size(); ++k) {
+      write(reply, p.first[k]);
+    }
+    ++count;
+  }
+  writeAt(reply, countOffset, count);
+
+  // flows of edges which carry any, keyed by handles in ascending order
+  size_t edgeCount = 0;
+  const netgen_edge* edges = netgen_edges(map, &edgeCount);
+  std::map<std::pair<uint32_t, uint32_t>,
+           std::array<float, 2 * NETGEN_WAGON_TYPE_COUNT>> flows;
+  for (size_t i = 0; i < edgeCount; ++i) {
+    const netgen_edge& e = edges[i];
+    uint32_t a = handleOfNode[e.a];
+    uint32_t b = handleOfNode[e.b];
+    const float* ab = e.flow_ab;
+    const float* ba = e.flow_ba;
+    if (a > b) {
+      std::swap(a, b);
+      std::swap(ab, ba);
+    }
+    std::array<float, 2 * NETGEN_WAGON_TYPE_COUNT> f;
+    bool anyFlow = false;
+    for (int w = 0; w < NETGEN_WAGON_TYPE_COUNT; ++w) {
+      f[w] = ab[w];
+      f[NETGEN_WAGON_TYPE_COUNT + w] = ba[w];
+      anyFlow = anyFlow || ab[w] != 0.f || ba[w] != 0.f;
+    }
+    if (anyFlow) {
+      flows[{a, b}] = f;
+    }
+  }
+  countOffset = reply.size();
+  count = 0;
+  write(reply, count);
+  auto writeFlows = [&](const std::pair<uint32_t, uint32_t>& edge,
+                        const std::array<float, 2 * NETGEN_WAGON_TYPE_COUNT>&
+                        f) {
+    write(reply, edge.first);
+    write(reply, edge.second);
+    for (float value : f) {
+      write(reply, value);
+    }
+    ++count;
+  };
+  for (auto it = reportedFlows.begin(); it != reportedFlows.end();) {
+    if (flows.count(it->first)) {
+      ++it;
+      continue;
+    }
+    writeFlows(it->first, {});
+    it = reportedFlows.erase(it);
+  }
+  for (const auto& f : flows) {
+    auto reported = reportedFlows.find(f.first);
+    if (reported != reportedFlows.end() && reported->second == f.second) {
+      continue;
+    }
+    reportedFlows[f.first] = f.second;
+    writeFlows(f.first, f.second);
+  }
+  writeAt(reply, countOffset, count);
+  return status;
+}
+
+bool PlanningServer::handle(const std::string& request, std::string& reply) {
+  Reader in {request};
+  uint8_t command = 0;
+  in.read(command);
+  switch (command) {
+    case AddIndustry:
+    case AddTown: {
+      Location l {{0.f, 0.f}, -1, {0, 0}, false};
+      uint8_t cargo[2] = {0, 0};
+      bool ok = in.read(l.position.x) && in.read(l.position.y)
+        && in.read(cargo[0]) && isCargoType(cargo[0]);
+      if (command == AddIndustry) {
+        l.output = cargo[0];
+      } else {
+        ok = ok && in.read(cargo[1]) && isCargoType(cargo[1]);
+        l.required = {cargo[0], cargo[1]};
+      }
+      if (!ok) {
+        break;
+      }
+      write<uint8_t>(reply, NETGEN_OK);
+      write(reply, static_cast<uint32_t>(locations.size()));
+      pendingLocations.push_back(static_cast<uint32_t>(locations.size()));
+      locations.push_back(l);
+      return true;
+    }
+    case RemoveLocation: {
+      uint32_t h = 0;
+      if (!in.read(h) || h >= locations.size() || locations[h].removed) {
+        break;
+      }
+      locations[h].removed = true;
+      for (auto it = demands.begin(); it != demands.end();) {
+        it = it->first.first == h ? demands.erase(it) : std::next(it);
+      }
+      pendingLocations.push_back(h);
+      write<uint8_t>(reply, NETGEN_OK);
+      return true;
+    }
+    case AddBarrier: {
+      uint32_t pointCount = 0;
+      if (!in.read(pointCount)
+          || pointCount > (request.size() - in.offset) / sizeof(netgen_point)) {
+        break;
+      }
+      std::vector<netgen_point> barrier(pointCount);
+      for (auto& p : barrier) {
+        in.read(p.x);
+        in.read(p.y);
+      }
+      barriers.push_back(barrier);
+      pendingBarriers.push_back(barrier);
+      write<uint8_t>(reply, NETGEN_OK);
+      return true;
+    }
+    case SetDemand: {
+      uint32_t h = 0;
+      uint8_t cargo = 0;
+      float quantity = 0.f;
+      if (!in.read(h) || !in.read(cargo) || !in.read(quantity)
+          || h >= locations.size() || locations[h].removed
+          || !isCargoType(cargo) || !std::isfinite(quantity)
+          || quantity < 0.f) {
+        break;
+      }
+      std::pair<uint32_t, int> key {h, cargo};
+      if (quantity > 0.f) {
+        demands[key] = quantity;
+      } else {
+        demands.erase(key);
+      }
+      pendingDemands[key] = quantity;
+      write<uint8_t>(reply, NETGEN_OK);
+      return true;
+    }
+    case SetRoutingEngine: {
+      uint8_t engine = 0;
+      if (!in.read(engine) || engine > NETGEN_ENGINE_MIN_COST_FLOW) {
+        break;
+      }
+      routingEngine = static_cast<netgen_routing_engine>(engine);
+      rebuildNeeded = true;
+      write<uint8_t>(reply, NETGEN_OK);
+      return true;
+    }
+    case Replan:
+      replan(reply);
+      return true;
+    case Shutdown:
+      write<uint8_t>(reply, NETGEN_OK);
+      return false;
+  }
+  write<uint8_t>(reply, NETGEN_INVALID_ARGUMENT);
+  return true;
+}
+
+bool PlanningServer::run() {
+  sockaddr_un address {};
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  std::strncpy(address.sun_path, socketPath.c_str(),
+               sizeof(address.sun_path) - 1);
+  int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    return false;
+  }
+  ::unlink(socketPath.c_str());
+  if (::bind(listener, reinterpret_cast<const sockaddr*>(&address),
+             sizeof(address)) < 0
+      || ::listen(listener, 8) < 0) {
+    ::close(listener);
+    return false;
+  }
+
+  bool serving = true;
+  std::string request;
+  std::string reply;
+  while (serving) {
+    int client = ::accept(listener, nullptr, nullptr);
+    if (client < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+#ifdef SO_NOSIGPIPE
+    int noSigPipe = 1;
+    ::setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe,
+                 sizeof(noSigPipe));
+#endif
+    while (serving && readFrame(client, request)) {
+      reply.clear();
+      serving = handle(request, reply);
+      if (!writeFrame(client, reply)) {
+        break;
+      }
+    }
+    ::close(client);
+  }
+  ::close(listener);
+  ::unlink(socketPath.c_str());
+  return true;
+}
@@ -0,0 +1,135 @@
+//  Copyright 2022 Peter Aisher
+//
+//  planning_server.h
+//  NetGen
+//
+
+#ifndef planning_server_h
+#define planning_server_h
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "netgen_c.h"
+
+/// Planning daemon keeping a map resident and answering over a Unix
+/// domain socket
+///
+/// Clients send requests and receive replies as frames of a 32-bit length
+/// followed by that many bytes, in the byte order of the host. A request
+/// starts with a command byte, a reply with a netgen_status byte.
+///
+/// Locations are referred to by handles which stay the same across
+/// re-plans, while node indices change as locations are added and
+/// removed. Demand changes re-plan only the affected supply chains,
+/// barriers only the connections crossing them, and added or removed
+/// locations only the connections through the triangles around them,
+/// all with the engine of the initial plan. Changing the engine rebuilds
+/// the map on the next re-plan, which takes as long as planning from
+/// scratch. The greedy engine is the default, as for Map.
+///
+/// A re-plan replies with what changed since the previous one:
+/// - uint32 count, then the uint32 id of each path no longer used
+/// - uint32 count, then for each path added or whose quantity or cost
+///   changed: uint32 id, uint8 cargo type, float quantity, float cost,
+///   uint32 node count, and the uint32 handle of each node from supplier
+///   to consumer
+/// - uint32 count, then for each edge whose flows changed: uint32 handles
+///   a < b, and float flows of each wagon type from a to b, then from b
+///   to a, all zero for an edge which no longer exists
+class PlanningServer {
+ public:
+  /// Commands, the first byte of a request
+  enum Command : uint8_t {
+    /// float x, float y, uint8 cargo type; replies with a uint32 handle
+    AddIndustry = 1,
+    /// float x, float y, uint8 cargo types a and b; replies with a uint32
+    /// handle
+    AddTown = 2,
+    /// uint32 handle
+    RemoveLocation = 3,
+    /// uint32 point count, then float x and y of each point
+    AddBarrier = 4,
+    /// uint32 handle, uint8 cargo type, float quantity
+    SetDemand = 5,
+    /// replies with the changes since the last re-plan
+    Replan = 6,
+    /// stop serving after replying
+    Shutdown = 7,
+    /// uint8 netgen_routing_engine, used from the next re-plan, which
+    /// rebuilds the map
+    SetRoutingEngine = 8
+  };
+
+ private:
+  struct Location {
+    netgen_point position;
+    /// cargo type produced, or -1 for towns
+    int output;
+    std::array<int, 2> required;
+    bool removed;
+  };
+
+  /// A path as last reported
+  struct ReportedPath {
+    uint32_t id;
+    float quantity;
+    float cost;
+  };
+
+  std::string socketPath;
+  netgen_map* map = nullptr;
+  std::vector<Location> locations {};
+  std::vector<std::vector<netgen_point>> barriers {};
+  /// demand of each location handle for each cargo type
+  std::map<std::pair<uint32_t, int>, float> demands {};
+  /// demand changed since the last re-plan
+  std::map<std::pair<uint32_t, int>, float> pendingDemands {};
+  /// barriers added since the last re-plan
+  std::vector<std::vector<netgen_point>> pendingBarriers {};
+  /// handles of locations added or removed since the last re-plan, in
+  /// order
+  std::vector<uint32_t> pendingLocations {};
+  netgen_routing_engine routingEngine = NETGEN_ENGINE_GREEDY;
+  /// whether the engine changed since the last re-plan
+  bool rebuildNeeded = true;
+  /// location handle of each node, and node of each handle or -1, of the
+  /// map
+  std::vector<uint32_t> handleOfNode {};
+  std::vector<int> nodeOfHandle {};
+
+  /// paths by cargo type and location handles, as last reported
+  std::map<std::vector<uint32_t>, ReportedPath> reportedPaths {};
+  uint32_t nextPathId = 0;
+  /// flows of each edge by location handles, as last reported
+  std::map<std::pair<uint32_t, uint32_t>,
+           std::array<float, 2 * NETGEN_WAGON_TYPE_COUNT>> reportedFlows {};
+
+  /// Build the map from scratch and make all connections
+  netgen_status rebuild();
+  /// Add or remove the location of a handle in the map, if it changed
+  netgen_status updateLocation(uint32_t handle);
+  /// Re-plan and append the changes since the last re-plan
+  netgen_status replan(std::string& reply);
+  /// Handle one request
+  /// @returns false if the server should stop
+  bool handle(const std::string& request, std::string& reply);
+
+ public:
+  /// Construct a server for a socket path
+  /// @param socketPath the path of the Unix domain socket to listen on
+  explicit PlanningServer(std::string socketPath);
+  ~PlanningServer();
+
+  PlanningServer(const PlanningServer&) = delete;
+  PlanningServer& operator=(const PlanningServer&) = delete;
+
+  /// Serve clients one at a time until told to shut down
+  /// @returns false if the socket could not be opened
+  bool run();
+};
+
+#endif /* planning_server_h */
@@ -7,12 +7,13 @@
 #ifndef Graph_h
 #define Graph_h
 
+#include <algorithm>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 #include <utility>
 #include "indexed_primitives.h"
 #include "indexed_delaunay.h"
+#include "memory_usage.h"
 
 /// Represents a graph with edge, weight and vertex information
 template <class E, class W, class V>
@@ -31,6 +32,20 @@ class IntGraph {
 public:
 
   friend class Map;
+  friend class CargoGraphOverlay;
+  friend class SupplierIndex;
+  friend struct netgen_map;
+
+  /// Bytes allocated by a graph
+  struct MemoryUsage {
+    /// hash map nodes, excluding the edge payloads they hold
+    size_t hashNodes = 0;
+    /// hash map bucket arrays
+    size_t buckets = 0;
+    /// weights and edge information of all edges
+    size_t edgePayloads = 0;
+    inline size_t total() const {return hashNodes + buckets + edgePayloads;}
+  };
 
   /// Construct an empty graph with no edges and no vertices;
   inline IntGraph() {}
@@ -63,26 +78,194 @@ public:
     }
   }
 
-  /// Get the neighbors of a node
+  /// The neighbors of a node, as pairs of neighboring node and weighted edge
+  class NeighborView {
+    typedef typename std::unordered_map<int, WeightedEdge>::const_iterator
+      Iterator;
+    Iterator first {};
+    Iterator last {};
+
+   public:
+    inline NeighborView() {}
+    inline NeighborView(Iterator first, Iterator last)
+      : first(first), last(last) {}
+    inline Iterator begin() const {return first;}
+    inline Iterator end() const {return last;}
+    inline bool empty() const {return first == last;}
+  };
+
+  /// Get the neighbors of a node without copying or inserting anything
   ///
   /// @param node the index of the node
   ///
-  /// @returns a map from neighboring nodes to the weighted edges connecting them
-  std::unordered_map<int, WeightedEdge>& getNeighbors(int node) {
-    return storage[node];
+  /// @returns the neighbors, empty if the node has no edges
+  NeighborView neighbors(int node) const {
+    auto it = storage.find(node);
+    if (it == storage.end()) {
+      return NeighborView();
+    }
+    return NeighborView(it->second.begin(), it->second.end());
   }
 
-  /// Get all edges
+  /// All edges, visiting each undirected edge once
+  ///
+  /// An edge present in both directions is visited as a < b, one present
+  /// in a single direction is visited in that direction.
+  class EdgeView {
+    typedef typename std::unordered_map<
+      int, std::unordered_map<int, WeightedEdge>>::const_iterator Outer;
+    typedef typename std::unordered_map<int, WeightedEdge>::const_iterator
+      Inner;
+    const IntGraph* graph;
+
+   public:
+    class iterator {
+      const IntGraph* graph;
+      Outer outer;
+      Inner inner {};
+
+      /// Whether the current entry is the second direction of an edge
+      inline bool isReverse() const {
+        if (outer->first < inner->first) {
+          return false;
+        }
+        auto back = graph->storage.find(inner->first);
+        return back != graph->storage.end()
+          && back->second.count(outer->first) != 0;
+      }
+
+      /// Move to the next entry to visit, starting from the current one
+      inline void settle() {
+        while (outer != graph->storage.end()) {
+          for (; inner != outer->second.end(); ++inner) {
+            if (!isReverse()) {
+              return;
+            }
+          }
+          if (++outer != graph->storage.end()) {
+            inner = outer->second.begin();
+          }
+        }
+      }
+
+     public:
+      inline iterator(const IntGraph* graph, Outer outer)
+        : graph(graph), outer(outer) {
+        if (outer != graph->storage.end()) {
+          inner = outer->second.begin();
+          settle();
+        }
+      }
+      inline IndexedEdge operator*() const {
+        return {outer->first, inner->first};
+      }
+      /// the weight and edge information from a to b
+      inline const WeightedEdge& weightedEdge() const {return inner->second;}
+      inline iterator& operator++() {
+        ++inner;
+        settle();
+        return *this;
+      }
+      inline bool operator==(const iterator& other) const {
+        return outer == other.outer
+          && (outer == graph->storage.end() || inner == other.inner);
+      }
+      inline bool operator!=(const iterator& other) const {
+        return !(*this == other);
+      }
+    };
+
+    inline explicit EdgeView(const IntGraph* graph) : graph(graph) {}
+    inline iterator begin() const {
+      return iterator(graph, graph->storage.begin());
+    }
+    inline iterator end() const {return iterator(graph, graph->storage.end());}
+  };
+
+  /// Get all edges without copying them
   ///
-  /// @returns a set containing all edges
-  std::unordered_set<IndexedEdge> allEdges() {
-    std::unordered_set<IndexedEdge> result {};
+  /// @returns a view visiting each undirected edge once
+  inline EdgeView edges() const {return EdgeView(this);}
+
+  /// Reallocate the graph in ascending node order
+  ///
+  /// Hash map entries are allocated one at a time, in the order they were
+  /// added. Afterwards the edges of nodes with nearby indices lie near
+  /// each other in memory.
+  void layOutInNodeOrder() {
+    std::vector<int> order;
+    order.reserve(storage.size());
     for (const auto& a : storage) {
-      for (const auto& b : a.second) {
-        result.emplace(a.first, b.first);
+      order.push_back(a.first);
+    }
+    std::sort(order.begin(), order.end());
+    std::unordered_map<int, std::unordered_map<int, WeightedEdge>> laidOut;
+    laidOut.reserve(storage.size());
+    std::vector<int> neighborOrder;
+    for (int a : order) {
+      const auto& from = storage.at(a);
+      neighborOrder.clear();
+      for (const auto& b : from) {
+        neighborOrder.push_back(b.first);
+      }
+      std::sort(neighborOrder.begin(), neighborOrder.end());
+      auto& to = laidOut[a];
+      to.reserve(from.size());
+      for (int b : neighborOrder) {
+        to.emplace(b, from.at(b));
+      }
+    }
+    storage.swap(laidOut);
+
+    std::vector<std::pair<int, V>> nodeOrder(nodes.begin(), nodes.end());
+    std::sort(nodeOrder.begin(), nodeOrder.end(),
+              [](const auto& x, const auto& y) {return x.first < y.first;});
+    std::unordered_map<int, V> laidOutNodes;
+    laidOutNodes.reserve(nodeOrder.size());
+    for (const auto& node : nodeOrder) {
+      laidOutNodes.emplace(node.first, node.second);
+    }
+    nodes.swap(laidOutNodes);
+  }
+
+  /// Renumber the nodes, keeping the edges, their weights and information
+  /// and the vertex values
+  ///
+  /// @param newIndex the new index of each node, a permutation
+  void renumberNodes(const std::vector<int>& newIndex) {
+    std::unordered_map<int, std::unordered_map<int, WeightedEdge>> renumbered;
+    renumbered.reserve(storage.size());
+    for (auto& a : storage) {
+      auto& to = renumbered[newIndex[a.first]];
+      to.reserve(a.second.size());
+      for (auto& b : a.second) {
+        to.emplace(newIndex[b.first], std::move(b.second));
       }
     }
-    return result;
+    storage.swap(renumbered);
+
+    std::unordered_map<int, V> renumberedNodes;
+    renumberedNodes.reserve(nodes.size());
+    for (auto& node : nodes) {
+      renumberedNodes.emplace(newIndex[node.first], std::move(node.second));
+    }
+    nodes.swap(renumberedNodes);
+  }
+
+  /// Bytes currently allocated by the graph
+  ///
+  /// @note visits every node once, but not every edge
+  MemoryUsage memoryUsage() const {
+    MemoryUsage usage;
+    usage.hashNodes = hashNodeBytes(storage) + hashNodeBytes(nodes);
+    usage.buckets = hashBucketBytes(storage) + hashBucketBytes(nodes);
+    for (const auto& a : storage) {
+      usage.hashNodes += hashNodeBytes(a.second)
+                         - a.second.size() * sizeof(WeightedEdge);
+      usage.buckets += hashBucketBytes(a.second);
+      usage.edgePayloads += a.second.size() * sizeof(WeightedEdge);
+    }
+    return usage;
   }
 
   /// Construct a graph by adding all edges from a Delaunay triangulation
@@ -0,0 +1,43 @@
+//  Copyright 2022 Peter Aisher
+//
+//  cargo_graph.h
+//  NetGen
+//
+
+#ifndef cargo_graph_h
+#define cargo_graph_h
+
+#include <array>
+#include "Graph.h"
+#include "wagon_type.h"
+
+/// Graph of the cargo network
+///
+/// Edge payloads hold the flow of each wagon type, edge weights are
+/// distances and vertex values are the remaining capacity of suppliers.
+/// The flow stored on edge (u, v) is cargo travelling from v to u.
+typedef IntGraph<std::array<float, WagonTypeCount>, float, float> CargoGraph;
+
+/// Cost of moving cargo across an edge, using empty return capacity
+/// @param weight the weight of the edge
+/// @param outbound_flow flow already moving in the same direction
+/// @param inbound_flow flow moving in the opposite direction
+/// @param quantity the quantity to move
+/// @returns the weight multiplied by the quantity which cannot travel in
+/// wagons which would otherwise return empty
+inline float edgeCostUsingCapacity(float weight, float outbound_flow,
+                                   float inbound_flow, float quantity) {
+  float available_capacity = inbound_flow - outbound_flow;
+
+  float effective_quantity = quantity;
+  if (available_capacity > 0) {
+    if (available_capacity >= quantity) {
+      effective_quantity = 0;
+    } else {
+      effective_quantity -= available_capacity;
+    }
+  }
+  return weight * effective_quantity;
+}
+
+#endif /* cargo_graph_h */
@@ -0,0 +1,400 @@
+//  Copyright 2022 Peter Aisher
+//
+//  cargo_graph_overlay.cpp
+//  NetGen
+//
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include "cargo_graph_overlay.h"
+#include "memory_usage.h"
+
+void CargoGraphOverlay::SearchState::resize(int nodeCount) {
+  distance.assign(nodeCount, 0.f);
+  previous.assign(nodeCount, -1);
+  previousLevel.assign(nodeCount, 0);
+  stamp.assign(nodeCount, 0);
+  settledStamp.assign(nodeCount, 0);
+  searchStamp = 0;
+}
+
+bool CargoGraphOverlay::build(const CargoGraph& graph,
+                              const std::vector<Point2D>& coordinates,
+                              int levelCount, int cellSize) {
+  if (levelCount < 1 || cellSize < 1) {
+    return false;
+  }
+  nodeCount = static_cast<int>(coordinates.size());
+  levels.clear();
+  metrics.clear();
+
+  // split the nodes in half along the longer axis of their bounding box
+  // until the finest cells are small enough
+  int leafDepth = 0;
+  while ((nodeCount >> leafDepth) > cellSize) {
+    ++leafDepth;
+  }
+  std::vector<int> leafOfNode(nodeCount, 0);
+  std::vector<int> order(nodeCount);
+  std::iota(order.begin(), order.end(), 0);
+  std::function<void(int, int, int, int)> split =
+    [&](int begin, int end, int depth, int leaf) {
+    if (depth == leafDepth || end - begin < 2) {
+      for (int i = begin; i < end; ++i) {
+        leafOfNode[order[i]] = leaf << (leafDepth - depth);
+      }
+      return;
+    }
+    float xmin = coordinates[order[begin]].x, xmax = xmin;
+    float ymin = coordinates[order[begin]].y, ymax = ymin;
+    for (int i = begin; i < end; ++i) {
+      const Point2D& p = coordinates[order[i]];
+      xmin = std::min(xmin, p.x);
+      xmax = std::max(xmax, p.x);
+      ymin = std::min(ymin, p.y);
+      ymax = std::max(ymax, p.y);
+    }
+    bool splitX = xmax - xmin >= ymax - ymin;
+    int mid = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid,
+                     order.begin() + end, [&](int a, int b) {
+      return splitX ? coordinates[a].x < coordinates[b].x
+                    : coordinates[a].y < coordinates[b].y;
+    });
+    split(begin, mid, depth + 1, leaf * 2);
+    split(mid, end, depth + 1, leaf * 2 + 1);
+  };
+  split(0, nodeCount, 0, 0);
+
+  // coarser levels merge 2^bitsPerLevel cells of the level below,
+  // the coarsest level keeps at least two cells
+  bitsPerLevel = 0;
+  if (leafDepth > 0) {
+    bitsPerLevel = std::max(1, (leafDepth + levelCount - 1) / levelCount);
+    levelCount = std::min(levelCount, (leafDepth - 1) / bitsPerLevel + 1);
+  } else {
+    levelCount = 1;
+  }
+  levels.resize(levelCount);
+  for (int l = 0; l < levelCount; ++l) {
+    Level& level = levels[l];
+    int shift = bitsPerLevel * l;
+    level.cellOfNode.resize(nodeCount);
+    for (int i = 0; i < nodeCount; ++i) {
+      level.cellOfNode[i] = leafOfNode[i] >> shift;
+    }
+    level.boundaryNodes.resize(size_t(1) << (leafDepth - shift));
+    level.boundaryIndex.assign(nodeCount, -1);
+    for (const auto& u : graph.storage) {
+      int cell = level.cellOfNode[u.first];
+      for (const auto& v : u.second) {
+        if (level.cellOfNode[v.first] != cell
+            && level.boundaryIndex[u.first] < 0) {
+          level.boundaryIndex[u.first] =
+            static_cast<int>(level.boundaryNodes[cell].size());
+          level.boundaryNodes[cell].push_back(u.first);
+        }
+      }
+    }
+  }
+
+  queryState.resize(nodeCount);
+  customizationState.resize(nodeCount);
+  targetStamp.assign(nodeCount, 0);
+  queryStamp = 0;
+  openStamp.resize(levelCount);
+  for (int l = 0; l < levelCount; ++l) {
+    openStamp[l].assign(levels[l].boundaryNodes.size(), 0);
+  }
+  return true;
+}
+
+size_t CargoGraphOverlay::memoryUsage() const {
+  size_t bytes = 0;
+  for (const Level& level : levels) {
+    bytes += vectorBytes(level.cellOfNode) + vectorBytes(level.boundaryIndex)
+      + vectorBytes(level.boundaryNodes);
+    for (const auto& boundary : level.boundaryNodes) {
+      bytes += vectorBytes(boundary);
+    }
+  }
+  for (const Metric& metric : metrics) {
+    for (const auto& cells : metric.cliques) {
+      bytes += vectorBytes(cells);
+      for (const auto& clique : cells) {
+        bytes += vectorBytes(clique);
+      }
+    }
+    for (const auto& dirty : metric.dirty) {
+      bytes += vectorBytes(dirty);
+    }
+  }
+  for (const SearchState* state : {&queryState, &customizationState}) {
+    bytes += vectorBytes(state->distance) + vectorBytes(state->previous)
+      + vectorBytes(state->previousLevel) + vectorBytes(state->stamp)
+      + vectorBytes(state->settledStamp);
+  }
+  for (const auto& open : openStamp) {
+    bytes += vectorBytes(open);
+  }
+  return bytes + vectorBytes(targetStamp) + vectorBytes(unpackedNodes);
+}
+
+void CargoGraphOverlay::edgeFlowChanged(int u, int v, WagonType t) {
+  if (!isBuilt()) {
+    return;
+  }
+  for (auto& metric : metrics) {
+    if (metric.wagonType != t) {
+      continue;
+    }
+    for (int l = 0; l < levels.size(); ++l) {
+      // cut edges of a level are used directly by searches at that level
+      int cell = levels[l].cellOfNode[u];
+      if (cell == levels[l].cellOfNode[v]) {
+        metric.dirty[l][cell] = true;
+      }
+    }
+  }
+}
+
+CargoGraphOverlay::Metric&
+CargoGraphOverlay::metricFor(WagonType t, float quantity) {
+  Metric* metric = nullptr;
+  for (auto& m : metrics) {
+    if (m.wagonType == t && m.quantity == quantity) {
+      metric = &m;
+      break;
+    }
+  }
+  if (metric == nullptr) {
+    if (metrics.size() < maxMetrics) {
+      metrics.emplace_back();
+      metric = &metrics.back();
+    } else {
+      metric = &*std::min_element(metrics.begin(), metrics.end(),
+        [](const Metric& a, const Metric& b) {
+          return a.lastUsed < b.lastUsed;
+        });
+    }
+    metric->wagonType = t;
+    metric->quantity = quantity;
+    metric->cliques.resize(levels.size());
+    metric->dirty.resize(levels.size());
+    for (int l = 0; l < levels.size(); ++l) {
+      metric->cliques[l].resize(levels[l].boundaryNodes.size());
+      metric->dirty[l].assign(levels[l].boundaryNodes.size(), true);
+    }
+  }
+  metric->lastUsed = ++useCounter;
+  return *metric;
+}
+
+void CargoGraphOverlay::customizeIfDirty(const CargoGraph& graph,
+                                         Metric& metric, int level, int cell) {
+  if (!metric.dirty[level - 1][cell]) {
+    return;
+  }
+  // the cell is searched using the shortcuts of its children
+  if (level > 1) {
+    const int firstChild = cell << bitsPerLevel;
+    const int childCount = 1 << bitsPerLevel;
+    for (int child = firstChild; child < firstChild + childCount; ++child) {
+      customizeIfDirty(graph, metric, level - 1, child);
+    }
+  }
+  const std::vector<int>& boundary = levels[level - 1].boundaryNodes[cell];
+  const size_t count = boundary.size();
+  std::vector<float>& clique = metric.cliques[level - 1][cell];
+  clique.assign(count * count, std::numeric_limits<float>::infinity());
+  SearchState& state = customizationState;
+  for (size_t i = 0; i < count; ++i) {
+    search(state, graph, metric, boundary[i], level, -1);
+    for (size_t j = 0; j < count; ++j) {
+      if (state.settledStamp[boundary[j]] == state.searchStamp) {
+        clique[i * count + j] = state.distance[boundary[j]];
+      }
+    }
+  }
+  metric.dirty[level - 1][cell] = false;
+}
+
+int CargoGraphOverlay::search(SearchState& state, const CargoGraph& graph,
+                              Metric& metric, int source, int restrictLevel,
+                              int target) {
+  if (++state.searchStamp == 0) {
+    std::fill(state.stamp.begin(), state.stamp.end(), 0);
+    std::fill(state.settledStamp.begin(), state.settledStamp.end(), 0);
+    state.searchStamp = 1;
+  }
+  std::vector<float>& distance = state.distance;
+  std::vector<unsigned>& stamp = state.stamp;
+  std::vector<unsigned>& settledStamp = state.settledStamp;
+  const unsigned searchStamp = state.searchStamp;
+  const WagonType t = metric.wagonType;
+  const float quantity = metric.quantity;
+  const int restrictCell = restrictLevel > 0
+    ? levels[restrictLevel - 1].cellOfNode[source] : -1;
+
+  typedef std::pair<float, int> QueueEntry;
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>,
+                      std::greater<QueueEntry>> frontier;
+  distance[source] = 0.f;
+  state.previous[source] = -1;
+  state.previousLevel[source] = 0;
+  stamp[source] = searchStamp;
+  frontier.emplace(0.f, source);
+
+  while (!frontier.empty()) {
+    auto u_pair = frontier.top();
+    frontier.pop();
+    const float dist_u = u_pair.first;
+    const int u = u_pair.second;
+    if (settledStamp[u] == searchStamp) {
+      continue;
+    }
+    settledStamp[u] = searchStamp;
+    if (restrictLevel == 0 && dist_u > queryCostBound) {
+      return -2 - u;  // every remaining route costs more than the bound
+    }
+    if (u == target
+        || (restrictLevel == 0 && targetStamp[u] == queryStamp)) {
+      return u;
+    }
+
+    // the coarsest level whose cell around u can be crossed by shortcuts
+    int k = 0;
+    if (restrictLevel > 0) {
+      k = restrictLevel - 1;
+    } else {
+      for (int l = static_cast<int>(levels.size()); l > 0; --l) {
+        if (openStamp[l - 1][levels[l - 1].cellOfNode[u]] != queryStamp) {
+          k = l;
+          break;
+        }
+      }
+    }
+
+    auto relax = [&](int v, float cost, int level) {
+      if (settledStamp[v] == searchStamp) {
+        return;
+      }
+      float alt = dist_u + cost;
+      if (stamp[v] != searchStamp || alt < distance[v]) {
+        stamp[v] = searchStamp;
+        distance[v] = alt;
+        state.previous[v] = u;
+        state.previousLevel[v] = level;
+        frontier.emplace(alt, v);
+      }
+    };
+
+    if (k > 0) {
+      const Level& level = levels[k - 1];
+      const int cell = level.cellOfNode[u];
+      const int i = level.boundaryIndex[u];
+      assert(i >= 0);
+      const std::vector<int>& boundary = level.boundaryNodes[cell];
+      if (restrictLevel == 0) {
+        customizeIfDirty(graph, metric, k, cell);
+      }
+      const float* row = metric.cliques[k - 1][cell].data() + i * boundary.size();
+      for (size_t j = 0; j < boundary.size(); ++j) {
+        if (j != size_t(i) && row[j] < std::numeric_limits<float>::infinity()) {
+          relax(boundary[j], row[j], k);
+        }
+      }
+    }
+
+    for (const auto& v_gr : graph.neighbors(u)) {
+      const int v = v_gr.first;
+      if (k > 0 && levels[k - 1].cellOfNode[v] == levels[k - 1].cellOfNode[u]) {
+        continue;
+      }
+      if (restrictCell >= 0
+          && levels[restrictLevel - 1].cellOfNode[v] != restrictCell) {
+        continue;
+      }
+      float outbound_flow = queryFlows->flows(u, v, v_gr.second.second)[t];
+      float inbound_flow =
+        queryFlows->flows(v, u, graph.storage.at(v).at(u).second)[t];
+      relax(v, edgeCostUsingCapacity(v_gr.second.first, outbound_flow,
+                                     inbound_flow, quantity), 0);
+    }
+  }
+  return -1;
+}
+
+std::vector<CargoGraphOverlay::Hop>
+CargoGraphOverlay::hopsTo(int node, int source) const {
+  std::vector<Hop> hops;
+  for (int v = node; v != source; v = queryState.previous[v]) {
+    hops.push_back({v, queryState.previousLevel[v]});
+  }
+  std::reverse(hops.begin(), hops.end());
+  return hops;
+}
+
+void CargoGraphOverlay::unpack(const CargoGraph& graph, Metric& metric,
+                               int from, Hop hop, std::vector<int>& nodes) {
+  if (hop.level == 0) {
+    nodes.push_back(hop.node);
+    return;
+  }
+  // search the shortcut's cell again one level down
+  search(queryState, graph, metric, from, hop.level, hop.node);
+  std::vector<Hop> hops = hopsTo(hop.node, from);
+  for (const Hop& h : hops) {
+    unpack(graph, metric, from, h, nodes);
+    from = h.node;
+  }
+}
+
+std::pair<float, PathPool::Handle>
+CargoGraphOverlay::shortestRoute(const CargoGraph& graph,
+                                 const ScenarioFlows& flows, int source,
+                                 WagonType t, float quantity,
+                                 const std::vector<int>& targets,
+                                 PathPool& paths, float costBound) {
+  Metric& metric = metricFor(t, quantity);
+  queryCostBound = costBound;
+  queryFlows = &flows;
+  if (++queryStamp == 0) {
+    std::fill(targetStamp.begin(), targetStamp.end(), 0);
+    for (auto& open : openStamp) {
+      std::fill(open.begin(), open.end(), 0);
+    }
+    queryStamp = 1;
+  }
+  // cells containing the source or a target are searched edge by edge
+  for (int l = 0; l < levels.size(); ++l) {
+    openStamp[l][levels[l].cellOfNode[source]] = queryStamp;
+    for (int target : targets) {
+      openStamp[l][levels[l].cellOfNode[target]] = queryStamp;
+    }
+  }
+  for (int target : targets) {
+    targetStamp[target] = queryStamp;
+  }
+
+  int found = search(queryState, graph, metric, source, 0, -1);
+  if (found == -1) {
+    return {std::numeric_limits<float>::infinity(), {}};
+  } else if (found < 0) {
+    return {queryState.distance[-2 - found], {}};
+  }
+  float cost = queryState.distance[found];
+  std::vector<Hop> hops = hopsTo(found, source);
+  unpackedNodes.assign(1, source);
+  int from = source;
+  for (const Hop& hop : hops) {
+    unpack(graph, metric, from, hop, unpackedNodes);
+    from = hop.node;
+  }
+  // the search runs from the consumer, paths run from the supplier
+  return {cost, paths.append(unpackedNodes.rbegin(), unpackedNodes.rend())};
+}
@@ -0,0 +1,175 @@
+//  Copyright 2022 Peter Aisher
+//
+//  cargo_graph_overlay.h
+//  NetGen
+//
+
+#ifndef cargo_graph_overlay_h
+#define cargo_graph_overlay_h
+
+#include <limits>
+#include <vector>
+#include <utility>
+#include "cargo_graph.h"
+#include "path_pool.h"
+#include "scenario_flows.h"
+#include "vector2.h"
+
+/// Multi-level overlay of a cargo graph for fast capacity-aware routing
+///
+/// Nodes are partitioned into nested cells by recursive bisection of
+/// their coordinates. For each metric (wagon type and quantity) every
+/// cell stores the cost of the cheapest route between each pair of its
+/// boundary nodes, computed from the cells of the level below. Searches
+/// then cross cells which contain neither the source nor a target using
+/// these shortcuts, in the style of customizable route planning.
+///
+/// The partition is built once and does not depend on flows. Shortcut
+/// costs are recomputed lazily, only for cells containing edges whose
+/// flows have changed since they were last computed, and only once a
+/// query needs to cross them.
+class CargoGraphOverlay {
+  /// One level of the partition
+  struct Level {
+    /// index of the cell containing each node
+    std::vector<int> cellOfNode {};
+    /// boundary nodes of each cell
+    std::vector<std::vector<int>> boundaryNodes {};
+    /// index of each node in the boundary of its cell, or -1 if interior
+    std::vector<int> boundaryIndex {};
+  };
+
+  /// Shortcut costs for one metric
+  struct Metric {
+    WagonType wagonType;
+    float quantity;
+    /// boundary to boundary costs for each level and cell, row major
+    std::vector<std::vector<std::vector<float>>> cliques {};
+    /// cells whose shortcut costs must be recomputed, for each level
+    std::vector<std::vector<bool>> dirty {};
+    unsigned long lastUsed = 0;
+  };
+
+  /// A step of a route, reached via a shortcut at a level (or 0 for an edge)
+  struct Hop {
+    int node;
+    int level;
+  };
+
+  /// Scratch storage for a search, valid where stamp matches searchStamp
+  struct SearchState {
+    std::vector<float> distance {};
+    std::vector<int> previous {};
+    std::vector<int> previousLevel {};
+    std::vector<unsigned> stamp {};
+    std::vector<unsigned> settledStamp {};
+    unsigned searchStamp = 0;
+    void resize(int nodeCount);
+  };
+
+  /// Levels of the partition, from the finest upwards
+  std::vector<Level> levels {};
+  /// each cell contains 2^bitsPerLevel cells of the level below
+  int bitsPerLevel = 0;
+  std::vector<Metric> metrics {};
+  int nodeCount = 0;
+  unsigned long useCounter = 0;
+
+  /* separate scratch storage, so cells can be customized during a query */
+  SearchState queryState;
+  SearchState customizationState;
+  /* cells which a query must search at a finer level */
+  std::vector<std::vector<unsigned>> openStamp {};
+  std::vector<unsigned> targetStamp {};
+  unsigned queryStamp = 0;
+  /// queries abandon routes costing more than this
+  float queryCostBound = 0.f;
+  /// flows of the current query's scenario, read over those of the graph
+  const ScenarioFlows* queryFlows = nullptr;
+  /* reused between queries to assemble the unpacked route */
+  std::vector<int> unpackedNodes {};
+
+  /// The maximum number of metrics to keep shortcut costs for
+  static constexpr size_t maxMetrics = 8;
+
+  /// The metric for a wagon type and quantity
+  Metric& metricFor(WagonType t, float quantity);
+
+  /// Make the shortcut costs of a cell current, with those of its children
+  /// @note cells are customized lazily, when a query first needs them
+  void customizeIfDirty(const CargoGraph& graph, Metric& metric,
+                        int level, int cell);
+
+  /// Run a Dijkstra search
+  /// @param state the scratch storage to use
+  /// @param source the node to start from
+  /// @param restrictLevel if positive, only search within the cell at this
+  /// level containing the source, using shortcuts of the level below
+  /// @param target stop once this node is settled, or -1
+  /// @returns the first settled node which is the target or a query
+  /// target, or -1 if none is reached, or -2 - u if a query gave up at
+  /// node u because of its cost bound
+  int search(SearchState& state, const CargoGraph& graph, Metric& metric,
+             int source, int restrictLevel, int target);
+
+  /// The hops leading to a node settled by the last query search
+  std::vector<Hop> hopsTo(int node, int source) const;
+
+  /// Expand a hop reached via a shortcut into the nodes it passes through
+  /// @param from the node the shortcut starts at
+  /// @param hop the end of the shortcut
+  /// @param nodes nodes after `from`, up to and including the end of the
+  /// shortcut, are appended here
+  void unpack(const CargoGraph& graph, Metric& metric, int from,
+              Hop hop, std::vector<int>& nodes);
+
+ public:
+  /// Construct an empty overlay
+  inline CargoGraphOverlay() {}
+
+  /// Build the partition of a graph
+  /// @param graph the graph to partition
+  /// @param coordinates the location of each node
+  /// @param levelCount the number of levels of cells, at least one
+  /// @param cellSize the approximate number of nodes in the finest cells,
+  /// at least one
+  /// @returns false, leaving the overlay unchanged, if levelCount or
+  /// cellSize is out of range
+  ///
+  /// @note must be rebuilt if edges are added to the graph
+  bool build(const CargoGraph& graph, const std::vector<Point2D>& coordinates,
+             int levelCount, int cellSize);
+
+  /// Whether the overlay has been built
+  inline bool isBuilt() const {return nodeCount > 0;}
+
+  /// Bytes allocated for the partition, shortcut costs and scratch storage
+  size_t memoryUsage() const;
+
+  /// Mark the flows of an edge as changed
+  /// @param u one end of the edge
+  /// @param v the other end of the edge
+  /// @param t the wagon type whose flow changed
+  void edgeFlowChanged(int u, int v, WagonType t);
+
+  /// Cheapest route from a consumer to any of several suppliers
+  /// @param graph the graph to search
+  /// @param flows changes to the flows of the graph, see ScenarioFlows
+  /// @param source the index of the consumer
+  /// @param t the wagon type of the cargo
+  /// @param quantity the quantity needed
+  /// @param targets suppliers with enough remaining capacity
+  /// @param paths the path from supplier to consumer is appended here
+  /// @param costBound give up once every remaining route costs more
+  /// @returns the cost and the handle of the path in `paths`, or an
+  /// empty handle with a lower bound on the cost if no target can be
+  /// reached within costBound, which is infinite if none can be reached
+  std::pair<float, PathPool::Handle>
+  shortestRoute(const CargoGraph& graph, const ScenarioFlows& flows,
+                int source, WagonType t,
+                float quantity, const std::vector<int>& targets,
+                PathPool& paths,
+                float costBound = std::numeric_limits<float>::infinity());
+};
+
+#endif /* cargo_graph_overlay_h */
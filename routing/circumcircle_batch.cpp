@@ -0,0 +1,234 @@
+//  Copyright 2022 Peter Aisher
+//
+//  circumcircle_batch.cpp
+//  NetGen
+//
+
+#include <limits>
+#include "circumcircle_batch.h"
+#include "simd_support.h"
+
+namespace {
+
+/// Pointers to the padded coordinate arrays of a circumcircle batch
+struct CornerArrays {
+  const float* ax;
+  const float* ay;
+  const float* bx;
+  const float* by;
+  const float* cx;
+  const float* cy;
+  size_t count;
+  size_t paddedCount;
+};
+
+typedef void (*InCircleKernel)(const CornerArrays&, const Point2D&,
+                               std::vector<int>&);
+
+// All kernels evaluate the determinant of
+// IndexedDelaunay::pointIsInCircumcircle term by term in the same order,
+// so that they agree exactly with each other and with the scalar test.
+
+void inCircleScalar(const CornerArrays& arr, const Point2D& d,
+                    std::vector<int>& result) {
+  const float dd = d.x*d.x;
+  const float ee = d.y*d.y;
+  for (size_t i = 0; i < arr.count; ++i) {
+    float d11 = arr.ax[i] - d.x;
+    float d21 = arr.bx[i] - d.x;
+    float d31 = arr.cx[i] - d.x;
+
+    float d12 = arr.ay[i] - d.y;
+    float d22 = arr.by[i] - d.y;
+    float d32 = arr.cy[i] - d.y;
+
+    float d13 = arr.ax[i]*arr.ax[i] - dd + arr.ay[i]*arr.ay[i] - ee;
+    float d23 = arr.bx[i]*arr.bx[i] - dd + arr.by[i]*arr.by[i] - ee;
+    float d33 = arr.cx[i]*arr.cx[i] - dd + arr.cy[i]*arr.cy[i] - ee;
+
+    float det = (d11 * d22 * d33) + (d21 * d32 * d13) + (d31 * d12 * d23)
+              - (d31 * d22 * d13) - (d21 * d12 * d33) - (d11 * d32 * d23);
+    if (det > 0) {
+      result.push_back(static_cast<int>(i));
+    }
+  }
+}
+
+/// Append the indices of the set bits of a lane mask
+inline void appendLanes(int mask, size_t base, std::vector<int>& result) {
+  while (mask) {
+    int lane = __builtin_ctz(mask);
+    result.push_back(static_cast<int>(base) + lane);
+    mask &= mask - 1;
+  }
+}
+
+#ifdef NETGEN_X86_SIMD
+
+void inCircleSSE(const CornerArrays& arr, const Point2D& d,
+                 std::vector<int>& result) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 px = _mm_set1_ps(d.x);
+  const __m128 py = _mm_set1_ps(d.y);
+  const __m128 dd = _mm_set1_ps(d.x*d.x);
+  const __m128 ee = _mm_set1_ps(d.y*d.y);
+  for (size_t i = 0; i < arr.paddedCount; i += 4) {
+    const __m128 ax = _mm_loadu_ps(arr.ax + i);
+    const __m128 ay = _mm_loadu_ps(arr.ay + i);
+    const __m128 bx = _mm_loadu_ps(arr.bx + i);
+    const __m128 by = _mm_loadu_ps(arr.by + i);
+    const __m128 cx = _mm_loadu_ps(arr.cx + i);
+    const __m128 cy = _mm_loadu_ps(arr.cy + i);
+    __m128 d11 = _mm_sub_ps(ax, px);
+    __m128 d21 = _mm_sub_ps(bx, px);
+    __m128 d31 = _mm_sub_ps(cx, px);
+    __m128 d12 = _mm_sub_ps(ay, py);
+    __m128 d22 = _mm_sub_ps(by, py);
+    __m128 d32 = _mm_sub_ps(cy, py);
+    __m128 d13 = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(ax, ax), dd),
+                                       _mm_mul_ps(ay, ay)), ee);
+    __m128 d23 = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(bx, bx), dd),
+                                       _mm_mul_ps(by, by)), ee);
+    __m128 d33 = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(cx, cx), dd),
+                                       _mm_mul_ps(cy, cy)), ee);
+    __m128 det = _mm_mul_ps(_mm_mul_ps(d11, d22), d33);
+    det = _mm_add_ps(det, _mm_mul_ps(_mm_mul_ps(d21, d32), d13));
+    det = _mm_add_ps(det, _mm_mul_ps(_mm_mul_ps(d31, d12), d23));
+    det = _mm_sub_ps(det, _mm_mul_ps(_mm_mul_ps(d31, d22), d13));
+    det = _mm_sub_ps(det, _mm_mul_ps(_mm_mul_ps(d21, d12), d33));
+    det = _mm_sub_ps(det, _mm_mul_ps(_mm_mul_ps(d11, d32), d23));
+    appendLanes(_mm_movemask_ps(_mm_cmpgt_ps(det, zero)), i, result);
+  }
+}
+
+__attribute__((target("avx2")))
+void inCircleAVX2(const CornerArrays& arr, const Point2D& d,
+                  std::vector<int>& result) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 px = _mm256_set1_ps(d.x);
+  const __m256 py = _mm256_set1_ps(d.y);
+  const __m256 dd = _mm256_set1_ps(d.x*d.x);
+  const __m256 ee = _mm256_set1_ps(d.y*d.y);
+  for (size_t i = 0; i < arr.paddedCount; i += 8) {
+    const __m256 ax = _mm256_loadu_ps(arr.ax + i);
+    const __m256 ay = _mm256_loadu_ps(arr.ay + i);
+    const __m256 bx = _mm256_loadu_ps(arr.bx + i);
+    const __m256 by = _mm256_loadu_ps(arr.by + i);
+    const __m256 cx = _mm256_loadu_ps(arr.cx + i);
+    const __m256 cy = _mm256_loadu_ps(arr.cy + i);
+    __m256 d11 = _mm256_sub_ps(ax, px);
+    __m256 d21 = _mm256_sub_ps(bx, px);
+    __m256 d31 = _mm256_sub_ps(cx, px);
+    __m256 d12 = _mm256_sub_ps(ay, py);
+    __m256 d22 = _mm256_sub_ps(by, py);
+    __m256 d32 = _mm256_sub_ps(cy, py);
+    __m256 d13 = _mm256_sub_ps(
+      _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(ax, ax), dd),
+                    _mm256_mul_ps(ay, ay)), ee);
+    __m256 d23 = _mm256_sub_ps(
+      _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(bx, bx), dd),
+                    _mm256_mul_ps(by, by)), ee);
+    __m256 d33 = _mm256_sub_ps(
+      _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(cx, cx), dd),
+                    _mm256_mul_ps(cy, cy)), ee);
+    __m256 det = _mm256_mul_ps(_mm256_mul_ps(d11, d22), d33);
+    det = _mm256_add_ps(det, _mm256_mul_ps(_mm256_mul_ps(d21, d32), d13));
+    det = _mm256_add_ps(det, _mm256_mul_ps(_mm256_mul_ps(d31, d12), d23));
+    det = _mm256_sub_ps(det, _mm256_mul_ps(_mm256_mul_ps(d31, d22), d13));
+    det = _mm256_sub_ps(det, _mm256_mul_ps(_mm256_mul_ps(d21, d12), d33));
+    det = _mm256_sub_ps(det, _mm256_mul_ps(_mm256_mul_ps(d11, d32), d23));
+    appendLanes(_mm256_movemask_ps(_mm256_cmp_ps(det, zero, _CMP_GT_OQ)),
+                i, result);
+  }
+}
+
+#endif  // NETGEN_X86_SIMD
+
+InCircleKernel selectKernel() {
+  switch (detectSimdLevel()) {
+#ifdef NETGEN_X86_SIMD
+    case SimdLevel::AVX2:
+      return inCircleAVX2;
+    case SimdLevel::SSE:
+      return inCircleSSE;
+#endif
+    default:
+      return inCircleScalar;
+  }
+}
+
+}  // namespace
+
+void CircumcircleBatch::reserveSlots(size_t n) {
+  if (n <= ax.size()) {
+    return;
+  }
+  size_t padded = std::max(ax.size() * 2, n + batchWidth - 1);
+  padded -= padded % batchWidth;
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  ax.resize(padded, nan);
+  ay.resize(padded, nan);
+  bx.resize(padded, nan);
+  by.resize(padded, nan);
+  cx.resize(padded, nan);
+  cy.resize(padded, nan);
+}
+
+void CircumcircleBatch::push_back(const Point2D& a, const Point2D& b,
+                                  const Point2D& c) {
+  reserveSlots(count + 1);
+  set(count++, a, b, c);
+}
+
+void CircumcircleBatch::set(size_t i, const Point2D& a, const Point2D& b,
+                            const Point2D& c) {
+  ax[i] = a.x;
+  ay[i] = a.y;
+  bx[i] = b.x;
+  by[i] = b.y;
+  cx[i] = c.x;
+  cy[i] = c.y;
+}
+
+void CircumcircleBatch::copySlot(size_t from, size_t to) {
+  ax[to] = ax[from];
+  ay[to] = ay[from];
+  bx[to] = bx[from];
+  by[to] = by[from];
+  cx[to] = cx[from];
+  cy[to] = cy[from];
+}
+
+void CircumcircleBatch::invalidate(size_t i) {
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  set(i, {nan, nan}, {nan, nan}, {nan, nan});
+}
+
+void CircumcircleBatch::resize(size_t n) {
+  reserveSlots(n);
+  for (size_t i = n; i < count; ++i) {
+    invalidate(i);
+  }
+  count = n;
+}
+
+void CircumcircleBatch::clear() {
+  ax.clear();
+  ay.clear();
+  bx.clear();
+  by.clear();
+  cx.clear();
+  cy.clear();
+  count = 0;
+}
+
+void CircumcircleBatch::trianglesWithCircumcircleContaining(
+    const Point2D& d, std::vector<int>& result) const {
+  static const InCircleKernel kernel = selectKernel();
+  if (count == 0) {
+    return;
+  }
+  size_t paddedCount = (count + batchWidth - 1) / batchWidth * batchWidth;
+  kernel({ax.data(), ay.data(), bx.data(), by.data(), cx.data(), cy.data(),
+          count, paddedCount}, d, result);
+}
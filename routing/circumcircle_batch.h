@@ -0,0 +1,86 @@
+//  Copyright 2022 Peter Aisher
+//
+//  circumcircle_batch.h
+//  NetGen
+//
+
+#ifndef circumcircle_batch_h
+#define circumcircle_batch_h
+
+#include <vector>
+#include "vector2.h"
+
+/// Structure-of-arrays store of triangle corner coordinates
+///
+/// Slot i holds the corners of triangle i of a triangulation, so that
+/// the in-circumcircle test for one point can be evaluated against eight
+/// triangles at a time using AVX2 or SSE where available.
+/// Unused slots hold NaN coordinates and never test positive.
+class CircumcircleBatch {
+  std::vector<float> ax {};
+  std::vector<float> ay {};
+  std::vector<float> bx {};
+  std::vector<float> by {};
+  std::vector<float> cx {};
+  std::vector<float> cy {};
+  size_t count = 0;
+
+  /// Grow the padded arrays to hold at least n slots
+  void reserveSlots(size_t n);
+
+ public:
+  /// Number of triangles processed per batch
+  static constexpr size_t batchWidth = 8;
+
+  /// Construct an empty store
+  inline CircumcircleBatch() {}
+
+  /// The number of slots in use
+  inline size_t size() const {return count;}
+
+  /// Append a triangle
+  /// @param a first corner
+  /// @param b second corner
+  /// @param c third corner
+  void push_back(const Point2D& a, const Point2D& b, const Point2D& c);
+
+  /// Overwrite the corners of a slot
+  /// @param i index of the slot
+  /// @param a first corner
+  /// @param b second corner
+  /// @param c third corner
+  void set(size_t i, const Point2D& a, const Point2D& b, const Point2D& c);
+
+  /// Copy the corners of one slot to another
+  /// @param from index of the slot to copy
+  /// @param to index of the slot to overwrite
+  void copySlot(size_t from, size_t to);
+
+  /// Mark a slot as unused, so that it never tests positive
+  /// @param i index of the slot
+  void invalidate(size_t i);
+
+  /// Change the number of slots in use
+  /// @param n the new number of slots
+  ///
+  /// @note new slots are unused
+  void resize(size_t n);
+
+  /// Remove all slots
+  void clear();
+
+  /// Bytes allocated for the coordinate arrays
+  inline size_t memoryUsage() const {return 6 * ax.capacity() * sizeof(float);}
+
+  /// Find triangles whose circumcircle contains a point
+  /// @param d the point to check
+  /// @param result indices of matching slots are appended here, in
+  /// ascending order
+  ///
+  /// @note corners are expected in CCW order, the test matches
+  /// IndexedDelaunay::pointIsInCircumcircle exactly
+  void trianglesWithCircumcircleContaining(const Point2D& d,
+                                           std::vector<int>& result) const;
+};
+
+#endif /* circumcircle_batch_h */
@@ -0,0 +1,141 @@
+//  Copyright 2022 Peter Aisher
+//
+//  edge_grid.cpp
+//  NetGen
+//
+
+#include <algorithm>
+#include <cmath>
+#include "edge_grid.h"
+#include "memory_usage.h"
+
+inline int EdgeGrid::column(float x) const {
+  int c = static_cast<int>(std::floor((x - origin.x) / cellSize));
+  return std::min(std::max(c, 0), columns - 1);
+}
+
+inline int EdgeGrid::row(float y) const {
+  int r = static_cast<int>(std::floor((y - origin.y) / cellSize));
+  return std::min(std::max(r, 0), rows - 1);
+}
+
+template <class F>
+void EdgeGrid::forEachCell(const LineSegment& s, F f) const {
+  const float minX = std::min(s.a.x, s.b.x);
+  const float maxX = std::max(s.a.x, s.b.x);
+  const int firstColumn = column(minX);
+  const int lastColumn = column(maxX);
+  for (int c = firstColumn; c <= lastColumn; ++c) {
+    // the part of the segment within this column
+    float x0 = std::max(minX, origin.x + c * cellSize);
+    float x1 = std::min(maxX, origin.x + (c + 1) * cellSize);
+    float y0 = std::min(s.a.y, s.b.y);
+    float y1 = std::max(s.a.y, s.b.y);
+    if (s.a.x != s.b.x) {
+      const float slope = (s.b.y - s.a.y) / (s.b.x - s.a.x);
+      y0 = s.a.y + (x0 - s.a.x) * slope;
+      y1 = s.a.y + (x1 - s.a.x) * slope;
+      if (y0 > y1) {
+        std::swap(y0, y1);
+      }
+    }
+    const int lastRow = row(y1);
+    for (int r = row(y0); r <= lastRow; ++r) {
+      f(r * columns + c);
+    }
+  }
+}
+
+void EdgeGrid::build(const std::vector<LineSegment>& segments) {
+  Point2D bl {0.f, 0.f};
+  Point2D tr {0.f, 0.f};
+  if (!segments.empty()) {
+    bl = tr = segments.front().a;
+  }
+  for (const auto& s : segments) {
+    for (const Point2D& p : {s.a, s.b}) {
+      bl = Point2D(std::min(bl.x, p.x), std::min(bl.y, p.y));
+      tr = Point2D(std::max(tr.x, p.x), std::max(tr.y, p.y));
+    }
+  }
+  origin = bl;
+  const float width = std::max(tr.x - bl.x, 1.f);
+  const float height = std::max(tr.y - bl.y, 1.f);
+  cellSize = std::sqrt(width * height / std::max<size_t>(segments.size(), 1));
+  columns = static_cast<int>(width / cellSize) + 1;
+  rows = static_cast<int>(height / cellSize) + 1;
+
+  // count the segments of each cell, then place them
+  firstEntry.assign(static_cast<size_t>(columns) * rows + 1, 0);
+  for (const auto& s : segments) {
+    forEachCell(s, [&](int cell) {++firstEntry[cell + 1];});
+  }
+  for (size_t c = 1; c < firstEntry.size(); ++c) {
+    firstEntry[c] += firstEntry[c - 1];
+  }
+  overflow.clear();
+  entries.resize(firstEntry.back());
+  std::vector<uint32_t> next(firstEntry.begin(), firstEntry.end() - 1);
+  for (int i = 0; i < segments.size(); ++i) {
+    forEachCell(segments[i], [&](int cell) {entries[next[cell]++] = i;});
+  }
+}
+
+void EdgeGrid::insert(int index, const LineSegment& s) {
+  forEachCell(s, [&](int cell) {
+    auto first = entries.begin() + firstEntry[cell];
+    auto last = entries.begin() + firstEntry[cell + 1];
+    auto unused = std::find(first, last, -1);
+    if (unused != last) {
+      *unused = index;
+    } else {
+      overflow[cell].push_back(index);
+    }
+  });
+}
+
+void EdgeGrid::remove(int index, const LineSegment& s) {
+  forEachCell(s, [&](int cell) {
+    auto first = entries.begin() + firstEntry[cell];
+    auto last = entries.begin() + firstEntry[cell + 1];
+    auto listed = std::find(first, last, index);
+    if (listed != last) {
+      *listed = -1;
+      return;
+    }
+    auto extra = overflow.find(cell);
+    if (extra != overflow.end()) {
+      auto& indices = extra->second;
+      indices.erase(std::remove(indices.begin(), indices.end(), index),
+                    indices.end());
+      if (indices.empty()) {
+        overflow.erase(extra);
+      }
+    }
+  });
+}
+
+void EdgeGrid::query(const LineSegment& s,
+                     std::vector<int>& candidates) const {
+  forEachCell(s, [&](int cell) {
+    for (uint32_t k = firstEntry[cell]; k < firstEntry[cell + 1]; ++k) {
+      if (entries[k] >= 0) {
+        candidates.push_back(entries[k]);
+      }
+    }
+    auto extra = overflow.find(cell);
+    if (extra != overflow.end()) {
+      candidates.insert(candidates.end(), extra->second.begin(),
+                        extra->second.end());
+    }
+  });
+}
+
+size_t EdgeGrid::memoryUsage() const {
+  size_t bytes = vectorBytes(firstEntry) + vectorBytes(entries)
+    + hashNodeBytes(overflow) + hashBucketBytes(overflow);
+  for (const auto& cell : overflow) {
+    bytes += vectorBytes(cell.second);
+  }
+  return bytes;
+}
@@ -0,0 +1,74 @@
+//  Copyright 2022 Peter Aisher
+//
+//  edge_grid.h
+//  NetGen
+//
+
+#ifndef edge_grid_h
+#define edge_grid_h
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "vector2.h"
+
+/// Uniform grid of line segments, for finding the segments another one
+/// may cross
+///
+/// Each segment is listed in every cell it passes through, so a query
+/// only visits the cells along the query segment. Cells are sized to
+/// hold about one segment each. Segments inserted after building take
+/// the places of removed ones in a cell, or else are listed separately.
+class EdgeGrid {
+  Point2D origin {0.f, 0.f};
+  float cellSize = 1.f;
+  int columns = 0;
+  int rows = 0;
+  /// segments of cell c are entries[firstEntry[c]] to
+  /// entries[firstEntry[c + 1] - 1]
+  std::vector<uint32_t> firstEntry {};
+  /// segment indices, -1 where a segment was removed
+  std::vector<int> entries {};
+  /// segments inserted into each cell with no place left for them
+  std::unordered_map<int, std::vector<int>> overflow {};
+
+  inline int column(float x) const;
+  inline int row(float y) const;
+
+  /// Call a function with the index of each cell a segment passes through
+  template <class F>
+  void forEachCell(const LineSegment& s, F f) const;
+
+ public:
+  /// Construct an empty grid
+  inline EdgeGrid() {}
+
+  /// Index segments
+  /// @param segments the segments, referred to by their index
+  void build(const std::vector<LineSegment>& segments);
+
+  /// Index a segment once built
+  /// @param index the index of the segment, which is no longer in use by
+  /// another
+  /// @param s the segment
+  void insert(int index, const LineSegment& s);
+
+  /// Stop indexing a segment
+  /// @param index the index of the segment
+  /// @param s the segment, as inserted
+  void remove(int index, const LineSegment& s);
+
+  /// Whether the grid has been built
+  inline bool isBuilt() const {return columns > 0;}
+
+  /// Segments which may cross a segment
+  /// @param s the segment to query
+  /// @param candidates indices of segments sharing a cell with s are
+  /// appended here, possibly more than once
+  void query(const LineSegment& s, std::vector<int>& candidates) const;
+
+  /// Bytes allocated by the grid
+  size_t memoryUsage() const;
+};
+
+#endif /* edge_grid_h */
@@ -6,6 +6,7 @@
 
 #include <utility>
 #include "indexed_delaunay.h"
+#include "memory_usage.h"
 
 
 bool IndexedDelaunay::pointIsInCircumcircle(int i, IndexedTriangle tri) {
@@ -32,20 +33,18 @@ bool IndexedDelaunay::pointIsInCircumcircle(int i, IndexedTriangle tri) {
 }
 
 std::vector<IndexedEdge> IndexedDelaunay::nonSharedEdges(const std::vector<IndexedTriangle> &badTriangles) {
+  // count the triangles containing each edge, in either direction
+  cavityEdgeCount.clear();
+  for (const auto & tri : badTriangles) {
+    for (const auto & edge : tri.edges()) {
+      ++cavityEdgeCount[{std::min(edge.a, edge.b), std::max(edge.a, edge.b)}];
+    }
+  }
   std::vector<IndexedEdge> polygon {};
   for (const auto & tri : badTriangles) {
     for (const auto & edge : tri.edges()) {
-      bool notShared = true;
-      for (const auto & other_tri : badTriangles) {
-        if (other_tri == tri) {
-          continue;
-        }
-        if (other_tri.containsEdge(edge)) {
-          notShared = false;
-          break;
-        }
-      }
-      if (notShared) {
+      if (cavityEdgeCount[{std::min(edge.a, edge.b),
+                           std::max(edge.a, edge.b)}] == 1) {
         polygon.push_back(edge);
       }
     }
@@ -128,6 +127,7 @@ bool IndexedDelaunay::isSliver(int k, float cos_epsi_squared)  {
 }
 
 void IndexedDelaunay::maskSliverTrianglesOnBoundary(float epsi) {
+  sliverAngle = epsi;
   float ce = cos(epsi);
   float cos_epsi_squared = ce * ce;
   std::deque<int> todo {};
@@ -135,6 +135,7 @@ void IndexedDelaunay::maskSliverTrianglesOnBoundary(float epsi) {
   std::move(boundaryIndices.begin(), boundaryIndices.end(), std::back_inserter(todo));
   while (!todo.empty()) {
     auto i = todo.front();
+    todo.pop_front();
     if (isTriangleMasked(i)) {
       continue;
     }
@@ -153,28 +154,36 @@ void IndexedDelaunay::maskSliverTrianglesOnBoundary(float epsi) {
       }
       maskTriangleAtIndex(i);
     }
-    todo.pop_front();
   }
 }
 
-std::vector<IndexedTriangle> IndexedDelaunay::trianglesWithCircumcircleContainingVertex(int i) {
-  std::vector<IndexedTriangle> badTriangles {};
-  for (const auto & tri : triangles) {
-    if (pointIsInCircumcircle(i, tri)) {
-      badTriangles.push_back(tri);
-    }
+void IndexedDelaunay::removeTriangles(const std::vector<int> &toRemove) {
+  for (int j : toRemove) {
+    triangles[j] = {-1, -1, -1};
+    circles.invalidate(j);
+    freeSlots.push_back(j);
   }
+}
+
+std::vector<int> IndexedDelaunay::trianglesWithCircumcircleContainingVertex(int i) {
+  std::vector<int> badTriangles {};
+  circles.trianglesWithCircumcircleContaining(vertices[i], badTriangles);
   return badTriangles;
 }
 
 void IndexedDelaunay::insertPointAndFixTriangulation(int i) {
-  std::vector<IndexedTriangle> badTriangles = trianglesWithCircumcircleContainingVertex(i);
+  std::vector<int> badIndices = trianglesWithCircumcircleContainingVertex(i);
+  std::vector<IndexedTriangle> badTriangles {};
+  badTriangles.reserve(badIndices.size());
+  for (int j : badIndices) {
+    badTriangles.push_back(triangles[j]);
+  }
   std::vector<IndexedEdge> polygon = nonSharedEdges(badTriangles);
-  removeTriangles(badTriangles);
+  removeTriangles(badIndices);
   for (const auto & edge : polygon) {
     IndexedTriangle newTri {edge.a, edge.b, i};
     makeCCW(newTri); // ought to be already ccw
-    triangles.push_back(newTri);
+    appendTriangle(newTri);
   }
 }
 
@@ -203,13 +212,374 @@ IndexedDelaunay::IndexedDelaunay(std::vector<Point2D> points)
   IndexedTriangle superTri = {supertriangleStartIndex,
                               supertriangleStartIndex + 1,
                               supertriangleStartIndex + 2};
-  triangles.push_back(superTri);
+  appendTriangle(superTri);
   for (int i = 0; i < supertriangleStartIndex; ++i) {
     insertPointAndFixTriangulation(i);
   }
+  constructionPeak = memoryUsage();
+  circles = CircumcircleBatch();
+  cavityEdgeCount = {};
   removeTrianglesWithSupertriangleVertices(supertriangleStartIndex);
   vertices.resize(supertriangleStartIndex);
   mask.resize(triangleCount());
   std::fill(mask.begin(), mask.end(), false);
   underConstruction = false;
 }
+
+void IndexedDelaunay::renumberVertices(const std::vector<int>& newIndex) {
+  std::vector<Point2D> renumbered(vertices.size());
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    renumbered[newIndex[i]] = vertices[i];
+  }
+  vertices.swap(renumbered);
+  for (auto& tri : triangles) {
+    tri = IndexedTriangle(newIndex[tri.a], newIndex[tri.b], newIndex[tri.c]);
+  }
+}
+
+std::unordered_map<IndexedEdge, int>
+IndexedDelaunay::trianglesByDirectedEdge() const {
+  std::unordered_map<IndexedEdge, int> triangleOf;
+  triangleOf.reserve(3 * triangles.size());
+  for (int t = 0; t < triangleCount(); ++t) {
+    for (const auto& edge : triangles[t].edges()) {
+      triangleOf.emplace(edge, t);
+    }
+  }
+  return triangleOf;
+}
+
+void IndexedDelaunay::replaceTriangles(
+    const std::vector<int>& removed, const std::vector<IndexedTriangle>& added,
+    const std::unordered_map<IndexedEdge, int>& triangleOf,
+    LocalChange& change) {
+  auto undirected = [](IndexedEdge e) {
+    return IndexedEdge(std::min(e.a, e.b), std::max(e.a, e.b));
+  };
+  auto isRemoved = [&removed](int t) {
+    return std::binary_search(removed.begin(), removed.end(), t);
+  };
+  // whether each edge touched is in an unmasked triangle before and after
+  // the change, counting the kept triangles beside it for both
+  struct Use {bool before = false; bool after = false; bool kept = false;};
+  std::unordered_map<IndexedEdge, Use> uses;
+  for (int t : removed) {
+    for (const auto& edge : triangles[t].edges()) {
+      uses[undirected(edge)].before |= !mask[t];
+    }
+  }
+  for (const auto& tri : added) {
+    for (const auto& edge : tri.edges()) {
+      uses[undirected(edge)];
+    }
+  }
+  for (auto& use : uses) {
+    const IndexedEdge& e = use.first;
+    for (const IndexedEdge& directed : {e, IndexedEdge(e.b, e.a)}) {
+      auto it = triangleOf.find(directed);
+      if (it != triangleOf.end() && !isRemoved(it->second)
+          && !mask[it->second]) {
+        use.second.kept = true;
+      }
+    }
+  }
+
+  size_t kept = 0;
+  for (int t = 0, r = 0; t < triangleCount(); ++t) {
+    if (r < removed.size() && removed[r] == t) {
+      ++r;
+      continue;
+    }
+    triangles[kept] = triangles[t];
+    mask[kept] = mask[t];
+    ++kept;
+  }
+  triangles.erase(triangles.begin() + kept, triangles.end());
+  mask.resize(kept);
+
+  // a new triangle lies on the boundary if an edge has no unmasked
+  // triangle beyond it
+  std::unordered_map<IndexedEdge, int> addedCount;
+  for (const auto& tri : added) {
+    for (const auto& edge : tri.edges()) {
+      ++addedCount[undirected(edge)];
+    }
+  }
+  const float ce = cos(sliverAngle);
+  for (const auto& tri : added) {
+    triangles.push_back(tri);
+    mask.push_back(false);
+    if (sliverAngle <= 0.f) {
+      continue;
+    }
+    bool onBoundary = false;
+    for (const auto& edge : tri.edges()) {
+      const IndexedEdge e = undirected(edge);
+      onBoundary |= !uses[e].kept && addedCount[e] == 1;
+    }
+    if (onBoundary && isSliver(triangleCount() - 1, ce * ce)) {
+      maskTriangleAtIndex(triangleCount() - 1);
+    }
+  }
+  for (size_t k = 0; k < added.size(); ++k) {
+    if (!mask[kept + k]) {
+      for (const auto& edge : added[k].edges()) {
+        uses[undirected(edge)].after = true;
+      }
+    }
+  }
+
+  for (const auto& use : uses) {
+    const bool before = use.second.before || use.second.kept;
+    const bool after = use.second.after || use.second.kept;
+    if (before && !after) {
+      change.edgesRemoved.push_back(use.first);
+    } else if (after && !before) {
+      change.edgesAdded.push_back(use.first);
+    }
+  }
+  auto byEnds = [](const IndexedEdge& x, const IndexedEdge& y) {
+    return x.a != y.a ? x.a < y.a : x.b < y.b;
+  };
+  std::sort(change.edgesRemoved.begin(), change.edgesRemoved.end(), byEnds);
+  std::sort(change.edgesAdded.begin(), change.edgesAdded.end(), byEnds);
+}
+
+bool IndexedDelaunay::insertVertex(Point2D p, LocalChange& change) {
+  change = LocalChange();
+  if (underConstruction) {
+    return false;
+  }
+  const bool duplicate =
+    std::find(vertices.begin(), vertices.end(), p) != vertices.end();
+  const int i = static_cast<int>(vertices.size());
+  vertices.push_back(p);
+  if (duplicate) {
+    // as in construction, where no circumcircle strictly contains it
+    return true;
+  }
+  const auto triangleOf = trianglesByDirectedEdge();
+  auto onBoundary = [&triangleOf](const IndexedEdge& edge) {
+    return triangleOf.count({edge.b, edge.a}) == 0;
+  };
+
+  // the cavity grows from the triangles containing p, which may lie on
+  // an edge, or if there are none from the boundary edges p lies beyond
+  std::vector<bool> bad(triangles.size(), false);
+  std::vector<int> todo;
+  for (int t = 0; t < triangleCount(); ++t) {
+    const IndexedTriangle& tri = triangles[t];
+    if (orientation(tri.a, tri.b, p) >= 0 && orientation(tri.b, tri.c, p) >= 0
+        && orientation(tri.c, tri.a, p) >= 0) {
+      bad[t] = true;
+      todo.push_back(t);
+    }
+  }
+  const bool outside = todo.empty();
+  auto beyond = [&](const IndexedEdge& edge) {
+    return outside && onBoundary(edge) && orientation(edge.a, edge.b, p) < 0;
+  };
+  // p on a boundary edge splits it rather than joining it
+  auto splits = [&](const IndexedEdge& edge) {
+    const Vector2D toA = vertices[edge.a] - p;
+    const Vector2D toB = vertices[edge.b] - p;
+    return orientation(edge.a, edge.b, p) == 0
+      && toA.x * toB.x + toA.y * toB.y < 0;
+  };
+  for (int t = 0; outside && t < triangleCount(); ++t) {
+    for (const auto& edge : triangles[t].edges()) {
+      if (beyond(edge) && !bad[t] && pointIsInCircumcircle(i, triangles[t])) {
+        bad[t] = true;
+        todo.push_back(t);
+      }
+    }
+  }
+  while (!todo.empty()) {
+    const int t = todo.back();
+    todo.pop_back();
+    for (const auto& edge : triangles[t].edges()) {
+      auto across = triangleOf.find({edge.b, edge.a});
+      if (across != triangleOf.end() && !bad[across->second]
+          && pointIsInCircumcircle(i, triangles[across->second])) {
+        bad[across->second] = true;
+        todo.push_back(across->second);
+      }
+    }
+  }
+
+  // join p to the edges around the cavity, and to those boundary edges
+  // it lies beyond which the cavity does not reach
+  std::vector<int> removed;
+  std::vector<IndexedTriangle> added;
+  for (int t = 0; t < triangleCount(); ++t) {
+    for (const auto& edge : triangles[t].edges()) {
+      auto across = triangleOf.find({edge.b, edge.a});
+      if (!bad[t]) {
+        if (beyond(edge)) {
+          added.push_back({edge.b, edge.a, i});
+        }
+      } else if (across != triangleOf.end() ? !bad[across->second]
+                 : !beyond(edge) && !splits(edge)) {
+        added.push_back({edge.a, edge.b, i});
+      }
+    }
+    if (bad[t]) {
+      removed.push_back(t);
+    }
+  }
+
+  // Triangles fanning out from p cover the cavity once if all are CCW.
+  // Outside, boundary edges facing p may be hidden behind others where
+  // the boundary is concave, so new edges must not cross any others.
+  bool valid = !added.empty();
+  for (const auto& tri : added) {
+    valid = valid && isCCW(tri);
+  }
+  for (size_t k = 0; valid && outside && k < added.size(); ++k) {
+    for (int corner : {added[k].a, added[k].b}) {
+      const LineSegment joined(p, vertices[corner]);
+      auto crosses = [&](int a, int b) {
+        return a != corner && b != corner
+          && joined.intersects(LineSegment(vertices[a], vertices[b]));
+      };
+      for (int t = 0; valid && t < triangleCount(); ++t) {
+        for (const auto& edge : triangles[t].edges()) {
+          valid = valid && (bad[t] || !crosses(edge.a, edge.b));
+        }
+      }
+      for (const auto& other : added) {
+        valid = valid && !crosses(other.a, other.b);
+      }
+    }
+  }
+  if (!valid) {
+    vertices.pop_back();
+    return false;
+  }
+  replaceTriangles(removed, added, triangleOf, change);
+  return true;
+}
+
+bool IndexedDelaunay::removeVertex(int v, LocalChange& change) {
+  change = LocalChange();
+  if (underConstruction || v < 0 || v >= static_cast<int>(vertices.size())) {
+    return false;
+  }
+  const auto triangleOf = trianglesByDirectedEdge();
+
+  // each triangle (v, a, b) around v gives the polygon edge from a to b
+  std::vector<int> removed;
+  std::unordered_map<int, int> next;
+  std::unordered_map<int, int> previous;
+  for (int t = 0; t < triangleCount(); ++t) {
+    const IndexedTriangle& tri = triangles[t];
+    IndexedEdge edge = tri.a == v ? IndexedEdge(tri.b, tri.c)
+      : tri.b == v ? IndexedEdge(tri.c, tri.a)
+      : tri.c == v ? IndexedEdge(tri.a, tri.b) : IndexedEdge(-1, -1);
+    if (edge.a < 0) {
+      continue;
+    }
+    removed.push_back(t);
+    if (!next.emplace(edge.a, edge.b).second
+        || !previous.emplace(edge.b, edge.a).second) {
+      return false;  // the triangles around v meet only at v
+    }
+  }
+  // on the boundary, the polygon is open, starting where no edge ends
+  int start = next.empty() ? -1 : next.begin()->first;
+  bool closed = true;
+  for (const auto& edge : next) {
+    if (previous.count(edge.first) == 0) {
+      if (!closed) {
+        return false;
+      }
+      closed = false;
+      start = edge.first;
+    }
+  }
+  std::vector<int> polygon;
+  for (int u = start; u >= 0 && polygon.size() <= removed.size();) {
+    polygon.push_back(u);
+    auto it = next.find(u);
+    u = it == next.end() || it->second == start ? -1 : it->second;
+  }
+  if (polygon.size() != removed.size() + (closed ? 0 : 1)
+      || (closed && polygon.size() < 3)) {
+    return false;
+  }
+
+  // An ear whose circumcircle holds no other corner of the polygon is a
+  // Delaunay triangle of it. The ends of an open polygon are joined
+  // through v, so its ears may not contain v.
+  auto isEar = [&](size_t k, bool delaunay) {
+    const size_t n = polygon.size();
+    const IndexedTriangle ear {polygon[(k + n - 1) % n], polygon[k],
+                               polygon[(k + 1) % n]};
+    if (!isCCW(ear)) {
+      return false;
+    }
+    auto contains = [&](int q) {
+      const Point2D x = vertices[q];
+      return orientation(ear.a, ear.b, x) >= 0
+        && orientation(ear.b, ear.c, x) >= 0
+        && orientation(ear.c, ear.a, x) >= 0;
+    };
+    if (!closed && contains(v)) {
+      return false;
+    }
+    for (int q : polygon) {
+      if (q != ear.a && q != ear.b && q != ear.c
+          && (contains(q) || (delaunay && pointIsInCircumcircle(q, ear)))) {
+        return false;
+      }
+    }
+    return true;
+  };
+  std::vector<IndexedTriangle> added;
+  while (polygon.size() > 3 || (!closed && polygon.size() == 3)) {
+    const size_t first = closed ? 0 : 1;
+    const size_t last = closed ? polygon.size() : polygon.size() - 1;
+    size_t ear = last;
+    for (bool delaunay : {true, false}) {
+      for (size_t k = first; k < last && ear == last; ++k) {
+        if (isEar(k, delaunay)) {
+          ear = k;
+        }
+      }
+    }
+    if (ear == last) {
+      if (closed) {
+        return false;
+      }
+      break;
+    }
+    const size_t n = polygon.size();
+    added.push_back({polygon[(ear + n - 1) % n], polygon[ear],
+                     polygon[(ear + 1) % n]});
+    polygon.erase(polygon.begin() + ear);
+  }
+  if (closed) {
+    const IndexedTriangle last {polygon[0], polygon[1], polygon[2]};
+    if (!isCCW(last)) {
+      return false;
+    }
+    added.push_back(last);
+  }
+
+  replaceTriangles(removed, added, triangleOf, change);
+  vertices.erase(vertices.begin() + v);
+  for (auto& tri : triangles) {
+    tri = IndexedTriangle(tri.a - (tri.a > v), tri.b - (tri.b > v),
+                          tri.c - (tri.c > v));
+  }
+  return true;
+}
+
+IndexedDelaunay::MemoryUsage IndexedDelaunay::memoryUsage() const {
+  MemoryUsage usage;
+  usage.vertices = vectorBytes(vertices);
+  usage.triangles = vectorBytes(triangles);
+  usage.mask = vectorBytes(mask);
+  usage.circumcircles = circles.memoryUsage();
+  return usage;
+}
@@ -12,9 +12,11 @@
 #include <algorithm>
 #include <deque>
 #include <iterator>
+#include <unordered_map>
 #include "vector2.h"
 #include "indexed_primitives.h"
 #include "bbox.h"
+#include "circumcircle_batch.h"
 
 //typedef dt::Vector2<float> Point;
 
@@ -30,15 +32,64 @@ class IndexedDelaunay {
   std::vector<IndexedTriangle> triangles;
   std::vector<bool> mask {};
 
+  /// Corner coordinates of each triangle, used during construction
+  CircumcircleBatch circles;
+
+  /// Slots of removed triangles, reused by appendTriangle during
+  /// construction
+  std::vector<int> freeSlots {};
+
+  /// Number of bad triangles containing each undirected edge of a cavity,
+  /// reused between insertions
+  std::unordered_map<IndexedEdge, int> cavityEdgeCount {};
+
   /// Flag set when triangulation is being constructed
   bool underConstruction = true;
 
+  /// Angle below which a corner of a boundary triangle counts as sharp,
+  /// as last given to maskSliverTrianglesOnBoundary, or 0 if not masked
+  float sliverAngle = 0.f;
+
+ public:
+  /// Bytes allocated by a triangulation
+  struct MemoryUsage {
+    size_t vertices = 0;
+    size_t triangles = 0;
+    size_t mask = 0;
+    /// corner coordinates used during construction
+    size_t circumcircles = 0;
+    inline size_t total() const {
+      return vertices + triangles + mask + circumcircles;
+    }
+  };
+
+  /// Edges of unmasked triangles changed by inserting or removing a
+  /// vertex, each with a < b
+  struct LocalChange {
+    /// edges no longer in any unmasked triangle
+    std::vector<IndexedEdge> edgesRemoved {};
+    /// edges now in an unmasked triangle which were in none before
+    std::vector<IndexedEdge> edgesAdded {};
+  };
+
+ private:
+  /// Memory usage at the end of construction, before scratch storage
+  /// was released
+  MemoryUsage constructionPeak;
+
   /// Check if point is contained in circumcircle of triangle
   /// @param i index of point to check
   /// @param tri triangle to check
   /// @returns true, if point is within circumcircle
   bool pointIsInCircumcircle(int i, IndexedTriangle tri);
 
+  /// Twice the signed area of the triangle a, b, p
+  /// @returns a positive value if the corners are in CCW order, zero if
+  /// they are collinear
+  inline float orientation(int a, int b, Point2D p) const {
+    return (vertices[b] - vertices[a]).cross(p - vertices[a]);
+  }
+
   /// Check if triangle has points in CCW order
   /// @param tri the triangle to check
   /// @returns true if the points are in CCW order
@@ -59,28 +110,44 @@ class IndexedDelaunay {
     }
   }
 
-  /// Remove triangles which share vertices with the
+  /// Remove free slots and triangles which share vertices with the
   /// supertriangle used for construction
   /// @param supertriangleStartIndex index of first supertriangle vertex
   inline void removeTrianglesWithSupertriangleVertices(int supertriangleStartIndex) {
-    auto res = std::remove_if(triangles.begin(), triangles.end(), [supertriangleStartIndex](auto const tri) { return tri.a >= supertriangleStartIndex || tri.b >= supertriangleStartIndex || tri.c >= supertriangleStartIndex;});
+    auto res = std::remove_if(triangles.begin(), triangles.end(), [supertriangleStartIndex](auto const tri) { return tri.a < 0 || tri.a >= supertriangleStartIndex || tri.b >= supertriangleStartIndex || tri.c >= supertriangleStartIndex;});
     triangles.erase(res, triangles.end());
+    freeSlots.clear();
   }
 
-  /// permanently remove triangles
-  /// @param toRemove triangles to remove
-  inline void removeTriangles(std::vector<IndexedTriangle> &toRemove) {
-    auto res = std::remove_if(triangles.begin(), triangles.end(), [&toRemove](auto const x) { return std::find(toRemove.begin(), toRemove.end(), x) != toRemove.end(); });
-    triangles.erase(res, triangles.end());
+  /// Add a triangle, reusing a free slot if there is one, and keeping
+  /// the corner coordinate store in step
+  /// @param tri the triangle to add
+  inline void appendTriangle(IndexedTriangle tri) {
+    if (freeSlots.empty()) {
+      triangles.push_back(tri);
+      circles.push_back(vertices[tri.a], vertices[tri.b], vertices[tri.c]);
+      return;
+    }
+    int slot = freeSlots.back();
+    freeSlots.pop_back();
+    triangles[slot] = tri;
+    circles.set(slot, vertices[tri.a], vertices[tri.b], vertices[tri.c]);
   }
 
-  /// Triangles whose circumcircle contains vertex i
+  /// remove triangles during construction, leaving their slots free
+  /// @param toRemove indices of triangles to remove
+  ///
+  /// @note free slots hold corners of -1 until they are reused
+  void removeTriangles(const std::vector<int> &toRemove);
+
+  /// Indices of triangles whose circumcircle contains vertex i
   /// @param i index of vertex
-  /// @returns vector of indexed trianges whose circumcircle contains vertex i
-  std::vector<IndexedTriangle> trianglesWithCircumcircleContainingVertex(int i);
+  /// @returns ascending indices of trianges whose circumcircle contains vertex i
+  std::vector<int> trianglesWithCircumcircleContainingVertex(int i);
 
   /// Edges not shared by multiple triangles
   /// @param tris the triangles to check for non-shared edges
+  /// @returns the edges, in the order and direction they appear in tris
   std::vector<IndexedEdge> nonSharedEdges(const std::vector<IndexedTriangle> &tris);
   void insertPointAndFixTriangulation(int i);
 
@@ -99,17 +166,26 @@ class IndexedDelaunay {
   /// @returns true, if any corner is sharper than epsi
   bool isSliver(int i, float cos_epsi_squared);
 
-  /// Check if triangle is masked
-  /// @param i index of triangle to check
-  inline bool isTriangleMasked(int i) const {
-    if (underConstruction) {return false;}
-    return mask[i];
-  }
-
   /// Mask triangle
   /// @param i index of triangle to mask
   inline void maskTriangleAtIndex(int i) {mask[i] = true;}
 
+  /// The triangle containing each directed edge, in the corner order of
+  /// the triangles
+  std::unordered_map<IndexedEdge, int> trianglesByDirectedEdge() const;
+
+  /// Replace triangles of the constructed triangulation, masking new
+  /// boundary slivers, and find the edges of unmasked triangles which
+  /// were removed or added
+  /// @param removed ascending indices of the triangles to remove
+  /// @param added the triangles to add
+  /// @param triangleOf the triangle of each directed edge before the change
+  /// @param change the edges changed are stored here
+  void replaceTriangles(const std::vector<int>& removed,
+                        const std::vector<IndexedTriangle>& added,
+                        const std::unordered_map<IndexedEdge, int>& triangleOf,
+                        LocalChange& change);
+
   /// Create a triangle entirely containg a given box
   /// @param boundingBox the counding box which should be entirely contained
   std::array<Point2D, 3> triangleContainingBox(const BBox &boundingBox);
@@ -125,12 +201,68 @@ public:
   template <class E, class W, class V>
   friend class IntGraph;
   friend class Map;
+  friend class PointLocator;
 
   /// Construct an empty triangulation
   inline IndexedDelaunay() {};
 
   /// Construct a triangulation of the points
   IndexedDelaunay(std::vector<Point2D> points);
+
+  /// The vertices, by index
+  inline const std::vector<Point2D>& allVertices() const {return vertices;}
+
+  /// The triangles, including masked ones, by index
+  inline const std::vector<IndexedTriangle>& allTriangles() const {
+    return triangles;
+  }
+
+  /// Check if triangle is masked
+  /// @param i index of triangle to check
+  inline bool isTriangleMasked(int i) const {
+    if (underConstruction) {return false;}
+    return mask[i];
+  }
+
+  /// Insert a vertex once constructed, replacing only the triangles whose
+  /// circumcircle contains it
+  /// @param p the location of the vertex, which is numbered after the
+  /// existing ones
+  /// @param change the edges changed are stored here
+  /// @returns false, leaving the triangulation unchanged, if p lies
+  /// beyond a concave part of the boundary where the triangles it would
+  /// add overlap others
+  ///
+  /// A vertex at the location of another is left in no triangle, as in
+  /// construction. New boundary triangles are masked if they are slivers,
+  /// but unlike maskSliverTrianglesOnBoundary, their neighbours are not
+  /// then checked.
+  bool insertVertex(Point2D p, LocalChange& change);
+
+  /// Remove a vertex once constructed, filling the polygon of its
+  /// neighbours by clipping the ears a Delaunay triangulation would have
+  /// @param v the vertex, after which vertices are numbered one lower
+  /// @param change the edges changed are stored here, numbered as before
+  /// the removal
+  /// @returns false, leaving the triangulation unchanged, if the
+  /// neighbours of v do not form a simple polygon
+  ///
+  /// Where v lies on the boundary, only the ears on the far side of its
+  /// neighbours from v are clipped, so the boundary may move inwards.
+  bool removeVertex(int v, LocalChange& change);
+
+  /// Renumber the vertices, keeping the triangles
+  /// @param newIndex the new index of each vertex, a permutation
+  void renumberVertices(const std::vector<int>& newIndex);
+
+  /// Bytes currently allocated by the triangulation
+  MemoryUsage memoryUsage() const;
+
+  /// Bytes allocated by the triangulation at the end of construction,
+  /// when its scratch storage was largest
+  inline const MemoryUsage& memoryUsageDuringConstruction() const {
+    return constructionPeak;
+  }
 };
 
 #endif /* indexed_delaunay_h */
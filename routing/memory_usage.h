@@ -0,0 +1,53 @@
+//  Copyright 2022 Peter Aisher
+//
+//  memory_usage.h
+//  NetGen
+//
+
+#ifndef memory_usage_h
+#define memory_usage_h
+
+#include <cstddef>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+// Byte counts of standard containers
+//
+// Hash map counts assume the usual layout of one heap node per element,
+// holding a next pointer and the element, plus one pointer per bucket.
+// Set counts assume one tree node per element, holding three pointers,
+// a colour and the element.
+// Allocator overhead is not included, so all counts are lower bounds.
+
+/// Bytes allocated by a vector
+template <class T>
+inline size_t vectorBytes(const std::vector<T>& v) {
+  return v.capacity() * sizeof(T);
+}
+
+/// Bytes allocated by a vector of bools, which packs one bit per element
+inline size_t vectorBytes(const std::vector<bool>& v) {
+  return (v.capacity() + 7) / 8;
+}
+
+/// Bytes allocated for the element nodes of a hash map
+template <class K, class V, class H, class E>
+inline size_t hashNodeBytes(const std::unordered_map<K, V, H, E>& m) {
+  typedef typename std::unordered_map<K, V, H, E>::value_type Element;
+  return m.size() * (sizeof(void*) + sizeof(Element));
+}
+
+/// Bytes allocated for the bucket array of a hash map
+template <class K, class V, class H, class E>
+inline size_t hashBucketBytes(const std::unordered_map<K, V, H, E>& m) {
+  return m.bucket_count() * sizeof(void*);
+}
+
+/// Bytes allocated for the element nodes of an ordered set
+template <class K, class C>
+inline size_t setNodeBytes(const std::set<K, C>& s) {
+  return s.size() * (4 * sizeof(void*) + sizeof(K));
+}
+
+#endif /* memory_usage_h */
@@ -0,0 +1,168 @@
+//  Copyright 2022 Peter Aisher
+//
+//  min_cost_flow.cpp
+//  NetGen
+//
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include "min_cost_flow.h"
+
+void MinCostFlow::addArc(int from, int to, double capacity, double cost) {
+  int forwardIndex = static_cast<int>(arcs[from].size());
+  int reverseIndex = static_cast<int>(arcs[to].size()) + (from == to);
+  arcs[from].push_back({to, reverseIndex, capacity, cost, 0.});
+  arcs[to].push_back({from, forwardIndex, 0., -cost, 0.});
+}
+
+std::pair<double, double>
+MinCostFlow::solve(int source, int sink, const std::function<bool()>& stop) {
+  const double infinity = std::numeric_limits<double>::infinity();
+  const size_t nodeCount = arcs.size();
+  std::vector<double> potential(nodeCount, 0.);
+  std::vector<double> distance(nodeCount);
+  std::vector<bool> settled(nodeCount);
+  std::vector<std::pair<int, int>> previousArc(nodeCount);
+  double totalFlow = 0.;
+  double totalCost = 0.;
+
+  typedef std::pair<double, int> QueueEntry;
+  while (!stop || !stop()) {
+    std::fill(distance.begin(), distance.end(), infinity);
+    std::fill(settled.begin(), settled.end(), false);
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>,
+                        std::greater<QueueEntry>> frontier;
+    distance[source] = 0.;
+    frontier.emplace(0., source);
+    while (!frontier.empty()) {
+      int u = frontier.top().second;
+      frontier.pop();
+      if (settled[u]) {
+        continue;
+      }
+      settled[u] = true;
+      if (u == sink) {
+        break;
+      }
+      for (int i = 0; i < arcs[u].size(); ++i) {
+        const Arc& arc = arcs[u][i];
+        if (arc.residual() <= epsilon || settled[arc.to]) {
+          continue;
+        }
+        // reduced costs are non-negative, up to rounding
+        double reduced = std::max(0., arc.cost + potential[u]
+                                      - potential[arc.to]);
+        double alt = distance[u] + reduced;
+        if (alt < distance[arc.to]) {
+          distance[arc.to] = alt;
+          previousArc[arc.to] = {u, i};
+          frontier.emplace(alt, arc.to);
+        }
+      }
+    }
+    if (!settled[sink]) {
+      break;
+    }
+    // nodes not settled are at least as far as the sink, which keeps
+    // reduced costs non-negative
+    for (size_t v = 0; v < nodeCount; ++v) {
+      potential[v] += std::min(distance[v], distance[sink]);
+    }
+
+    double quantity = infinity;
+    for (int v = sink; v != source; v = previousArc[v].first) {
+      const Arc& arc = arcs[previousArc[v].first][previousArc[v].second];
+      quantity = std::min(quantity, arc.residual());
+    }
+    for (int v = sink; v != source; v = previousArc[v].first) {
+      Arc& arc = arcs[previousArc[v].first][previousArc[v].second];
+      arc.flow += quantity;
+      arcs[v][arc.reverse].flow -= quantity;
+      totalCost += quantity * arc.cost;
+    }
+    totalFlow += quantity;
+  }
+  return {totalFlow, totalCost};
+}
+
+std::vector<MinCostFlow::FlowPath>
+MinCostFlow::decompose(int source, int sink, PathPool& paths) {
+  std::vector<FlowPath> result;
+  // the next arc to try at each node, arcs before it carry no more flow
+  std::vector<size_t> nextArc(arcs.size(), 0);
+  std::vector<int> positionInWalk(arcs.size(), -1);
+  // nodes of the current walk, and the arc taken from each
+  std::vector<int> walk {source};
+  std::vector<int> walkArcs;
+  positionInWalk[source] = 0;
+
+  auto flowOnWalk = [&](size_t from) {
+    double quantity = std::numeric_limits<double>::infinity();
+    for (size_t k = from; k < walkArcs.size(); ++k) {
+      quantity = std::min(quantity, arcs[walk[k]][walkArcs[k]].flow);
+    }
+    return quantity;
+  };
+  auto removeFlowOnWalk = [&](size_t from, double quantity) {
+    for (size_t k = from; k < walkArcs.size(); ++k) {
+      Arc& arc = arcs[walk[k]][walkArcs[k]];
+      arc.flow -= quantity;
+      arcs[arc.to][arc.reverse].flow += quantity;
+    }
+  };
+  auto truncateWalk = [&](size_t length) {
+    for (size_t k = length; k < walk.size(); ++k) {
+      positionInWalk[walk[k]] = -1;
+    }
+    walk.resize(length);
+    walkArcs.resize(length - 1);
+  };
+
+  while (!walk.empty()) {
+    int u = walk.back();
+    if (u == sink) {
+      double quantity = flowOnWalk(0);
+      double unitCost = 0.;
+      for (size_t k = 0; k < walkArcs.size(); ++k) {
+        unitCost += arcs[walk[k]][walkArcs[k]].cost;
+      }
+      removeFlowOnWalk(0, quantity);
+      if (walk.size() > 2) {
+        result.push_back({paths.append(walk.begin() + 1, walk.end() - 1),
+                          quantity, quantity * unitCost});
+      }
+      truncateWalk(1);
+      continue;
+    }
+    // skip arcs which carry no flow, including residual reverse arcs
+    size_t& i = nextArc[u];
+    while (i < arcs[u].size() && arcs[u][i].flow <= epsilon) {
+      ++i;
+    }
+    if (i == arcs[u].size()) {
+      // no flow leaves u any more, any left over on the arc into it is
+      // rounding error
+      if (walk.size() == 1) {
+        break;
+      }
+      truncateWalk(walk.size() - 1);
+      ++nextArc[walk.back()];
+      continue;
+    }
+    const int v = arcs[u][i].to;
+    walkArcs.push_back(static_cast<int>(i));
+    if (positionInWalk[v] >= 0) {
+      // drop the flow around the cycle back to v
+      size_t start = positionInWalk[v];
+      removeFlowOnWalk(start, flowOnWalk(start));
+      walkArcs.pop_back();
+      truncateWalk(start + 1);
+      continue;
+    }
+    positionInWalk[v] = static_cast<int>(walk.size());
+    walk.push_back(v);
+  }
+  return result;
+}
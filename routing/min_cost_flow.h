@@ -0,0 +1,78 @@
+//  Copyright 2022 Peter Aisher
+//
+//  min_cost_flow.h
+//  NetGen
+//
+
+#ifndef min_cost_flow_h
+#define min_cost_flow_h
+
+#include <functional>
+#include <utility>
+#include <vector>
+#include "path_pool.h"
+
+/// Single commodity min-cost flow network
+///
+/// Arcs have a capacity, which may be infinite, and a non-negative cost
+/// per unit of flow. Flow is sent from a source to a sink by successive
+/// shortest paths: each round, a Dijkstra search on costs reduced by node
+/// potentials finds the cheapest augmenting path in the residual network.
+class MinCostFlow {
+  struct Arc {
+    int to;
+    /// index of the paired arc in the adjacency list of `to`
+    int reverse;
+    double capacity;
+    double cost;
+    double flow;
+    inline double residual() const {return capacity - flow;}
+  };
+
+  std::vector<std::vector<Arc>> arcs;
+
+ public:
+  /// A path carrying part of the flow
+  struct FlowPath {
+    /// nodes strictly between the source and the sink
+    PathPool::Handle path;
+    double quantity;
+    /// cost of the quantity along this path
+    double cost;
+  };
+
+  /// Flow below this is treated as no flow
+  static constexpr double epsilon = 1e-6;
+
+  /// Construct a network without arcs
+  /// @param nodeCount the number of nodes
+  inline explicit MinCostFlow(int nodeCount) : arcs(nodeCount) {}
+
+  /// Add an arc and its residual reverse arc
+  /// @param from the tail of the arc
+  /// @param to the head of the arc
+  /// @param capacity the most flow the arc can carry
+  /// @param cost the non-negative cost per unit of flow
+  void addArc(int from, int to, double capacity, double cost);
+
+  /// Send as much flow as possible from source to sink, at least cost
+  /// @param source the node flow leaves from
+  /// @param sink the node flow arrives at
+  /// @param stop if given, checked before each augmenting path; once it
+  /// returns true the flow sent so far is kept, which is the cheapest
+  /// flow of its quantity
+  /// @returns the total flow sent and its total cost
+  std::pair<double, double> solve(int source, int sink,
+                                  const std::function<bool()>& stop = nullptr);
+
+  /// Split the flow into paths from source to sink
+  /// @param source the node flow leaves from
+  /// @param sink the node flow arrives at
+  /// @param paths the nodes of each path are appended here
+  /// @returns the paths with their quantities and costs
+  ///
+  /// @note removes the flow from the network, cycles of flow are dropped
+  std::vector<FlowPath> decompose(int source, int sink, PathPool& paths);
+};
+
+#endif /* min_cost_flow_h */
@@ -0,0 +1,133 @@
+//  Copyright 2022 Peter Aisher
+//
+//  path_pool.h
+//  NetGen
+//
+
+#ifndef path_pool_h
+#define path_pool_h
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/// Flat append-only storage for many node paths
+///
+/// Paths are stored one after the other in a single node array and are
+/// referred to by handles holding their offset and length, so storing a
+/// path does not allocate once the pool has grown to its working size.
+/// Handles stay valid until the pool is cleared, or the path is discarded.
+class PathPool {
+  std::vector<int> nodes {};
+
+ public:
+  /// Reference to a path in a pool
+  struct Handle {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+  };
+
+  /// Read-only view of the nodes of a path
+  struct View {
+    const int* first;
+    const int* last;
+    inline const int* begin() const {return first;}
+    inline const int* end() const {return last;}
+    inline size_t size() const {return last - first;}
+    inline bool empty() const {return first == last;}
+    inline int front() const {return *first;}
+    inline int back() const {return *(last - 1);}
+    inline int operator[](size_t i) const {return first[i];}
+  };
+
+  /// Construct an empty pool
+  inline PathPool() {}
+
+  /// The nodes of a path
+  /// @param h the handle of the path
+  inline View view(Handle h) const {
+    const int* first = nodes.data() + h.offset;
+    return {first, first + h.length};
+  }
+
+  /// Append a path following a chain of predecessors
+  /// @param previous the predecessor of each node, or -1 at the start
+  /// of the chain
+  /// @param node the last node of the chain, which is stored first
+  /// @returns the handle of the stored path
+  inline Handle appendChain(const std::vector<int>& previous, int node) {
+    Handle h {static_cast<uint32_t>(nodes.size()), 0};
+    for (int u = node; u >= 0; u = previous[u]) {
+      nodes.push_back(u);
+    }
+    h.length = static_cast<uint32_t>(nodes.size()) - h.offset;
+    return h;
+  }
+
+  /// Append a path
+  /// @param first the first node of the path
+  /// @param last one past the last node of the path
+  /// @returns the handle of the stored path
+  template <typename Iterator>
+  inline Handle append(Iterator first, Iterator last) {
+    Handle h {static_cast<uint32_t>(nodes.size()), 0};
+    nodes.insert(nodes.end(), first, last);
+    h.length = static_cast<uint32_t>(nodes.size()) - h.offset;
+    return h;
+  }
+
+  /// Append a copy of a path from another pool
+  /// @param other the pool holding the path
+  /// @param h the handle of the path in the other pool
+  /// @returns the handle of the stored copy
+  inline Handle append(const PathPool& other, Handle h) {
+    View v = other.view(h);
+    return append(v.begin(), v.end());
+  }
+
+  /// Release the storage of the most recently appended path
+  /// @param h the handle of the path, which must be the last appended
+  ///
+  /// @note the handle must not be used afterwards
+  inline void discardLast(Handle h) {
+    if (h.offset + h.length == nodes.size()) {
+      nodes.resize(h.offset);
+    }
+  }
+
+  /// Whether two paths of this pool visit the same nodes
+  /// @param a the handle of one path
+  /// @param b the handle of the other path
+  inline bool equal(Handle a, Handle b) const {
+    View va = view(a);
+    View vb = view(b);
+    return va.size() == vb.size()
+      && std::equal(va.begin(), va.end(), vb.begin());
+  }
+
+  /// Renumber the nodes of all paths
+  /// @param newIndex the new index of each node, -1 for a node removed
+  ///
+  /// Nodes already removed stay -1, in paths no longer in use.
+  inline void renumberNodes(const std::vector<int>& newIndex) {
+    for (int& node : nodes) {
+      if (node >= 0) {
+        node = newIndex[node];
+      }
+    }
+  }
+
+  /// Remove all paths, keeping the allocated storage for reuse
+  inline void clear() {nodes.clear();}
+
+  /// The nodes of all paths, in the order they were stored
+  inline const int* data() const {return nodes.data();}
+
+  /// The total number of nodes stored
+  inline size_t size() const {return nodes.size();}
+
+  /// Bytes allocated for the node array
+  inline size_t memoryUsage() const {return nodes.capacity() * sizeof(int);}
+};
+
+#endif /* path_pool_h */
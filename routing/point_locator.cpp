@@ -0,0 +1,264 @@
+//  Copyright 2022 Peter Aisher
+//
+//  point_locator.cpp
+//  NetGen
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include "point_locator.h"
+#include "memory_usage.h"
+
+inline int PointLocator::cell(Point2D p) const {
+  int c = static_cast<int>(std::floor((p.x - origin.x) / cellSize));
+  int r = static_cast<int>(std::floor((p.y - origin.y) / cellSize));
+  c = std::min(std::max(c, 0), columns - 1);
+  r = std::min(std::max(r, 0), rows - 1);
+  return r * columns + c;
+}
+
+void PointLocator::build(const IndexedDelaunay& t) {
+  const std::vector<Point2D>& vertices = t.vertices;
+  const std::vector<IndexedTriangle>& triangles = t.triangles;
+  const int vertexCount = static_cast<int>(vertices.size());
+  const int triangleCount = static_cast<int>(triangles.size());
+
+  // each interior edge appears once in each direction, in the triangles
+  // on either side of it
+  std::unordered_map<IndexedEdge, int> triangleOfEdge;
+  triangleOfEdge.reserve(3 * triangles.size());
+  for (int i = 0; i < triangleCount; ++i) {
+    for (const IndexedEdge& e : triangles[i].edges()) {
+      triangleOfEdge.emplace(e, i);
+    }
+  }
+  neighbours.assign(triangleCount, {-1, -1, -1});
+  std::vector<int> incidentTriangle(vertexCount, -1);
+  firstAdjacent.assign(vertexCount + 1, 0);
+  for (int i = 0; i < triangleCount; ++i) {
+    const auto edges = triangles[i].edges();
+    for (int k = 0; k < 3; ++k) {
+      auto across = triangleOfEdge.find({edges[k].b, edges[k].a});
+      if (across != triangleOfEdge.end()) {
+        neighbours[i][k] = across->second;
+      } else {
+        // a boundary edge appears in one direction only
+        ++firstAdjacent[edges[k].b + 1];
+      }
+      ++firstAdjacent[edges[k].a + 1];
+      incidentTriangle[edges[k].a] = i;
+    }
+  }
+  for (int v = 0; v < vertexCount; ++v) {
+    firstAdjacent[v + 1] += firstAdjacent[v];
+  }
+  adjacent.resize(firstAdjacent.back());
+  std::vector<int> next(firstAdjacent.begin(), firstAdjacent.end() - 1);
+  for (int i = 0; i < triangleCount; ++i) {
+    const auto edges = triangles[i].edges();
+    for (int k = 0; k < 3; ++k) {
+      adjacent[next[edges[k].a]++] = edges[k].b;
+      if (neighbours[i][k] < 0) {
+        adjacent[next[edges[k].b]++] = edges[k].a;
+      }
+    }
+  }
+
+  // seed each cell with a triangle at one of its vertices, then give
+  // empty cells the triangle of the nearest seeded cell
+  Point2D bl {0.f, 0.f};
+  Point2D tr {0.f, 0.f};
+  if (vertexCount > 0) {
+    bl = tr = vertices.front();
+  }
+  for (const Point2D& p : vertices) {
+    bl = Point2D(std::min(bl.x, p.x), std::min(bl.y, p.y));
+    tr = Point2D(std::max(tr.x, p.x), std::max(tr.y, p.y));
+  }
+  origin = bl;
+  const float width = std::max(tr.x - bl.x, 1.f);
+  const float height = std::max(tr.y - bl.y, 1.f);
+  cellSize = std::sqrt(width * height / std::max(vertexCount, 1));
+  columns = static_cast<int>(width / cellSize) + 1;
+  rows = static_cast<int>(height / cellSize) + 1;
+  cellTriangle.assign(static_cast<size_t>(columns) * rows, -1);
+  std::vector<int> frontier;
+  for (int v = 0; v < vertexCount; ++v) {
+    int c = cell(vertices[v]);
+    if (incidentTriangle[v] >= 0 && cellTriangle[c] < 0) {
+      cellTriangle[c] = incidentTriangle[v];
+      frontier.push_back(c);
+    }
+  }
+  if (frontier.empty()) {
+    cellTriangle.clear();
+    firstOverlapping.clear();
+    overlapping.clear();
+    return;
+  }
+  for (size_t f = 0; f < frontier.size(); ++f) {
+    const int c = frontier[f];
+    const int r = c / columns;
+    const int col = c % columns;
+    const int around[4][2] = {{r - 1, col}, {r + 1, col},
+                              {r, col - 1}, {r, col + 1}};
+    for (const auto& a : around) {
+      if (a[0] < 0 || a[0] >= rows || a[1] < 0 || a[1] >= columns) {
+        continue;
+      }
+      const int n = a[0] * columns + a[1];
+      if (cellTriangle[n] < 0) {
+        cellTriangle[n] = cellTriangle[c];
+        frontier.push_back(n);
+      }
+    }
+  }
+
+  // list each unmasked triangle in the cells its bounds overlap, counting
+  // first and then filling
+  auto forEachCell = [&](int i, auto&& f) {
+    const IndexedTriangle& tri = triangles[i];
+    const Point2D& a = vertices[tri.a];
+    const Point2D& b = vertices[tri.b];
+    const Point2D& c = vertices[tri.c];
+    const int first = cell({std::min({a.x, b.x, c.x}),
+                            std::min({a.y, b.y, c.y})});
+    const int last = cell({std::max({a.x, b.x, c.x}),
+                           std::max({a.y, b.y, c.y})});
+    for (int r = first / columns; r <= last / columns; ++r) {
+      for (int col = first % columns; col <= last % columns; ++col) {
+        f(r * columns + col);
+      }
+    }
+  };
+  firstOverlapping.assign(cellTriangle.size() + 1, 0);
+  for (int i = 0; i < triangleCount; ++i) {
+    if (!t.isTriangleMasked(i)) {
+      forEachCell(i, [&](int c) {++firstOverlapping[c + 1];});
+    }
+  }
+  for (size_t c = 0; c < cellTriangle.size(); ++c) {
+    firstOverlapping[c + 1] += firstOverlapping[c];
+  }
+  overlapping.resize(firstOverlapping.back());
+  next.assign(firstOverlapping.begin(), firstOverlapping.end() - 1);
+  for (int i = 0; i < triangleCount; ++i) {
+    if (!t.isTriangleMasked(i)) {
+      forEachCell(i, [&](int c) {overlapping[next[c]++] = i;});
+    }
+  }
+}
+
+int PointLocator::scanCell(const IndexedDelaunay& t, Point2D p) const {
+  const int c = cell(p);
+  for (int o = firstOverlapping[c]; o < firstOverlapping[c + 1]; ++o) {
+    const IndexedTriangle& tri = t.triangles[overlapping[o]];
+    const int corners[3] = {tri.a, tri.b, tri.c};
+    bool inside = true;
+    for (int k = 0; k < 3 && inside; ++k) {
+      const Point2D& a = t.vertices[corners[k]];
+      const Point2D& b = t.vertices[corners[(k + 1) % 3]];
+      inside = (b - a).cross(p - a) >= 0.f;
+    }
+    if (inside) {
+      return overlapping[o];
+    }
+  }
+  return -1;
+}
+
+int PointLocator::locate(const IndexedDelaunay& t, Point2D p) const {
+  if (cellTriangle.empty()) {
+    return -1;
+  }
+  int i = cellTriangle[cell(p)];
+  // a visibility walk always ends in a Delaunay triangulation, the bound
+  // only guards against rounding. It can leave a boundary which is not
+  // convex, or stop in a masked triangle overlapping an unmasked one
+  // where locations almost coincide
+  for (size_t step = 0; step <= t.triangles.size(); ++step) {
+    const IndexedTriangle& tri = t.triangles[i];
+    const int corners[3] = {tri.a, tri.b, tri.c};
+    int next = i;
+    for (int k = 0; k < 3; ++k) {
+      const Point2D& a = t.vertices[corners[k]];
+      const Point2D& b = t.vertices[corners[(k + 1) % 3]];
+      // corners are counter-clockwise, so p lies beyond an edge it is to
+      // the right of
+      if ((b - a).cross(p - a) < 0.f) {
+        next = neighbours[i][k];
+        break;
+      }
+    }
+    if (next == i && !t.isTriangleMasked(i)) {
+      return i;
+    }
+    if (next == i || next < 0) {
+      break;
+    }
+    i = next;
+  }
+  return scanCell(t, p);
+}
+
+int PointLocator::descend(const IndexedDelaunay& t, Point2D p,
+                          int start) const {
+  int v = start;
+  float best = (t.vertices[v] - p).lengthSquared();
+  auto moveCloser = [&](int from) {
+    bool moved = false;
+    for (int a = firstAdjacent[from]; a < firstAdjacent[from + 1]; ++a) {
+      const float d = (t.vertices[adjacent[a]] - p).lengthSquared();
+      if (d < best) {
+        best = d;
+        v = adjacent[a];
+        moved = true;
+      }
+    }
+    return moved;
+  };
+  for (bool moved = true; moved;) {
+    while (moveCloser(v)) {}
+    // rounding can leave overlapping triangles where locations almost
+    // coincide, hiding a closer vertex one step further on
+    moved = false;
+    const int from = v;
+    for (int a = firstAdjacent[from]; a < firstAdjacent[from + 1]; ++a) {
+      moved = moveCloser(adjacent[a]) || moved;
+    }
+  }
+  return v;
+}
+
+int PointLocator::nearestVertex(const IndexedDelaunay& t, Point2D p) const {
+  if (cellTriangle.empty()) {
+    // fewer than three vertices, or all on a line
+    int nearest = -1;
+    float best = std::numeric_limits<float>::infinity();
+    for (int v = 0; v < t.vertices.size(); ++v) {
+      const float d = (t.vertices[v] - p).lengthSquared();
+      if (d < best) {
+        best = d;
+        nearest = v;
+      }
+    }
+    return nearest;
+  }
+  const IndexedTriangle& tri = t.triangles[cellTriangle[cell(p)]];
+  int start = tri.a;
+  for (int corner : {tri.b, tri.c}) {
+    if ((t.vertices[corner] - p).lengthSquared()
+        < (t.vertices[start] - p).lengthSquared()) {
+      start = corner;
+    }
+  }
+  return descend(t, p, start);
+}
+
+size_t PointLocator::memoryUsage() const {
+  return vectorBytes(neighbours) + vectorBytes(firstAdjacent)
+    + vectorBytes(adjacent) + vectorBytes(cellTriangle)
+    + vectorBytes(firstOverlapping) + vectorBytes(overlapping);
+}
@@ -0,0 +1,82 @@
+//  Copyright 2022 Peter Aisher
+//
+//  point_locator.h
+//  NetGen
+//
+
+#ifndef point_locator_h
+#define point_locator_h
+
+#include <array>
+#include <vector>
+#include "vector2.h"
+#include "indexed_delaunay.h"
+
+/// Finds the triangle of a triangulation containing a point, and the
+/// vertex nearest to a point
+///
+/// A uniform grid gives a triangle near any point, holding about one
+/// vertex per cell. Point location walks from there towards the point,
+/// crossing an edge the point lies beyond. The boundary of the
+/// triangulation need not be convex, so a walk can leave it before
+/// reaching the point; the triangles overlapping the point's cell are
+/// then tested one by one. The nearest vertex is found by moving
+/// from the nearest corner of that triangle to any neighbour closer to
+/// the point: a vertex not nearest always has a Delaunay neighbour closer.
+///
+/// Queries only read the index, so any number of threads may run them at
+/// once.
+class PointLocator {
+  /// the triangle across edge k of triangle t, from corner k to corner
+  /// k + 1, at neighbours[t][k], or -1 on the boundary
+  std::vector<std::array<int, 3>> neighbours {};
+  /// vertices adjacent to vertex v are adjacent[firstAdjacent[v]] to
+  /// adjacent[firstAdjacent[v + 1] - 1]
+  std::vector<int> firstAdjacent {};
+  std::vector<int> adjacent {};
+  /// a triangle in or near each grid cell
+  std::vector<int> cellTriangle {};
+  /// unmasked triangles whose bounds overlap grid cell c are
+  /// overlapping[firstOverlapping[c]] to
+  /// overlapping[firstOverlapping[c + 1] - 1]
+  std::vector<int> firstOverlapping {};
+  std::vector<int> overlapping {};
+  Point2D origin {0.f, 0.f};
+  float cellSize = 1.f;
+  int columns = 0;
+  int rows = 0;
+
+  inline int cell(Point2D p) const;
+  /// The unmasked triangle containing a point, found by testing those
+  /// overlapping its cell
+  int scanCell(const IndexedDelaunay& t, Point2D p) const;
+  /// The vertex of a triangulation nearest to a point, found by moving to
+  /// closer neighbours from a starting vertex
+  int descend(const IndexedDelaunay& t, Point2D p, int start) const;
+
+ public:
+  /// Construct an empty locator
+  inline PointLocator() {}
+
+  /// Index a triangulation
+  /// @param t the triangulation, which queries must be given unchanged
+  void build(const IndexedDelaunay& t);
+
+  /// The triangle containing a point
+  /// @param t the triangulation the locator was built for
+  /// @param p the point
+  /// @returns the index of the triangle, or -1 if the point lies outside
+  /// the triangulation or in a masked triangle
+  int locate(const IndexedDelaunay& t, Point2D p) const;
+
+  /// The vertex nearest to a point
+  /// @param t the triangulation the locator was built for
+  /// @param p the point
+  /// @returns the index of the vertex, or -1 if there are none
+  int nearestVertex(const IndexedDelaunay& t, Point2D p) const;
+
+  /// Bytes allocated by the locator
+  size_t memoryUsage() const;
+};
+
+#endif /* point_locator_h */
@@ -0,0 +1,102 @@
+//  Copyright 2022 Peter Aisher
+//
+//  scenario_flows.h
+//  NetGen
+//
+
+#ifndef scenario_flows_h
+#define scenario_flows_h
+
+#include <array>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "cargo_graph.h"
+#include "memory_usage.h"
+
+/// Edge flows and supplier capacities of one scenario, kept as changes
+/// to a cargo graph shared read-only with other scenarios
+///
+/// Only edges and suppliers which the scenario has changed are stored,
+/// everything else is read from the graph. Changed edges are listed by
+/// their first node, so reading an edge of a node without changes costs
+/// one test, and otherwise a scan of at most its degree.
+class ScenarioFlows {
+  typedef std::array<float, WagonTypeCount> Flows;
+
+  /// flows of changed edges (x, y) at changedEdges[x], as pairs of y and
+  /// the flows, keyed as stored in the graph: (x, y) holds cargo
+  /// travelling from y to x
+  std::vector<std::vector<std::pair<int, Flows>>> changedEdges {};
+  /// remaining capacity of changed suppliers
+  std::unordered_map<int, float> capacities {};
+
+ public:
+  /// Construct without changes
+  inline ScenarioFlows() {}
+
+  /// The flows of an edge
+  /// @param x the first node of the edge, as stored in the graph
+  /// @param y the second node of the edge
+  /// @param stored the flows the shared graph stores for (x, y)
+  inline const Flows& flows(int x, int y, const Flows& stored) const {
+    if (static_cast<size_t>(x) >= changedEdges.size()) {
+      return stored;
+    }
+    for (const auto& edge : changedEdges[x]) {
+      if (edge.first == y) {
+        return edge.second;
+      }
+    }
+    return stored;
+  }
+
+  /// The flows of an edge, for modification
+  /// @param x the first node of the edge, as stored in the graph
+  /// @param y the second node of the edge
+  /// @param stored the flows the shared graph stores for (x, y), which
+  /// the scenario starts from
+  inline Flows& writableFlows(int x, int y, const Flows& stored) {
+    if (static_cast<size_t>(x) >= changedEdges.size()) {
+      changedEdges.resize(x + 1);
+    }
+    for (auto& edge : changedEdges[x]) {
+      if (edge.first == y) {
+        return edge.second;
+      }
+    }
+    changedEdges[x].emplace_back(y, stored);
+    return changedEdges[x].back().second;
+  }
+
+  /// The remaining capacity of a supplier
+  /// @param node the supplier
+  /// @param stored the capacity the shared graph stores
+  inline float capacity(int node, float stored) const {
+    if (capacities.empty()) {
+      return stored;
+    }
+    auto it = capacities.find(node);
+    return it == capacities.end() ? stored : it->second;
+  }
+
+  /// The remaining capacity of a supplier, for modification
+  /// @param node the supplier
+  /// @param stored the capacity the shared graph stores, which the
+  /// scenario starts from
+  inline float& writableCapacity(int node, float stored) {
+    return capacities.emplace(node, stored).first->second;
+  }
+
+  /// Bytes allocated for the changes
+  inline size_t memoryUsage() const {
+    size_t bytes = vectorBytes(changedEdges) + hashNodeBytes(capacities)
+      + hashBucketBytes(capacities);
+    for (const auto& edges : changedEdges) {
+      bytes += vectorBytes(edges);
+    }
+    return bytes;
+  }
+};
+
+#endif /* scenario_flows_h */
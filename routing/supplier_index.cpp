@@ -0,0 +1,61 @@
+//  Copyright 2022 Peter Aisher
+//
+//  supplier_index.cpp
+//  NetGen
+//
+
+#include "supplier_index.h"
+#include "memory_usage.h"
+
+void SupplierIndex::build(const CargoGraph& graph, int nodeCount,
+                          const std::vector<CargoType>& outputTypes) {
+  componentOfNode.assign(nodeCount, -1);
+  int componentCount = 0;
+  std::vector<int> stack;
+  for (int start = 0; start < nodeCount; ++start) {
+    if (componentOfNode[start] >= 0) {
+      continue;
+    }
+    componentOfNode[start] = componentCount;
+    stack.push_back(start);
+    while (!stack.empty()) {
+      int u = stack.back();
+      stack.pop_back();
+      for (const auto& v_gr : graph.neighbors(u)) {
+        if (componentOfNode[v_gr.first] < 0) {
+          componentOfNode[v_gr.first] = componentCount;
+          stack.push_back(v_gr.first);
+        }
+      }
+    }
+    ++componentCount;
+  }
+
+  suppliers.assign(static_cast<size_t>(componentCount) * CargoTypeCount,
+                   Suppliers());
+  this->outputTypes = outputTypes;
+  capacities.assign(outputTypes.size(), 0.f);
+  for (int i = 0; i < outputTypes.size(); ++i) {
+    auto capacity = graph.nodes.find(i);
+    capacities[i] = capacity == graph.nodes.end() ? 0.f : capacity->second;
+    suppliers[componentOfNode[i] * CargoTypeCount + outputTypes[i]]
+      .emplace(capacities[i], i);
+  }
+}
+
+void SupplierIndex::capacityChanged(int supplier, float capacity) {
+  Suppliers& s = suppliers[componentOfNode[supplier] * CargoTypeCount
+                           + outputTypes[supplier]];
+  s.erase({capacities[supplier], supplier});
+  capacities[supplier] = capacity;
+  s.emplace(capacity, supplier);
+}
+
+size_t SupplierIndex::memoryUsage() const {
+  size_t bytes = vectorBytes(componentOfNode) + vectorBytes(suppliers)
+    + vectorBytes(outputTypes) + vectorBytes(capacities);
+  for (const auto& s : suppliers) {
+    bytes += setNodeBytes(s);
+  }
+  return bytes;
+}
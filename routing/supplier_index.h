@@ -0,0 +1,86 @@
+//  Copyright 2022 Peter Aisher
+//
+//  supplier_index.h
+//  NetGen
+//
+
+#ifndef supplier_index_h
+#define supplier_index_h
+
+#include <set>
+#include <utility>
+#include <vector>
+#include "cargo_graph.h"
+#include "cargo_type.h"
+
+/// Suppliers of each cargo type ordered by remaining capacity, for each
+/// connected component of a cargo graph
+///
+/// Every node of a component can reach every other, so a consumer can be
+/// supplied if and only if the supplier with the most remaining capacity
+/// in its component has enough, which is found without searching.
+class SupplierIndex {
+  /// remaining capacity and node of suppliers, by remaining capacity
+  typedef std::set<std::pair<float, int>> Suppliers;
+
+  /// connected component of each node
+  std::vector<int> componentOfNode {};
+  /// suppliers of component c and cargo type t at c * CargoTypeCount + t
+  std::vector<Suppliers> suppliers {};
+  /// cargo type of each supplier
+  std::vector<CargoType> outputTypes {};
+  /// remaining capacity of each supplier, as held in the index
+  std::vector<float> capacities {};
+
+  inline const Suppliers& suppliersFor(int node, CargoType cargo) const {
+    return suppliers[componentOfNode[node] * CargoTypeCount + cargo];
+  }
+
+ public:
+  /// Construct an empty index
+  inline SupplierIndex() {}
+
+  /// Index the suppliers of a graph
+  /// @param graph the graph, whose node values are remaining capacities
+  /// @param nodeCount the number of nodes of the graph
+  /// @param outputTypes the cargo type of each supplier, suppliers being
+  /// the nodes 0 to outputTypes.size() - 1
+  void build(const CargoGraph& graph, int nodeCount,
+             const std::vector<CargoType>& outputTypes);
+
+  /// Whether the index has been built
+  inline bool isBuilt() const {return !componentOfNode.empty();}
+
+  /// Update the remaining capacity of a supplier
+  /// @param supplier the node of the supplier
+  /// @param capacity its new remaining capacity
+  void capacityChanged(int supplier, float capacity);
+
+  /// Whether any supplier reachable from a node has enough capacity
+  /// @param node the node of the consumer
+  /// @param cargo the cargo type needed
+  /// @param quantity the quantity needed
+  inline bool canSupply(int node, CargoType cargo, float quantity) const {
+    const Suppliers& s = suppliersFor(node, cargo);
+    return !s.empty() && s.rbegin()->first >= quantity;
+  }
+
+  /// Call a function for each reachable supplier with enough capacity
+  /// @param node the node of the consumer
+  /// @param cargo the cargo type needed
+  /// @param quantity the quantity needed
+  /// @param f function taking the node of a supplier
+  template <class F>
+  void forEachSupplier(int node, CargoType cargo, float quantity,
+                       F f) const {
+    const Suppliers& s = suppliersFor(node, cargo);
+    for (auto it = s.lower_bound({quantity, -1}); it != s.end(); ++it) {
+      f(it->second);
+    }
+  }
+
+  /// Bytes allocated by the index
+  size_t memoryUsage() const;
+};
+
+#endif /* supplier_index_h */
@@ -0,0 +1,412 @@
+//  Copyright 2022 Peter Aisher
+//
+//  tiled_network.cpp
+//  NetGen
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <unordered_set>
+#include "tiled_network.h"
+#include "cargo_graph.h"
+#include "indexed_delaunay.h"
+#include "memory_usage.h"
+
+size_t TiledNetwork::Tile::memoryUsage() const {
+  return vectorBytes(locations) + vectorBytes(firstEdge) + vectorBytes(edges);
+}
+
+TiledNetwork::TiledNetwork(std::string directory, float tileSize,
+                           float halo, size_t memoryBudget)
+: directory(directory), tileSize(tileSize), halo(halo),
+  memoryBudget(memoryBudget) {}
+
+TiledNetwork::~TiledNetwork() {
+  flush();
+}
+
+std::string TiledNetwork::locationFileName(int tile) const {
+  return directory + "/tile_" + std::to_string(tile) + ".locations";
+}
+
+std::string TiledNetwork::graphFileName(int tile) const {
+  return directory + "/tile_" + std::to_string(tile) + ".graph";
+}
+
+std::string TiledNetwork::crossEdgeFileName(int tile) const {
+  return directory + "/tile_" + std::to_string(tile) + ".cross";
+}
+
+int TiledNetwork::addLocation(Point2D position, CargoType output,
+                              float capacity) {
+  std::pair<int, int> cell {static_cast<int>(std::floor(position.x / tileSize)),
+                            static_cast<int>(std::floor(position.y / tileSize))};
+  auto inserted = tileOfCell.emplace(cell, tileCount());
+  int tile = inserted.first->second;
+  if (inserted.second) {
+    cellOfTile.push_back(cell);
+    tileLocationCount.push_back(0);
+    // start from an empty file, spills append to it
+    std::ofstream(locationFileName(tile), std::ios::binary | std::ios::trunc);
+  }
+  int id = nodeCount();
+  tileOfLocation.push_back(tile);
+  indexInTile.push_back(tileLocationCount[tile]++);
+  spillBuffers[tile].push_back({position, id, output, capacity});
+  if (++spillBufferedCount >= spillBufferLimit) {
+    spillLocations();
+  }
+  return id;
+}
+
+bool TiledNetwork::spillLocations() {
+  for (const auto& buffer : spillBuffers) {
+    std::ofstream out(locationFileName(buffer.first),
+                      std::ios::binary | std::ios::app);
+    out.write(reinterpret_cast<const char*>(buffer.second.data()),
+              buffer.second.size() * sizeof(Location));
+    if (!out) {
+      ioFailed = true;
+    }
+  }
+  spillBuffers.clear();
+  spillBufferedCount = 0;
+  return !ioFailed;
+}
+
+bool TiledNetwork::readLocations(int tile,
+                                 std::vector<Location>& locations) const {
+  locations.resize(tileLocationCount[tile]);
+  std::ifstream in(locationFileName(tile), std::ios::binary);
+  in.read(reinterpret_cast<char*>(locations.data()),
+          locations.size() * sizeof(Location));
+  return static_cast<bool>(in);
+}
+
+bool TiledNetwork::triangulateTile(int tile) {
+  std::vector<Location> own;
+  if (!readLocations(tile, own)) {
+    return false;
+  }
+  // own locations first, then those of the halo
+  std::vector<Point2D> points;
+  std::vector<int> ids;
+  for (const auto& location : own) {
+    points.push_back(location.position);
+    ids.push_back(location.id);
+  }
+  const std::pair<int, int> cell = cellOfTile[tile];
+  const float minX = cell.first * tileSize - halo;
+  const float maxX = (cell.first + 1) * tileSize + halo;
+  const float minY = cell.second * tileSize - halo;
+  const float maxY = (cell.second + 1) * tileSize + halo;
+  const int reach = static_cast<int>(std::ceil(halo / tileSize));
+  std::vector<Location> other;
+  for (int dx = -reach; dx <= reach; ++dx) {
+    for (int dy = -reach; dy <= reach; ++dy) {
+      auto neighbor = tileOfCell.find({cell.first + dx, cell.second + dy});
+      if ((dx == 0 && dy == 0) || neighbor == tileOfCell.end()) {
+        continue;
+      }
+      if (!readLocations(neighbor->second, other)) {
+        return false;
+      }
+      for (const auto& location : other) {
+        const Point2D& p = location.position;
+        if (p.x >= minX && p.x < maxX && p.y >= minY && p.y < maxY) {
+          points.push_back(p);
+          ids.push_back(location.id);
+        }
+      }
+    }
+  }
+
+  std::vector<std::vector<int>> neighbors(own.size());
+  if (points.size() >= 3) {
+    IndexedDelaunay triangulation(points);
+    triangulation.maskSliverTrianglesOnBoundary(0.15);
+    CargoGraph graph(triangulation);
+    for (int a = 0; a < own.size(); ++a) {
+      for (const auto& b : graph.neighbors(a)) {
+        if (!impassableSegments.anyIntersects({points[a],
+                                               points[b.first]})) {
+          neighbors[a].push_back(b.first);
+        }
+      }
+    }
+  }
+
+  Tile t;
+  t.locations = std::move(own);
+  std::vector<std::pair<int, int>> crossEdges;
+  t.firstEdge.push_back(0);
+  for (int a = 0; a < neighbors.size(); ++a) {
+    std::sort(neighbors[a].begin(), neighbors[a].end(),
+              [&](int i, int j) {return ids[i] < ids[j];});
+    for (int b : neighbors[a]) {
+      Edge e {ids[b], (points[b] - points[a]).length(), {}, {}};
+      t.edges.push_back(e);
+      if (b >= t.locations.size()) {
+        crossEdges.emplace_back(ids[a], ids[b]);
+      }
+    }
+    t.firstEdge.push_back(static_cast<uint32_t>(t.edges.size()));
+  }
+  std::ofstream out(crossEdgeFileName(tile), std::ios::binary);
+  uint32_t crossEdgeCount = static_cast<uint32_t>(crossEdges.size());
+  out.write(reinterpret_cast<const char*>(&crossEdgeCount),
+            sizeof(crossEdgeCount));
+  out.write(reinterpret_cast<const char*>(crossEdges.data()),
+            crossEdges.size() * sizeof(crossEdges[0]));
+  return static_cast<bool>(out) && writeTile(tile, t);
+}
+
+bool TiledNetwork::stitchTile(int tile) {
+  Tile t;
+  if (!readTile(tile, t)) {
+    return false;
+  }
+  // edges other tiles found into this one, keyed by both ends
+  std::unordered_set<uint64_t> reverseEdges;
+  std::unordered_set<uint32_t> otherTiles;
+  for (const auto& e : t.edges) {
+    if (tileOfLocation[e.to] != tile) {
+      otherTiles.insert(tileOfLocation[e.to]);
+    }
+  }
+  auto key = [](int a, int b) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(a)) << 32
+      | static_cast<uint32_t>(b);
+  };
+  std::vector<std::pair<int, int>> crossEdges;
+  for (uint32_t other : otherTiles) {
+    std::ifstream in(crossEdgeFileName(other), std::ios::binary);
+    uint32_t crossEdgeCount = 0;
+    in.read(reinterpret_cast<char*>(&crossEdgeCount), sizeof(crossEdgeCount));
+    crossEdges.resize(crossEdgeCount);
+    in.read(reinterpret_cast<char*>(crossEdges.data()),
+            crossEdges.size() * sizeof(crossEdges[0]));
+    if (!in) {
+      return false;
+    }
+    for (const auto& e : crossEdges) {
+      if (tileOfLocation[e.second] == tile) {
+        reverseEdges.insert(key(e.second, e.first));
+      }
+    }
+  }
+
+  Tile stitched;
+  stitched.locations = std::move(t.locations);
+  stitched.firstEdge.push_back(0);
+  for (int a = 0; a < stitched.locations.size(); ++a) {
+    const int id = stitched.locations[a].id;
+    for (uint32_t k = t.firstEdge[a]; k < t.firstEdge[a + 1]; ++k) {
+      const Edge& e = t.edges[k];
+      if (tileOfLocation[e.to] == tile || reverseEdges.count(key(id, e.to))) {
+        stitched.edges.push_back(e);
+      }
+    }
+    stitched.firstEdge.push_back(static_cast<uint32_t>(stitched.edges.size()));
+  }
+  return writeTile(tile, stitched);
+}
+
+bool TiledNetwork::build() {
+  if (!spillLocations()) {
+    return false;
+  }
+  for (int t = 0; t < tileCount(); ++t) {
+    if (!triangulateTile(t)) {
+      ioFailed = true;
+      return false;
+    }
+  }
+  for (int t = 0; t < tileCount(); ++t) {
+    if (!stitchTile(t)) {
+      ioFailed = true;
+      return false;
+    }
+  }
+  for (int t = 0; t < tileCount(); ++t) {
+    std::remove(locationFileName(t).c_str());
+    std::remove(crossEdgeFileName(t).c_str());
+  }
+  return true;
+}
+
+bool TiledNetwork::readTile(int tile, Tile& t) const {
+  std::ifstream in(graphFileName(tile), std::ios::binary);
+  uint32_t counts[2] = {0, 0};
+  in.read(reinterpret_cast<char*>(counts), sizeof(counts));
+  t.locations.resize(counts[0]);
+  t.firstEdge.resize(counts[0] + 1);
+  t.edges.resize(counts[1]);
+  in.read(reinterpret_cast<char*>(t.locations.data()),
+          t.locations.size() * sizeof(Location));
+  in.read(reinterpret_cast<char*>(t.firstEdge.data()),
+          t.firstEdge.size() * sizeof(uint32_t));
+  in.read(reinterpret_cast<char*>(t.edges.data()),
+          t.edges.size() * sizeof(Edge));
+  t.dirty = false;
+  return static_cast<bool>(in);
+}
+
+bool TiledNetwork::writeTile(int tile, const Tile& t) {
+  std::ofstream out(graphFileName(tile), std::ios::binary | std::ios::trunc);
+  uint32_t counts[2] = {static_cast<uint32_t>(t.locations.size()),
+                        static_cast<uint32_t>(t.edges.size())};
+  out.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+  out.write(reinterpret_cast<const char*>(t.locations.data()),
+            t.locations.size() * sizeof(Location));
+  out.write(reinterpret_cast<const char*>(t.firstEdge.data()),
+            t.firstEdge.size() * sizeof(uint32_t));
+  out.write(reinterpret_cast<const char*>(t.edges.data()),
+            t.edges.size() * sizeof(Edge));
+  if (!out) {
+    ioFailed = true;
+  }
+  return static_cast<bool>(out);
+}
+
+TiledNetwork::Tile& TiledNetwork::tile(int tile) {
+  auto loaded = loadedTiles.find(tile);
+  if (loaded != loadedTiles.end()) {
+    tileUse.splice(tileUse.begin(), tileUse, tileUsePosition[tile]);
+    return loaded->second;
+  }
+  Tile t;
+  ++tileLoads;
+  if (!readTile(tile, t)) {
+    // route around what could not be read
+    ioFailed = true;
+    t.locations.assign(tileLocationCount[tile],
+                       {{0.f, 0.f}, -1, CargoTypeCount, 0.f});
+    t.firstEdge.assign(tileLocationCount[tile] + 1, 0);
+    t.edges.clear();
+  }
+  const size_t bytes = t.memoryUsage();
+  // the tile asked for is always loaded, even if it alone is over budget
+  while (!tileUse.empty() && loadedBytes + bytes > memoryBudget) {
+    int evicted = tileUse.back();
+    Tile& e = loadedTiles[evicted];
+    if (e.dirty) {
+      writeTile(evicted, e);
+    }
+    loadedBytes -= e.memoryUsage();
+    tileUse.pop_back();
+    tileUsePosition.erase(evicted);
+    loadedTiles.erase(evicted);
+  }
+  loadedBytes += bytes;
+  tileUse.push_front(tile);
+  tileUsePosition[tile] = tileUse.begin();
+  return loadedTiles[tile] = std::move(t);
+}
+
+TiledNetwork::Route
+TiledNetwork::shortestRoute(int consumer, CargoType need, float quantity,
+                            float costBound) {
+  Route route;
+  const WagonType w = cargoInfo.wagonTypeForCargo(need);
+  typedef std::pair<float, int> QueueEntry;
+  // closest first
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>,
+                      std::greater<QueueEntry>> frontier;
+  // the whole graph is not in memory, so scratch storage is only kept
+  // for nodes reached
+  std::unordered_map<int, float> distance {{consumer, 0.f}};
+  std::unordered_map<int, int> previous {{consumer, -1}};
+  std::unordered_set<int> settled;
+  frontier.emplace(0.f, consumer);
+
+  while (!frontier.empty()) {
+    auto u_pair = frontier.top();
+    frontier.pop();
+    float dist_u = u_pair.first;
+    int u = u_pair.second;
+    if (settled.count(u)) {
+      continue;  // stale entry
+    }
+    if (dist_u > costBound) {
+      route.cost = dist_u;
+      return route;
+    }
+    const Tile& t = tile(tileOfLocation[u]);
+    const uint32_t i = indexInTile[u];
+    const Location& location = t.locations[i];
+    if (location.output == need && location.capacity >= quantity) {
+      route.cost = dist_u;
+      route.supplier = u;
+      for (int v = u; v >= 0; v = previous[v]) {
+        route.path.push_back(v);
+      }
+      return route;
+    }
+    settled.insert(u);
+    for (uint32_t k = t.firstEdge[i]; k < t.firstEdge[i + 1]; ++k) {
+      const Edge& e = t.edges[k];
+      if (settled.count(e.to)) {
+        continue;
+      }
+      // cargo would travel from e.to to u
+      float alt = dist_u + edgeCostUsingCapacity(e.weight, e.inbound[w],
+                                                 e.outbound[w], quantity);
+      auto reached = distance.find(e.to);
+      if (reached == distance.end() || alt < reached->second) {
+        distance[e.to] = alt;
+        previous[e.to] = u;
+        frontier.emplace(alt, e.to);
+      }
+    }
+  }
+  return route;  // no supplier at any cost
+}
+
+void TiledNetwork::registerFlow(const Route& route, CargoType need,
+                                float quantity) {
+  const WagonType w = cargoInfo.wagonTypeForCargo(need);
+  // edges of a location are sorted by the node they lead to
+  auto edgeBetween = [&](int a, int b) -> Edge& {
+    Tile& t = tile(tileOfLocation[a]);
+    t.dirty = true;
+    const uint32_t i = indexInTile[a];
+    return *std::lower_bound(t.edges.begin() + t.firstEdge[i],
+                             t.edges.begin() + t.firstEdge[i + 1], b,
+                             [](const Edge& e, int to) {return e.to < to;});
+  };
+  // path is from supplier to consumer
+  for (size_t i = 0, j = 1; j < route.path.size(); ++i, ++j) {
+    int a = route.path[i];
+    int b = route.path[j];
+    edgeBetween(a, b).outbound[w] += quantity;
+    edgeBetween(b, a).inbound[w] += quantity;
+  }
+  Tile& t = tile(tileOfLocation[route.supplier]);
+  t.dirty = true;
+  t.locations[indexInTile[route.supplier]].capacity -= quantity;
+}
+
+TiledNetwork::Route TiledNetwork::connect(int consumer, CargoType need,
+                                          float quantity) {
+  Route route = shortestRoute(consumer, need, quantity);
+  if (route.supplier >= 0) {
+    registerFlow(route, need, quantity);
+  }
+  return route;
+}
+
+bool TiledNetwork::flush() {
+  bool ok = true;
+  for (auto& loaded : loadedTiles) {
+    if (loaded.second.dirty) {
+      ok = writeTile(loaded.first, loaded.second) && ok;
+      loaded.second.dirty = false;
+    }
+  }
+  return ok;
+}
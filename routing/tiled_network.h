@@ -0,0 +1,233 @@
+//  Copyright 2022 Peter Aisher
+//
+//  tiled_network.h
+//  NetGen
+//
+
+#ifndef tiled_network_h
+#define tiled_network_h
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "vector2.h"
+#include "segment_batch.h"
+#include "cargo_type.h"
+#include "wagon_type.h"
+#include "cargo_information.h"
+#include "industry.h"
+#include "town.h"
+
+/// Cargo network kept on disk in square tiles, for maps larger than memory
+///
+/// Locations are bucketed by tile as they are added and spilled to one
+/// file per tile. Each tile is then triangulated together with the
+/// locations of surrounding tiles within a halo of its border, and the
+/// edges at its own locations are written to a tile graph file. An edge
+/// between two tiles is kept only if both tiles found it, so the stitched
+/// graph is undirected.
+///
+/// Routing loads tile graphs on demand into a cache bounded by a memory
+/// budget, evicting the least recently used tiles and writing back those
+/// whose flows have changed.
+///
+/// @note apart from loaded tiles, eight bytes are held in memory for each
+/// location, to find its tile
+class TiledNetwork {
+ public:
+  /// A route found by a search
+  struct Route {
+    float cost = std::numeric_limits<float>::infinity();
+    /// the supplier, or -1 if none was found
+    int supplier = -1;
+    /// nodes from the supplier to the consumer
+    std::vector<int> path {};
+  };
+
+ private:
+  /// A location as stored in tile files
+  struct Location {
+    Point2D position;
+    int id;
+    /// cargo type produced, or CargoTypeCount for towns
+    CargoType output;
+    /// remaining output capacity
+    float capacity;
+  };
+
+  /// An edge at a location, as stored in tile graph files
+  struct Edge {
+    int to;
+    float weight;
+    /// flow of each wagon type travelling from `to` to this location
+    std::array<float, WagonTypeCount> inbound;
+    /// flow of each wagon type travelling from this location to `to`
+    std::array<float, WagonTypeCount> outbound;
+  };
+
+  /// The graph of one tile, in compressed sparse row form
+  struct Tile {
+    std::vector<Location> locations {};
+    /// edges of location i are firstEdge[i] to firstEdge[i + 1] - 1
+    std::vector<uint32_t> firstEdge {};
+    std::vector<Edge> edges {};
+    bool dirty = false;
+    size_t memoryUsage() const;
+  };
+
+  std::string directory;
+  float tileSize;
+  float halo;
+  size_t memoryBudget;
+  CargoInformation cargoInfo;
+  SegmentBatch impassableSegments;
+
+  /// tile number of each grid cell holding locations
+  std::map<std::pair<int, int>, int> tileOfCell {};
+  /// grid cell of each tile
+  std::vector<std::pair<int, int>> cellOfTile {};
+  /// number of locations in each tile
+  std::vector<uint32_t> tileLocationCount {};
+  /// tile of each location, and its index within the tile
+  std::vector<uint32_t> tileOfLocation {};
+  std::vector<uint32_t> indexInTile {};
+
+  /// locations added but not yet spilled to their tile files
+  std::unordered_map<int, std::vector<Location>> spillBuffers {};
+  size_t spillBufferedCount = 0;
+
+  /// loaded tiles, and their order of use, most recent first
+  std::unordered_map<int, Tile> loadedTiles {};
+  std::list<int> tileUse {};
+  std::unordered_map<int, std::list<int>::iterator> tileUsePosition {};
+  size_t loadedBytes = 0;
+  size_t tileLoads = 0;
+
+  /// set once a tile file could not be read or written
+  bool ioFailed = false;
+
+  /// Locations spilled to the tile files before they are written
+  static constexpr size_t spillBufferLimit = 1 << 16;
+
+  std::string locationFileName(int tile) const;
+  std::string graphFileName(int tile) const;
+  std::string crossEdgeFileName(int tile) const;
+
+  /// Add a location to the spill buffer of its tile
+  int addLocation(Point2D position, CargoType output, float capacity);
+  /// Append all buffered locations to their tile files
+  bool spillLocations();
+  /// Read the locations of a tile
+  bool readLocations(int tile, std::vector<Location>& locations) const;
+  /// Triangulate a tile with its halo and write its graph and the edges
+  /// it shares with other tiles
+  bool triangulateTile(int tile);
+  /// Drop edges to other tiles which those tiles did not find
+  bool stitchTile(int tile);
+
+  bool readTile(int tile, Tile& t) const;
+  bool writeTile(int tile, const Tile& t);
+
+  /// A loaded tile, paging it in and others out as needed
+  ///
+  /// @note references stay valid until the next call
+  Tile& tile(int tile);
+
+ public:
+  /// Construct an empty network stored in a directory
+  /// @param directory an existing directory for the tile files
+  /// @param tileSize the side length of a tile
+  /// @param halo the distance beyond its border from which a tile takes
+  /// locations when triangulating, which should exceed the typical
+  /// spacing of locations
+  /// @param memoryBudget the most bytes of tile graphs kept in memory
+  TiledNetwork(std::string directory, float tileSize, float halo,
+               size_t memoryBudget);
+
+  /// Writes back changed tiles
+  ~TiledNetwork();
+
+  /// Add industry
+  /// @param industry add this industry to the network
+  /// @returns the node index of the industry
+  inline int addIndustry(Industry industry) {
+    return addLocation(industry.location(), industry.outputType(),
+                       industry.maxOutput());
+  }
+
+  /// Add town
+  /// @param town add this town to the network
+  /// @returns the node index of the town
+  inline int addTown(const Town& town) {
+    return addLocation(town.location(), CargoTypeCount, 0.f);
+  }
+
+  /// Add impassable line
+  /// @param line edges crossing this line will not be part of the network
+  ///
+  /// @note lines must be added before the network is built
+  inline void addImpassableLine(const Line2D& line) {
+    impassableSegments.addLine(line);
+  }
+
+  /// Triangulate all tiles and write their graphs to disk
+  /// @returns false if a tile file could not be read or written
+  ///
+  /// @note locations must all be added before the network is built
+  bool build();
+
+  /// The number of nodes
+  inline int nodeCount() const {
+    return static_cast<int>(tileOfLocation.size());
+  }
+
+  /// The number of tiles
+  inline int tileCount() const {return static_cast<int>(cellOfTile.size());}
+
+  /// Shortest route from a consumer to a supplier using empty capacity
+  /// @param consumer the node of the consumer
+  /// @param need the cargo type needed
+  /// @param quantity the quantity needed
+  /// @param costBound give up once every remaining route costs more
+  /// @returns the cheapest route to a supplier with enough remaining
+  /// capacity, or a route without supplier if there is none within
+  /// costBound, whose cost is then a lower bound, or infinite if there
+  /// is no supplier at all
+  Route shortestRoute(int consumer, CargoType need, float quantity,
+                      float costBound = std::numeric_limits<float>::infinity());
+
+  /// Register the flow of a route and use up the capacity of its supplier
+  /// @param route the route, which must have a supplier
+  /// @param need the cargo type carried
+  /// @param quantity the quantity carried
+  void registerFlow(const Route& route, CargoType need, float quantity);
+
+  /// Route a quantity to a consumer from the cheapest supplier, and
+  /// register its flow
+  /// @returns the route taken, without supplier if there is none
+  Route connect(int consumer, CargoType need, float quantity);
+
+  /// Write all changed tiles to disk
+  /// @returns false if a tile could not be written
+  bool flush();
+
+  /// Whether all tile files have been read and written successfully
+  ///
+  /// @note a tile which could not be read is routed as if its locations
+  /// had no edges and no capacity
+  inline bool good() const {return !ioFailed;}
+
+  /// Bytes of tile graphs currently in memory
+  inline size_t memoryUsage() const {return loadedBytes;}
+
+  /// The number of times a tile was read from disk
+  inline size_t tileLoadCount() const {return tileLoads;}
+};
+
+#endif /* tiled_network_h */
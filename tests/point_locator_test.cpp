@@ -0,0 +1,96 @@
+//  Copyright 2022 Peter Aisher
+//
+//  point_locator_test.cpp
+//  NetGen
+//
+//  Compares PointLocator against brute force on random triangulations.
+//  Build with the sources in routing/, vector/ and data/, for example
+//  g++ -std=c++17 -O2 -Irouting -Ivector -Idata tests/point_locator_test.cpp
+//    routing/*.cpp vector/*.cpp data/*.cpp
+//  and run without arguments; exits with a failure status on any mismatch.
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "indexed_delaunay.h"
+#include "point_locator.h"
+
+namespace {
+
+bool contains(const IndexedDelaunay& t, int i, Point2D p) {
+  const IndexedTriangle& tri = t.allTriangles()[i];
+  const int corners[3] = {tri.a, tri.b, tri.c};
+  for (int k = 0; k < 3; ++k) {
+    const Point2D& a = t.allVertices()[corners[k]];
+    const Point2D& b = t.allVertices()[corners[(k + 1) % 3]];
+    if ((b - a).cross(p - a) < 0.f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Check queries spread beyond the bounds of n random points
+/// @returns the number of mismatches
+int check(int n, int queries, unsigned seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<float> coordinate(0.f, 10000.f);
+  std::uniform_real_distribution<float> query(-1000.f, 11000.f);
+  std::vector<Point2D> points;
+  for (int i = 0; i < n; ++i) {
+    points.emplace_back(coordinate(random), coordinate(random));
+  }
+  IndexedDelaunay t(points);
+  t.maskSliverTrianglesOnBoundary(0.15);
+  PointLocator locator;
+  locator.build(t);
+
+  const int triangleCount = static_cast<int>(t.allTriangles().size());
+  int misses = 0;
+  int wrongTriangles = 0;
+  int wrongVertices = 0;
+  for (int q = 0; q < queries; ++q) {
+    const Point2D p(query(random), query(random));
+    bool inside = false;
+    for (int i = 0; i < triangleCount && !inside; ++i) {
+      inside = !t.isTriangleMasked(i) && contains(t, i, p);
+    }
+    const int found = locator.locate(t, p);
+    if (found < 0 && inside) {
+      ++misses;
+    } else if (found >= 0
+               && (t.isTriangleMasked(found) || !contains(t, found, p))) {
+      ++wrongTriangles;
+    }
+
+    float best = (points.front() - p).lengthSquared();
+    for (const Point2D& v : points) {
+      best = std::min(best, (v - p).lengthSquared());
+    }
+    const int nearest = locator.nearestVertex(t, p);
+    if (nearest < 0 || (points[nearest] - p).lengthSquared() != best) {
+      ++wrongVertices;
+    }
+  }
+  if (misses + wrongTriangles + wrongVertices > 0) {
+    std::cerr << n << " points, seed " << seed << ": " << misses
+              << " points inside not located, " << wrongTriangles
+              << " located in a triangle not containing them, "
+              << wrongVertices << " wrong nearest vertices\n";
+  }
+  return misses + wrongTriangles + wrongVertices;
+}
+
+}  // namespace
+
+int main() {
+  int failures = 0;
+  for (unsigned seed = 1; seed <= 4; ++seed) {
+    failures += check(600, 25000, seed);
+  }
+  failures += check(3, 1000, 5);
+  failures += check(5000, 5000, 6);
+  std::cout << (failures == 0 ? "passed" : "FAILED") << "\n";
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
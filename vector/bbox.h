@@ -15,8 +15,8 @@ struct BBox {
   inline void extendToInclude(Point2D point) {
     bl.x = fmin(bl.x, point.x);
     bl.y = fmin(bl.y, point.y);
-    tr.x = fmax(bl.x, point.x);
-    tr.y = fmax(bl.y, point.y);
+    tr.x = fmax(tr.x, point.x);
+    tr.y = fmax(tr.y, point.y);
   }
   BBox(LineSegment& l) {
     bl.x = fmin(l.a.x, l.b.x);
@@ -0,0 +1,49 @@
+//  Copyright 2022 Peter Aisher
+//
+//  hilbert.h
+//  NetGen
+//
+
+#ifndef hilbert_h
+#define hilbert_h
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include "vector2.h"
+#include "bbox.h"
+
+/// Position of a point along a Hilbert curve filling a box
+/// @param p the point
+/// @param bounds the box, points outside it are moved to its edge
+/// @param order the number of bits per axis, at most 31
+/// @returns the distance along the curve, so that points close on the
+/// curve are close in the box
+inline uint64_t hilbertIndex(Point2D p, const BBox& bounds, int order = 16) {
+  const uint32_t cells = uint32_t(1) << order;
+  auto cell = [cells](float v, float lo, float hi) {
+    float t = hi > lo ? (v - lo) / (hi - lo) : 0.f;
+    t = std::min(std::max(t, 0.f), 1.f);
+    return std::min(static_cast<uint32_t>(t * cells), cells - 1);
+  };
+  uint32_t x = cell(p.x, bounds.bl.x, bounds.tr.x);
+  uint32_t y = cell(p.y, bounds.bl.y, bounds.tr.y);
+  uint64_t d = 0;
+  for (uint32_t s = cells / 2; s > 0; s /= 2) {
+    const uint32_t rx = (x & s) ? 1 : 0;
+    const uint32_t ry = (y & s) ? 1 : 0;
+    d += uint64_t(s) * s * ((3 * rx) ^ ry);
+    // rotate the quadrant so that the curve within it starts and ends
+    // at the right corners
+    if (ry == 0) {
+      if (rx == 1) {
+        x = cells - 1 - x;
+        y = cells - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+#endif /* hilbert_h */
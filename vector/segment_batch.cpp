@@ -0,0 +1,160 @@
+//  Copyright 2022 Peter Aisher
+//
+//  segment_batch.cpp
+//  NetGen
+//
+
+#include "segment_batch.h"
+#include "simd_support.h"
+
+namespace {
+
+/// Pointers to the padded coordinate arrays of a segment batch
+struct SegmentArrays {
+  const float* ax;
+  const float* ay;
+  const float* bx;
+  const float* by;
+  size_t paddedCount;
+};
+
+typedef bool (*IntersectionKernel)(const SegmentArrays&, const LineSegment&);
+
+bool anyIntersectsScalar(const SegmentArrays& arr, const LineSegment& s) {
+  for (size_t i = 0; i < arr.paddedCount; ++i) {
+    LineSegment t({arr.ax[i], arr.ay[i]}, {arr.bx[i], arr.by[i]});
+    if (s.intersects(t)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef NETGEN_X86_SIMD
+
+// The vector kernels evaluate the same products and differences as
+// pointsAreCCW, in the same order, so they agree exactly with the
+// scalar test.
+
+bool anyIntersectsSSE(const SegmentArrays& arr, const LineSegment& s) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 pax = _mm_set1_ps(s.a.x);
+  const __m128 pay = _mm_set1_ps(s.a.y);
+  const __m128 pbx = _mm_set1_ps(s.b.x);
+  const __m128 pby = _mm_set1_ps(s.b.y);
+  const __m128 dx = _mm_set1_ps(s.b.x - s.a.x);
+  const __m128 dy = _mm_set1_ps(s.b.y - s.a.y);
+  for (size_t i = 0; i < arr.paddedCount; i += 4) {
+    const __m128 qax = _mm_loadu_ps(arr.ax + i);
+    const __m128 qay = _mm_loadu_ps(arr.ay + i);
+    const __m128 qbx = _mm_loadu_ps(arr.bx + i);
+    const __m128 qby = _mm_loadu_ps(arr.by + i);
+    // pointsAreCCW(s.a, t.a, t.b) and pointsAreCCW(s.b, t.a, t.b)
+    __m128 c1 = _mm_sub_ps(
+      _mm_mul_ps(_mm_sub_ps(qax, pax), _mm_sub_ps(qby, pay)),
+      _mm_mul_ps(_mm_sub_ps(qay, pay), _mm_sub_ps(qbx, pax)));
+    __m128 c2 = _mm_sub_ps(
+      _mm_mul_ps(_mm_sub_ps(qax, pbx), _mm_sub_ps(qby, pby)),
+      _mm_mul_ps(_mm_sub_ps(qay, pby), _mm_sub_ps(qbx, pbx)));
+    // pointsAreCCW(s.a, s.b, t.a) and pointsAreCCW(s.a, s.b, t.b)
+    __m128 c3 = _mm_sub_ps(_mm_mul_ps(dx, _mm_sub_ps(qay, pay)),
+                           _mm_mul_ps(dy, _mm_sub_ps(qax, pax)));
+    __m128 c4 = _mm_sub_ps(_mm_mul_ps(dx, _mm_sub_ps(qby, pay)),
+                           _mm_mul_ps(dy, _mm_sub_ps(qbx, pax)));
+    __m128 sides = _mm_xor_ps(_mm_cmpgt_ps(c1, zero), _mm_cmpgt_ps(c2, zero));
+    __m128 ends = _mm_xor_ps(_mm_cmpgt_ps(c3, zero), _mm_cmpgt_ps(c4, zero));
+    if (_mm_movemask_ps(_mm_and_ps(sides, ends))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+__attribute__((target("avx2")))
+bool anyIntersectsAVX2(const SegmentArrays& arr, const LineSegment& s) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 pax = _mm256_set1_ps(s.a.x);
+  const __m256 pay = _mm256_set1_ps(s.a.y);
+  const __m256 pbx = _mm256_set1_ps(s.b.x);
+  const __m256 pby = _mm256_set1_ps(s.b.y);
+  const __m256 dx = _mm256_set1_ps(s.b.x - s.a.x);
+  const __m256 dy = _mm256_set1_ps(s.b.y - s.a.y);
+  for (size_t i = 0; i < arr.paddedCount; i += 8) {
+    const __m256 qax = _mm256_loadu_ps(arr.ax + i);
+    const __m256 qay = _mm256_loadu_ps(arr.ay + i);
+    const __m256 qbx = _mm256_loadu_ps(arr.bx + i);
+    const __m256 qby = _mm256_loadu_ps(arr.by + i);
+    __m256 c1 = _mm256_sub_ps(
+      _mm256_mul_ps(_mm256_sub_ps(qax, pax), _mm256_sub_ps(qby, pay)),
+      _mm256_mul_ps(_mm256_sub_ps(qay, pay), _mm256_sub_ps(qbx, pax)));
+    __m256 c2 = _mm256_sub_ps(
+      _mm256_mul_ps(_mm256_sub_ps(qax, pbx), _mm256_sub_ps(qby, pby)),
+      _mm256_mul_ps(_mm256_sub_ps(qay, pby), _mm256_sub_ps(qbx, pbx)));
+    __m256 c3 = _mm256_sub_ps(_mm256_mul_ps(dx, _mm256_sub_ps(qay, pay)),
+                              _mm256_mul_ps(dy, _mm256_sub_ps(qax, pax)));
+    __m256 c4 = _mm256_sub_ps(_mm256_mul_ps(dx, _mm256_sub_ps(qby, pay)),
+                              _mm256_mul_ps(dy, _mm256_sub_ps(qbx, pax)));
+    __m256 sides = _mm256_xor_ps(_mm256_cmp_ps(c1, zero, _CMP_GT_OQ),
+                                 _mm256_cmp_ps(c2, zero, _CMP_GT_OQ));
+    __m256 ends = _mm256_xor_ps(_mm256_cmp_ps(c3, zero, _CMP_GT_OQ),
+                                _mm256_cmp_ps(c4, zero, _CMP_GT_OQ));
+    if (_mm256_movemask_ps(_mm256_and_ps(sides, ends))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif  // NETGEN_X86_SIMD
+
+IntersectionKernel selectKernel() {
+  switch (detectSimdLevel()) {
+#ifdef NETGEN_X86_SIMD
+    case SimdLevel::AVX2:
+      return anyIntersectsAVX2;
+    case SimdLevel::SSE:
+      return anyIntersectsSSE;
+#endif
+    default:
+      return anyIntersectsScalar;
+  }
+}
+
+}  // namespace
+
+void SegmentBatch::add(const LineSegment& s) {
+  if (count == ax.size()) {
+    size_t padded = ax.size() + batchWidth;
+    ax.resize(padded, 0.f);
+    ay.resize(padded, 0.f);
+    bx.resize(padded, 0.f);
+    by.resize(padded, 0.f);
+  }
+  ax[count] = s.a.x;
+  ay[count] = s.a.y;
+  bx[count] = s.b.x;
+  by[count] = s.b.y;
+  ++count;
+}
+
+void SegmentBatch::addLine(const Line2D& line) {
+  for (int i = 0, j = 1; j < line.size(); ++i, ++j) {
+    add({line[i], line[j]});
+  }
+}
+
+void SegmentBatch::clear() {
+  ax.clear();
+  ay.clear();
+  bx.clear();
+  by.clear();
+  count = 0;
+}
+
+bool SegmentBatch::anyIntersects(const LineSegment& s) const {
+  static const IntersectionKernel kernel = selectKernel();
+  if (count == 0) {
+    return false;
+  }
+  return kernel({ax.data(), ay.data(), bx.data(), by.data(), ax.size()}, s);
+}
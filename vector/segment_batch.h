@@ -0,0 +1,53 @@
+//  Copyright 2022 Peter Aisher
+//
+//  segment_batch.h
+//  NetGen
+//
+
+#ifndef segment_batch_h
+#define segment_batch_h
+
+#include <vector>
+#include "vector2.h"
+
+/// Structure-of-arrays store of line segments
+///
+/// End point coordinates are kept in separate arrays, padded to a whole
+/// number of batches, so that a segment can be tested against up to
+/// eight stored segments at once using AVX2 or SSE where available.
+class SegmentBatch {
+  /* end point coordinates, padded with degenerate segments at the origin */
+  std::vector<float> ax {};
+  std::vector<float> ay {};
+  std::vector<float> bx {};
+  std::vector<float> by {};
+  size_t count = 0;
+
+ public:
+  /// Number of segments processed per batch
+  static constexpr size_t batchWidth = 8;
+
+  /// Construct an empty store
+  inline SegmentBatch() {}
+
+  /// Add a segment
+  /// @param s the segment to add
+  void add(const LineSegment& s);
+
+  /// Add every segment of a polyline
+  /// @param line the polyline whose segments should be added
+  void addLine(const Line2D& line);
+
+  /// Remove all segments
+  void clear();
+
+  /// The number of stored segments
+  inline size_t size() const {return count;}
+
+  /// Does a segment intersect any stored segment
+  /// @param s the segment to test
+  /// @returns true if `s.intersects(t)` holds for any stored segment `t`
+  bool anyIntersects(const LineSegment& s) const;
+};
+
+#endif /* segment_batch_h */
@@ -0,0 +1,35 @@
+//  Copyright 2022 Peter Aisher
+//
+//  simd_support.h
+//  NetGen
+//
+
+#ifndef simd_support_h
+#define simd_support_h
+
+#if !defined(NETGEN_DISABLE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define NETGEN_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/// Instruction set levels used by the batch geometry kernels
+enum class SimdLevel {
+  Scalar, SSE, AVX2
+};
+
+/// The widest instruction set level supported by the running CPU
+///
+/// @note defining NETGEN_DISABLE_SIMD forces the scalar fallback
+inline SimdLevel detectSimdLevel() {
+#ifdef NETGEN_X86_SIMD
+  if (__builtin_cpu_supports("avx2")) {
+    return SimdLevel::AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return SimdLevel::SSE;
+  }
+#endif
+  return SimdLevel::Scalar;
+}
+
+#endif /* simd_support_h */
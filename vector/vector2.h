@@ -74,7 +74,7 @@ struct LineSegment {
       && (pointsAreCCW(a, b, s.a) != pointsAreCCW(a, b, s.b));
   }
   inline LineSegment(const Point2D& a, const Point2D& b) : a(a), b(b) {};
-  inline bool intersectsLine(Line2D line) const {
+  inline bool intersectsLine(const Line2D& line) const {
     for (int i = 0, j = 1; j < line.size(); ++i, ++j) {
       LineSegment l(line[i], line[j]);
       if ((*this).intersects(l)) {